@@ -15,19 +15,32 @@
 #ifndef CALLCONTEXT_H
 #define CALLCONTEXT_H
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Support/CallSite.h"
+#include "llvm/Support/ErrorHandling.h"
 
-#include <deque>
-#include <set>
+#include <algorithm>
+#include <cassert>
 #include <stdint.h>
 
+#include <pthread.h>
+
 namespace llvm {
 
+class Function;
+class Instruction;
+
 // ContextManage -
 // Provide lightweight canonical reference's to Context objects.
 // Goal is to abstract away which Context type is being used,
 // as well as make them cheap to copy spuriously.
 // Similar to LLVM's FoldingSet.
+// Safe to use from several threads at once.
+//
+// Contexts are hash-consed into an arena of fixed-size chunks, and their
+// ContextIDs are dense indices into it, so they may index arrays. Context
+// types must be default constructible, copyable, and provide
+// ==, hash() and an empty default value.
 typedef uintptr_t ContextID;
 // DefaultID - Special-case (what ContextID zero-init's to)
 // that is used to respresent an empty context.
@@ -35,108 +48,215 @@ static const ContextID DefaultID = 0;
 template<class C>
 class ContextManager {
 public:
+  ContextManager() : NumContexts(0) {
+    ::pthread_mutex_init(&Lock, NULL);
+    std::fill(Chunks, Chunks + MaxChunks, (C *)NULL);
+    // The empty context is always DefaultID
+    C initial;
+    getIDFor(initial);
+  }
 
   // getIDFor - Return a canonical ContextID for the given Context
-  ContextID getIDFor(C & c) {
+  ContextID getIDFor(const C & c) {
+    ::pthread_mutex_lock(&Lock);
     // Try to find a match in our set of contexts...
-    typename CSet::iterator I = Contexts.find((ContextID)&c);
+    typename CMap::iterator I = Contexts.find(&c);
     // If we don't already have on like this, add a copy
     if (I == Contexts.end()) {
-      I = Contexts.insert((ContextID)new C(c)).first;
+      ContextID ID = allocateID();
+      C &Copy = Chunks[ID / ChunkSize][ID % ChunkSize];
+      Copy = c;
+      I = Contexts.insert(std::make_pair(&Copy, ID)).first;
     }
     // Return the reference to the canonical object
-    return *I;
+    ContextID ID = I->second;
+    ::pthread_mutex_unlock(&Lock);
+    return ID;
+  }
+
+  // getAnonymousID - Return a new ContextID that no Context maps to, for
+  // analysis state that belongs to no calling context in particular.
+  // getContextFor returns the empty context for it.
+  ContextID getAnonymousID() {
+    ::pthread_mutex_lock(&Lock);
+    ContextID ID = allocateID();
+    ::pthread_mutex_unlock(&Lock);
+    return ID;
   }
 
   // getContextFor - Return the Context object corresponding to the given ID
   const C & getContextFor(ContextID ID) const {
-    // Special-case for 'default' ContextIDs
-    if (ID == DefaultID) return initial;
+    // Canonical objects are never moved or modified, so only the sanity
+    // check needs the lock. Whoever was handed ID saw its chunk created.
+#ifndef NDEBUG
+    ::pthread_mutex_lock(&Lock);
+    assert(ID < NumContexts && "Unknown context!");
+    ::pthread_mutex_unlock(&Lock);
+#endif
+    return Chunks[ID / ChunkSize][ID % ChunkSize];
+  }
 
-    // Otherwise just return what the ID points to
-    assert(Contexts.count(ID));
-    return *(C*)ID;
+  // numContexts - The number of distinct contexts, which are numbered
+  // below it
+  size_t numContexts() const {
+    ::pthread_mutex_lock(&Lock);
+    size_t N = NumContexts;
+    ::pthread_mutex_unlock(&Lock);
+    return N;
   }
 
-  // Free all allocated context objects
+  // Free all allocated context objects but the empty one
   void clear() {
-    for(typename CSet::iterator I = Contexts.begin(), E = Contexts.end();
-        I != E; ++I)
-      delete (C*)*I;
+    ::pthread_mutex_lock(&Lock);
     Contexts.clear();
+    for (unsigned i = 0; i != MaxChunks; ++i) {
+      delete [] Chunks[i];
+      Chunks[i] = NULL;
+    }
+    NumContexts = 0;
+    ::pthread_mutex_unlock(&Lock);
+    C initial;
+    getIDFor(initial);
   }
 
   // Destructor
   ~ContextManager() {
-    clear();
+    for (unsigned i = 0; i != MaxChunks; ++i)
+      delete [] Chunks[i];
+    ::pthread_mutex_destroy(&Lock);
   }
 
 private:
-  // Comparator type, compares the ID's by comparing their dereferenced values
-  struct CompareID {
-    bool operator()(const ContextID &A, const ContextID &B) const {
-      return *(C*)A < *(C*)B;
+  ContextManager(const ContextManager &);
+  ContextManager &operator=(const ContextManager &);
+
+  // allocateID - The next ContextID, with its chunk created. Called with
+  // Lock held. The chunk table is never reallocated, since getContextFor
+  // reads it without the lock, so running out of it is fatal.
+  ContextID allocateID() {
+    if (NumContexts == MaxChunks * ChunkSize) {
+      ::pthread_mutex_unlock(&Lock);
+      report_fatal_error("Too many calling contexts, try a smaller "
+                         "-deps-context-budget");
+    }
+    ContextID ID = NumContexts++;
+    C *&Chunk = Chunks[ID / ChunkSize];
+    if (!Chunk) Chunk = new C[ChunkSize];
+    return ID;
+  }
+
+  // Hashes and compares contexts through pointers to them, so that
+  // contexts not in the arena can be looked up too
+  struct ContextInfo {
+    static const C *getEmptyKey() { return DenseMapInfo<const C *>::getEmptyKey(); }
+    static const C *getTombstoneKey() { return DenseMapInfo<const C *>::getTombstoneKey(); }
+    static unsigned getHashValue(const C *c) { return c->hash(); }
+    static bool isEqual(const C *A, const C *B) {
+      if (A == B) return true;
+      if (A == getEmptyKey() || A == getTombstoneKey() ||
+          B == getEmptyKey() || B == getTombstoneKey()) return false;
+      return *A == *B;
     }
   };
 
-  typedef std::set<ContextID,CompareID> CSet;
-  CSet Contexts;
-  C initial;
+  // 4M contexts
+  static const unsigned ChunkSize = 1024;
+  static const unsigned MaxChunks = 4096;
+
+  typedef DenseMap<const C *, ContextID, ContextInfo> CMap;
+  CMap Contexts;
+  C *Chunks[MaxChunks];
+  ContextID NumContexts;
+  mutable pthread_mutex_t Lock;
 };
 
 // Context types:
 
-class CallerContext {
-  /// CallerContext is a thin wrapper around stl's deque with
-  /// a custom < operator to support using CallerContext's
-  /// as keys in a map.
-  typedef std::deque<const Function*> callers_type;
+/// FixedContext - The last (up to) K elements of a chain of calls, oldest
+/// first, stored inline along with their hash. Pushing onto a full context
+/// drops its oldest element, so contexts never exceed K elements.
+template<class T, unsigned K>
+class FixedContext {
 public:
-  /// CallerContext's are ordered by lexicographical comparison
-  /// over the deque of functions.
-  bool operator<(const CallerContext & that) const {
-    return std::lexicographical_compare(callers.begin(), callers.end(),
-                                        that.callers.begin(),
-                                        that.callers.end());
+  typedef const T *iterator;
+
+  FixedContext() : length(0), hashValue(0) { }
+
+  /// FixedContexts are ordered by lexicographical comparison over their
+  /// elements.
+  bool operator<(const FixedContext & that) const {
+    return std::lexicographical_compare(begin(), end(),
+                                        that.begin(), that.end());
+  }
+  bool operator==(const FixedContext & that) const {
+    return hashValue == that.hashValue && length == that.length &&
+           std::equal(begin(), end(), that.begin());
   }
 
-  void push_back(const ImmutableCallSite &cs) {
-    callers.push_back(cs.getInstruction()->getParent()->getParent());
+  void push_back(T element) {
+    if (K == 0) return;
+    if (length == K) {
+      std::copy(elements + 1, elements + K, elements);
+      --length;
+    }
+    elements[length++] = element;
+    rehash();
   }
-  size_t size() const { return callers.size(); }
-  void pop_front() { callers.pop_front(); }
-  void dump() const;
+  void pop_front() {
+    assert(length && "Empty context!");
+    std::copy(elements + 1, elements + length, elements);
+    --length;
+    rehash();
+  }
+
+  iterator begin() const { return elements; }
+  iterator end() const { return elements + length; }
+  size_t size() const { return length; }
+  unsigned hash() const { return hashValue; }
 
 private:
-  callers_type callers;
+  void rehash() {
+    hashValue = length;
+    for (unsigned i = 0; i != length; ++i)
+      hashValue = hashValue * 37 + DenseMapInfo<T>::getHashValue(elements[i]);
+  }
+
+  T elements[K ? K : 1];
+  unsigned length;
+  unsigned hashValue;
 };
 
-class CallSiteContext {
-  /// CallSiteContext is a thin wrapper around stl's deque with
-  /// a custom < operator to support using CallSiteContext's
-  /// as keys in a map.
-  typedef std::deque<ImmutableCallSite> sites_type;
+// Print the callers or call sites of a context, for debugging
+void dumpCallers(const Function *const *begin, const Function *const *end);
+void dumpCallSites(const Instruction *const *begin,
+                   const Instruction *const *end);
+
+/// CallerContext - The functions making the last K calls.
+template<unsigned K>
+class CallerContext : public FixedContext<const Function *, K> {
 public:
-  /// CallSiteContext's are ordered by lexicographical comparison
-  /// over the deque of callsites, using the instruction
-  /// address for CallSite comparison.
-  static bool compareCS(const ImmutableCallSite & LHS,
-                        const ImmutableCallSite & RHS) {
-    return LHS.getInstruction() < RHS.getInstruction();
+  void push_back(const ImmutableCallSite &cs) {
+    FixedContext<const Function *, K>::push_back(
+      cs.getInstruction()->getParent()->getParent());
   }
-  bool operator<(const CallSiteContext & that) const {
-    return std::lexicographical_compare(sites.begin(), sites.end(),
-                                        that.sites.begin(),
-                                        that.sites.end(),compareCS);
+  void push_back(const Function *F) {
+    FixedContext<const Function *, K>::push_back(F);
   }
+  void dump() const {
+    dumpCallers(this->begin(), this->end());
+  }
+};
 
-  void push_back(const ImmutableCallSite &cs) { sites.push_back(cs); }
-  size_t size() const { return sites.size(); }
-  void pop_front() { sites.pop_front(); }
-  void dump() const;
-
-private:
-  sites_type sites;
+/// CallSiteContext - The last K call sites, by their instructions.
+template<unsigned K>
+class CallSiteContext : public FixedContext<const Instruction *, K> {
+public:
+  void push_back(const ImmutableCallSite &cs) {
+    FixedContext<const Instruction *, K>::push_back(cs.getInstruction());
+  }
+  void dump() const {
+    dumpCallSites(this->begin(), this->end());
+  }
 };
 
 }
@@ -19,32 +19,49 @@
 #include "CallContext.h"
 #include "InterProcAnalysisPass.h"
 
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IntrinsicInst.h"
 
 #include "dsa/DSGraph.h"
 
+#include <pthread.h>
+#include <vector>
+
 namespace llvm {
 
 /// CallSensitiveAnalysisPass can be extended to implement a k-callsite
 /// sensitive interprocedural analysis. The parameters to the template
-/// are an input and output type for the user's analysis and a non-negative
-/// integer k.
+/// are an input and output type for the user's analysis, a non-negative
+/// integer k, and the context type, which is instantiated with k as the
+/// number of calls it keeps (CallerContext or CallSiteContext).
 ///
 /// The input and output types must implement the operators for
 /// <=, ==, and !=, and be default constructible.
 /// Furthermore, each should implement:
 ///  const T upperBound(const T & other) const
 /// Where the output should be the join of the instances.
-template<class I, class O, int K, class C>
+template<class I, class O, int K, template<unsigned> class C>
 class CallSensitiveAnalysisPass :
    public InterProcAnalysisPass<ContextID, I, O> {
 public:
   typedef AnalysisUnit<ContextID> AUnitType;
+  typedef C<K> Context;
 
-  explicit CallSensitiveAnalysisPass(char &pid, bool collapseExtContext, bool collapseIndContext) :
+  /// If contextBudget is not zero, each function is analyzed in at most
+  /// that many contexts besides DefaultID; calls in any further contexts
+  /// analyze it in DefaultID.
+  explicit CallSensitiveAnalysisPass(char &pid, bool collapseExtContext, bool collapseIndContext,
+                                     unsigned contextBudget = 0) :
     InterProcAnalysisPass<ContextID, I, O>(pid),
-    collapseInd(collapseIndContext), collapseExt(collapseExtContext) { }
+    collapseInd(collapseIndContext), collapseExt(collapseExtContext),
+    contextBudget(contextBudget) {
+    ::pthread_mutex_init(&budgetLock, NULL);
+  }
+
+  ~CallSensitiveAnalysisPass() {
+    ::pthread_mutex_destroy(&budgetLock);
+  }
 
 
   /// bottomInput - This method should be implemented by the subclass as the
@@ -77,9 +94,21 @@ public:
   /// getCallResult - Analyzes all possible callees and returns a summary
   /// by joining their analysis results.
   virtual const O getCallResult(const ImmutableCallSite & cs,  const I input) {
+    return callResult(cs, input, true);
+  }
+
+  /// requestCallees - Like getCallResult, but leaves out the signatures of
+  /// any external code the call site may invoke. For use by analyses that
+  /// accounted for those signatures already (e.g. in prepareContext(..)).
+  const O requestCallees(const ImmutableCallSite & cs, const I input) {
+    return callResult(cs, input, false);
+  }
+
+private:
+  const O callResult(const ImmutableCallSite & cs, const I input, bool useSignatures) {
     // if the call is an intrinsic, jump straight to using a signature
     if (isa<IntrinsicInst>(cs.getInstruction())) {
-      return signatureForExternalCall(cs, input);
+      return useSignatures ? signatureForExternalCall(cs, input) : bottomOutput();
     }
 
     // Compute what context callee's should be analyzed in.
@@ -88,9 +117,9 @@ public:
     // Fast-path direct calls
     if (const Function *F = cs.getCalledFunction()) {
         if (!F->isDeclaration()) {
-          return this->getAnalysisResult(AUnitType(newContext, *F), input);
+          return this->getAnalysisResult(AUnitType(budgetContext(*F, newContext), *F), input);
         } else {
-          return signatureForExternalCall(cs, input);
+          return useSignatures ? signatureForExternalCall(cs, input) : bottomOutput();
         }
     }
 
@@ -130,7 +159,7 @@ public:
         // If we have code, request analysis and add it to the output
         // otherwise use a signature
         if (!function->isDeclaration()) {
-          AUnitType unit = AUnitType(indirectContext, *function);
+          AUnitType unit = AUnitType(budgetContext(*function, indirectContext), *function);
           output = output.upperBound(this->getAnalysisResult(unit, input));
         } else {
           useExternalSignature = true;
@@ -160,7 +189,7 @@ public:
           if (!functionIsCallable(cs, function)) continue;
           // If we have code, analyze it, otherwise use a signature
           if (!function->isDeclaration()) {
-            AUnitType unit = AUnitType(externalContext, *function);
+            AUnitType unit = AUnitType(budgetContext(*function, externalContext), *function);
             output = output.upperBound(this->getAnalysisResult(unit, input));
           } else {
             useExternalSignature = true;
@@ -170,12 +199,14 @@ public:
 
     // If we call any declarations, use signature for this callsite
     // This only needs to be done once, since we don't specify callee.
-    if (useExternalSignature)
+    if (useExternalSignature && useSignatures)
       output = output.upperBound(signatureForExternalCall(cs, input));
 
     return output;
   }
 
+public:
+
   /// invokableCode - returns a set of function pointers to code that could
   /// be analyzed by calling getCallResult().
   /// XXX Hacky... should refactor so that we don't have to keep this code
@@ -192,7 +223,7 @@ public:
     if (const Function *F = cs.getCalledFunction()) {
       std::set<std::pair<const Function*, const ContextID> > single;
       if (!F->isDeclaration())
-        single.insert(std::pair<const Function *, const ContextID>(F,newContext));
+        single.insert(std::pair<const Function *, const ContextID>(F,budgetContext(*F, newContext)));
       return single;
     }
 
@@ -226,7 +257,7 @@ public:
           // If we have code, it would be analyzed by getCallResult()
           // otherwise use a signature
           if (!function->isDeclaration()) {
-            callees.insert(std::pair<const Function *, const ContextID>(function,indirectContext));
+            callees.insert(std::pair<const Function *, const ContextID>(function,budgetContext(*function, indirectContext)));
         } else {
           // The callee is either indirect or to an external function
           if (*callee == cg.getExternalCallingNode()) {
@@ -246,7 +277,7 @@ public:
           const Function *function = callee->second->getFunction();
           if (!functionIsCallable(cs, function)) continue;
           if (!function->isDeclaration()) {
-            callees.insert(std::pair<const Function *, const ContextID>(function,externalContext));
+            callees.insert(std::pair<const Function *, const ContextID>(function,budgetContext(*function, externalContext)));
           }
       }
     }
@@ -338,13 +369,10 @@ public:
   }
 
   /// To update a CallSiteContext, add the new call site to the list of call sites.
-  /// If there are more than K callsites in the list, drop the oldest.
+  /// Contexts hold at most K callsites, so this drops the oldest once full.
   ContextID updateContext(const ContextID c, const ImmutableCallSite &cs) {
-    C newContext = CM.getContextFor(c);
+    Context newContext = CM.getContextFor(c);
     newContext.push_back(cs);
-    while (newContext.size() > K) {
-      newContext.pop_front();
-    }
     return CM.getIDFor(newContext);
   }
 
@@ -352,16 +380,52 @@ public:
     return DefaultID;
   }
 
+  /// The context to analyze F in when it is called in context c. Within
+  /// the budget, that is c; once F has used up its budget, the contexts it
+  /// wasn't analyzed in already are merged into DefaultID. The decision
+  /// for each context is kept, so the units requested by getCallResult and
+  /// those listed by invokableCode agree. May be called from the threads
+  /// preparing units.
+  ContextID budgetContext(const Function &F, const ContextID c) {
+    if (!contextBudget || c == DefaultID) return c;
+    ::pthread_mutex_lock(&budgetLock);
+    DenseSet<ContextID> &contexts = budgetedContexts[&F];
+    ContextID result = c;
+    if (!contexts.count(c)) {
+      if (contexts.size() < contextBudget) {
+        contexts.insert(c);
+      } else {
+        if (demotedSet.insert(&F).second) demoted.push_back(&F);
+        result = DefaultID;
+      }
+    }
+    ::pthread_mutex_unlock(&budgetLock);
+    return result;
+  }
+
+  /// The functions that ran out of their context budget, in the order they
+  /// did
+  const std::vector<const Function *> &demotedFunctions() const {
+    return demoted;
+  }
+
   /// getAnalysisUsage - Derived methods must call this implementation.
   virtual void getAnalysisUsage(AnalysisUsage &Info) const {
     InterProcAnalysisPass<ContextID,I,O>::getAnalysisUsage(Info);
   }
 
 protected:
-  ContextManager<C> CM;
+  ContextManager<Context> CM;
 private:
   bool collapseInd;
   bool collapseExt;
+
+  unsigned contextBudget;
+  /// The contexts each function was allowed, besides DefaultID
+  DenseMap<const Function *, DenseSet<ContextID> > budgetedContexts;
+  DenseSet<const Function *> demotedSet;
+  std::vector<const Function *> demoted;
+  pthread_mutex_t budgetLock;
 };
 
 }
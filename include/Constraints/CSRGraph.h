@@ -0,0 +1,63 @@
+//===-- CSRGraph.h ----------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Immutable adjacency lists over densely numbered nodes, stored in
+// compressed sparse row form (an offset per node into one target array).
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef CSRGRAPH_H_
+#define CSRGRAPH_H_
+
+#include <utility>
+#include <vector>
+
+namespace deps {
+
+class CSRGraph {
+public:
+  typedef std::pair<unsigned, unsigned> Edge;
+  typedef std::vector<Edge> EdgeList;
+  typedef const unsigned *iterator;
+
+  CSRGraph() {}
+
+  /// Replace the contents of this graph with the given (From, To) edges
+  /// over the nodes [0, NumNodes), or with the (To, From) edges if Reverse
+  /// is given. Duplicate edges are kept.
+  void build(unsigned NumNodes, const EdgeList &Edges, bool Reverse = false);
+
+  /// Release all storage held by the graph.
+  void clear();
+
+  unsigned numNodes() const {
+    return Offsets.empty() ? 0 : Offsets.size() - 1;
+  }
+  unsigned numEdges() const { return Targets.size(); }
+
+  /// Successors of N. Nodes outside of the graph have no successors.
+  iterator succ_begin(unsigned N) const {
+    return N < numNodes() ? base() + Offsets[N] : base();
+  }
+  iterator succ_end(unsigned N) const {
+    return N < numNodes() ? base() + Offsets[N + 1] : base();
+  }
+
+private:
+  const unsigned *base() const {
+    return Targets.empty() ? 0 : &Targets[0];
+  }
+
+  std::vector<unsigned> Offsets;
+  std::vector<unsigned> Targets;
+};
+
+} // end namespace deps
+
+#endif // CSRGRAPH_H_
@@ -16,6 +16,9 @@
 #define CONSTRAINTKIT_H_
 
 #include "Constraints/DepsTypes.h"
+
+#include "llvm/ADT/StringRef.h"
+
 #include <set>
 #include <string>
 
@@ -31,14 +34,22 @@ public:
     virtual void variables(std::set<const ConsVar *> &) const = 0;
     virtual bool operator== (const ConsElem &elem) const = 0;
 
-    /// Support for llvm-style RTTI (isa<>, dyn_cast<>, etc.)
-    virtual DepsType type() const = 0;
+    /// Support for llvm-style RTTI (isa<>, dyn_cast<>, etc.). Not virtual,
+    /// the solvers tell elements apart in their inner loops.
+    DepsType type() const { return kind; }
 
     virtual ~ConsElem() {}
+protected:
+    explicit ConsElem(DepsType kind) : kind(kind) {}
+private:
+    const DepsType kind;
 };
 
 /// Interface distinguishing constraint variables
-class ConsVar : public ConsElem { };
+class ConsVar : public ConsElem {
+protected:
+    explicit ConsVar(DepsType kind) : ConsElem(kind) {}
+};
 
 /// Interface for querying the results of solving a constraint set
 class ConsSoln {
@@ -54,7 +65,7 @@ public:
 class ConstraintKit {
 public:
     /// Create a new constraint variable
-    virtual const ConsVar &newVar(const std::string) = 0;
+    virtual const ConsVar &newVar(const llvm::StringRef) = 0;
     /// Create a new constraint element by taking the upper bound of two
     /// existing elements
     virtual const ConsElem &upperBound(const ConsElem&, const ConsElem&) = 0;
@@ -0,0 +1,67 @@
+//===-- ConstraintStream.h --------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Constraints of one kind, stored as they are added in the form the solvers
+// build their graphs from (see -deps-stream-constraints).
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef CONSTRAINTSTREAM_H_
+#define CONSTRAINTSTREAM_H_
+
+#include "Constraints/CSRGraph.h"
+#include "Constraints/LHConstraint.h"
+
+#include "llvm/ADT/BitVector.h"
+
+#include <vector>
+
+namespace deps {
+
+class ConsElem;
+class LHConsVar;
+
+/// ConstraintStream - The constraints of a kind as a flat list of the
+/// edges between variables, and the variables a constant makes high (the
+/// seeds of the least solution) or low (those of the greatest). Each edge
+/// takes half the space of an LHConstraint, and SharedGraph builds its
+/// adjacency straight from the list. Constraints that can't change either
+/// solution, such as those between two constants, are dropped.
+class ConstraintStream {
+public:
+  ConstraintStream() : NumNodes(0) {}
+
+  /// Add lhs <= rhs. Neither may be a join.
+  void add(const ConsElem &lhs, const ConsElem &rhs);
+
+  bool empty() const {
+    return Edges.empty() && LeastSeeds.empty() && GreatestSeeds.empty();
+  }
+  size_t size() const {
+    return Edges.size() + LeastSeeds.size() + GreatestSeeds.size();
+  }
+
+  /// Append constraints equivalent to the stream to C, given the kit's
+  /// variables by index.
+  void appendTo(std::vector<LHConstraint> &C,
+                const std::vector<const LHConsVar *> &Vars) const;
+
+  /// Set the bits of the variables that appear in the stream.
+  void markUsed(llvm::BitVector &Used) const;
+
+  CSRGraph::EdgeList Edges;
+  // One more than the largest variable in Edges
+  unsigned NumNodes;
+  std::vector<unsigned> LeastSeeds;
+  std::vector<unsigned> GreatestSeeds;
+};
+
+} // end namespace deps
+
+#endif // CONSTRAINTSTREAM_H_
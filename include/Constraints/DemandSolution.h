@@ -0,0 +1,92 @@
+//===-- DemandSolution.h ----------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Query-driven solutions of L-H constraints. Rather than propagating all
+// constraints up front, each query searches the constraint graph from the
+// queried variable towards the constants that could change it.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef DEMANDSOLUTION_H_
+#define DEMANDSOLUTION_H_
+
+#include "Constraints/ConstraintKit.h"
+#include "Constraints/CSRGraph.h"
+#include "Constraints/LHConstraint.h"
+#include "Constraints/LHConstraints.h"
+#include "Constraints/SCCRemap.h"
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+
+#include <vector>
+
+namespace deps {
+
+/// The constraints of one kind, with the edges of the propagation map
+/// that PartialSolution would build reversed: from each variable to the
+/// variables that could change it. Seeds are the variables that a
+/// constant changes directly.
+class DemandGraph : public llvm::RefCountedBase<DemandGraph> {
+public:
+  /// Build the graph of C for a least (initial false) or greatest (initial
+  /// true) solution. If C has been condensed, Remap must describe the
+  /// collapsed components; the graph keeps a reference to it. C is not
+  /// stored.
+  DemandGraph(const std::vector<LHConstraint> &C, bool initial,
+              const llvm::IntrusiveRefCntPtr<SCCRemap> &Remap);
+
+  /// Is V changed directly by a constant?
+  bool isSeed(unsigned V) const;
+
+  /// Append the variables that could change V.
+  void appendPreds(unsigned V, std::vector<unsigned> &List) const;
+
+private:
+  unsigned rep(unsigned V) const;
+
+  CSRGraph Preds;
+  llvm::BitVector Seeds;
+  llvm::IntrusiveRefCntPtr<SCCRemap> Remap;
+};
+
+/// Solution to the union of the constraints of one or more DemandGraphs,
+/// equal to the corresponding PartialSolution. A variable is changed iff
+/// it can be reached from a seed; subst() finds out by searching backwards
+/// from the variable. Answers are remembered: a successful search marks
+/// the path it found, and a failed one everything it visited (whose
+/// backward cone it has then exhausted), so repeated queries get cheaper.
+class DemandSolution : public ConsSoln {
+public:
+  typedef std::vector<llvm::IntrusiveRefCntPtr<DemandGraph> > Graphs;
+
+  DemandSolution(const Graphs &G, bool initial) : G(G), initial(initial) {}
+
+  // Evaluate the given ConsElem in our solution environment
+  const LHConstant &subst(const ConsElem &E);
+
+private:
+  enum State { Unknown = 0, Changed, Unchanged };
+  struct Level;
+  friend struct Level;
+
+  bool isChanged(unsigned V);
+  unsigned char &state(unsigned V) {
+    if (V >= Memo.size()) Memo.resize(V + 1, Unknown);
+    return Memo[V];
+  }
+
+  Graphs G;
+  std::vector<unsigned char> Memo;
+  bool initial;
+};
+
+} // end namespace deps
+
+#endif // DEMANDSOLUTION_H_
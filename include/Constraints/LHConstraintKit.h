@@ -16,17 +16,30 @@
 #define LHCONSTRAINTKIT_H_
 
 #include "Constraints/ConstraintKit.h"
+#include "Constraints/ConstraintStream.h"
 #include "Constraints/LHConstraint.h"
+#include "Constraints/SCCRemap.h"
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/FoldingSet.h"
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/Allocator.h"
 
 #include <set>
 #include <map>
 #include <vector>
 
+namespace llvm {
+class raw_ostream;
+}
+
 namespace deps {
 
+class DemandGraph;
 class LHConstant;
 class LHConsVar;
 class LHJoin;
@@ -43,9 +56,10 @@ public:
     /// Get a reference to the constant "high" element of the lattice
     const ConsElem &highConstant() const;
     /// Create a new constraint variable
-    virtual const ConsVar &newVar(const std::string description);
+    virtual const ConsVar &newVar(const llvm::StringRef description);
     /// Create a new constraint element by taking the upper bound of two
-    /// existing elements
+    /// existing elements. Joins are flattened and deduplicated, low is
+    /// dropped from them, and a join of a single element is that element.
     virtual const ConsElem &upperBound(const ConsElem &e1, const ConsElem &e2);
     /// Create a new constraint element by taking the upper bound of two
     /// existing elements. Arguments and return type may be null.
@@ -53,8 +67,14 @@ public:
     /// Create a new constraint element by taking the upper bound of the
     /// given set of elements.
     virtual const ConsElem &upperBound(std::set<const ConsElem*> elems);
+    /// Create a new constraint element by taking the upper bound of the
+    /// given elements, which may repeat.
+    virtual const ConsElem &upperBound(llvm::ArrayRef<const ConsElem*> elems);
 
-    /// Add the constraint lhs <= rhs to the set "kind"
+    /// Add the constraint lhs <= rhs to the set "kind". If the kind was
+    /// solved already, the cached solutions for it are updated by
+    /// propagating just the new constraint (solutions handed out earlier
+    /// are not).
     virtual void addConstraint(const std::string kind, const ConsElem &lhs, const ConsElem &rhs);
     /// Find the lfp of the constraints in the "kinds" sets
     /// Unconstrained variables will be "Low" (caller delete)
@@ -62,26 +82,90 @@ public:
     /// Find the gfp of the constraints in the "kinds" sets
     /// Unconstrained variables will be "High" (caller delete)
     virtual ConsSoln *greatestSolution(const std::set<std::string> kinds);
+    /// Same as leastSolution, but elements are only solved for when they
+    /// are queried, by searching backwards through the constraints. Much
+    /// cheaper when only a few elements are queried. (caller delete)
+    ConsSoln *leastDemandSolution(const std::set<std::string> kinds);
+    /// Same as greatestSolution, but solved on demand (caller delete)
+    ConsSoln *greatestDemandSolution(const std::set<std::string> kinds);
 
     // Compute both least and greatest solutions simultaneously
     // for the given kind.
     void solveMT(std::string kind);
-    // Solve the given kinds in parallel (per thread limit)
-  std::vector<PartialSolution*> solveLeastMT(std::vector<std::string> kinds, bool useDefaultSinks);
+    /// Free everything but what the solutions handed out already need:
+    /// the cached solutions and propagation maps of every kind, the
+    /// constraints, and the descriptions of the variables. No constraints
+    /// may be added and no solutions asked for afterwards.
+    void compact();
+    /// Write the constraints of every kind in the format read by
+    /// deps-solver-bench. Kinds that have been solved appear condensed, or
+    /// empty once both of their solutions exist.
+    void writeConstraints(llvm::raw_ostream &OS) const;
+
+    // Solve the given kinds in parallel (per thread limit), each merged
+    // with the default solution(s). (caller delete)
+  std::vector<ConsSoln*> solveLeastMT(std::vector<std::string> kinds, bool useDefaultSinks);
+
+    /// Elements (variables) made high by each label, by label
+    typedef std::vector<std::pair<const ConsElem *, unsigned> > LabelSeeds;
+    /// Solve the default solution(s) for each of numLabels labels at once,
+    /// where each label makes its seeds high. Returns the least solution
+    /// of every label, as solveLeastMT would for a kind made of just the
+    /// label's seeds. (caller delete)
+    std::vector<ConsSoln*> solveLabels(const LabelSeeds &seeds, unsigned numLabels,
+                                       bool useDefaultSinks);
 private:
     static LHConstraintKit *singleton;
     llvm::StringMap<std::vector<LHConstraint> > constraints;
+    // Constraints of the kinds added with -deps-stream-constraints, until
+    // they are solved or something needs them as LHConstraints
+    llvm::StringMap<ConstraintStream> streams;
     std::set<std::string> lockedConstraintKinds;
+    // Set by compact()
+    bool compacted;
+
+    // Variables, joins and the element arrays of joins are allocated here,
+    // and are never freed individually.
+    llvm::BumpPtrAllocator allocator;
+    // Interned variable descriptions, which are mostly repeated value names
+    llvm::StringSet<llvm::BumpPtrAllocator> descriptions;
 
     std::vector<const LHConsVar *> vars;
-    std::set<LHJoin> joins;
+    llvm::FoldingSet<LHJoin> joins;
+
+    // Returns the upper bound of the given elements, none of which may be
+    // a join. Reorders elems.
+    const ConsElem &getOrCreateJoin(llvm::SmallVectorImpl<const ConsElem *> &elems);
 
     // Cached solutions for each kind
     llvm::StringMap<PartialSolution*> leastSolutions;
     llvm::StringMap<PartialSolution*> greatestSolutions;
 
+    // Components collapsed in each kind's constraints (see SCCRemap)
+    llvm::StringMap<llvm::IntrusiveRefCntPtr<SCCRemap> > remaps;
+
+    // Cached graphs for each kind, for demand solutions
+    llvm::StringMap<llvm::IntrusiveRefCntPtr<DemandGraph> > leastGraphs;
+    llvm::StringMap<llvm::IntrusiveRefCntPtr<DemandGraph> > greatestGraphs;
+
+    ConsSoln *demandSolution(const std::set<std::string> kinds, bool initial);
+
+    // Prevent further constraints from being added to the given kind,
+    // condensing its constraints if requested. Returns false if the kind
+    // was already locked.
+    bool lockKind(const std::string kind);
+    // Adds the size of a kind that is being locked to the PhaseReport
+    void reportKindSize(const std::string kind);
+    // Returns the remapping for the given kind, or NULL if none
+    const SCCRemap *remapFor(const std::string kind) const;
+    // Returns the representative of elem under Remap (which may be NULL)
+    const ConsElem &condense(const SCCRemap *Remap, const ConsElem &elem) const;
+    // Add lhs <= rhs to a kind that has been locked
+    void addToLockedKind(const std::string kind, const ConsElem &lhs, const ConsElem &rhs);
+
     void freeUnneededConstraints(std::string kind);
 
+    // The constraints of a kind, moving any streamed ones into it first
     std::vector<LHConstraint> &getOrCreateConstraintSet(const std::string kind);
 };
 
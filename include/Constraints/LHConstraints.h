@@ -16,7 +16,10 @@
 #define LHCONSTRAINTS_H_
 
 #include "Constraints/ConstraintKit.h"
-#include <string>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/FoldingSet.h"
+#include "llvm/ADT/StringRef.h"
 
 namespace deps {
 
@@ -35,9 +38,10 @@ public:
     /// Returns the least upper bound of two members of the L-H lattice
     virtual const LHConstant &join(const LHConstant & other) const;
     virtual bool operator== (const ConsElem& c) const;
+    /// Is this the high constant?
+    bool isHigh() const { return level == HIGH; }
 
     /// Support for llvm-style RTTI (isa<>, dyn_cast<>, etc.)
-    virtual DepsType type() const { return DT_LHConstant; }
     static inline bool classof(const LHConstant *) { return true; }
     static inline bool classof(const ConsElem *elem) {
         return elem->type() == DT_LHConstant;
@@ -55,8 +59,9 @@ protected:
 /// Concrete implementation of constraint variables for use with LHConstraintKit.
 class LHConsVar : public ConsVar {
 public:
-    /// Create a new variable with description
-    LHConsVar(const std::string desc);
+    /// Create a new variable with description and dense index. The
+    /// description is not copied, and must outlive the variable.
+    LHConsVar(llvm::StringRef desc, unsigned index);
     /// Compare two elements for constraint satisfaction
     virtual bool leq(const ConsElem &elem) const;
     /// Returns the singleton set containing this variable
@@ -64,45 +69,53 @@ public:
       set.insert(this);
     }
     virtual bool operator== (const ConsElem& c) const;
+    /// Returns the dense index of this variable, unique within its kit.
+    /// Variables are numbered consecutively from zero in creation order.
+    unsigned index() const { return idx; }
+    /// Returns the description given when the variable was created
+    llvm::StringRef description() const { return desc; }
 
     /// Support for llvm-style RTTI (isa<>, dyn_cast<>, etc.)
-    virtual DepsType type() const { return DT_LHConsVar; }
     static inline bool classof(const LHConsVar *) { return true; }
     static inline bool classof(const ConsVar *var) { return var->type() == DT_LHConsVar; }
     static inline bool classof(const ConsElem *elem) { return elem->type() == DT_LHConsVar; }
 private:
     LHConsVar(const LHConsVar &);
     LHConsVar& operator=(const LHConsVar&);
-    const std::string desc;
+    // Reset by LHConstraintKit::compact(), before it frees the descriptions
+    llvm::StringRef desc;
+    const unsigned idx;
+    friend class LHConstraintKit;
 };
 
 /// Constraint element representing the join of L-H lattice elements.
-class LHJoin : public ConsElem {
+/// Joins are hash-consed by LHConstraintKit, so equal joins are identical.
+class LHJoin : public ConsElem, public llvm::FoldingSetNode {
 public:
     /// Returns true if all of the elements of the join are leq(elem)
     virtual bool leq(const ConsElem &elem) const;
     /// Returns set of sub-elements that are constraint variables
     virtual void variables(std::set<const ConsVar *> & set) const;
-    /// Create a new constraint element by joining two existing constraints (caller delete)
-    static const LHJoin *create(const ConsElem &e1, const ConsElem &e2);
-    /// Returns the set of elements joined by this element
-    const std::set<const ConsElem *> & elements() const {
+    /// Returns the elements joined by this element, ordered by address
+    llvm::ArrayRef<const ConsElem *> elements() const {
       return elems;
     }
     virtual bool operator== (const ConsElem& c) const;
-    bool operator<(const LHJoin &c) const {
-      if (elems.size() != c.elems.size())
-        return elems.size() < c.elems.size();
-      return elems < c.elems;
-    }
+
+    /// Support for FoldingSet
+    void Profile(llvm::FoldingSetNodeID &ID) const { Profile(ID, elems); }
+    static void Profile(llvm::FoldingSetNodeID &ID,
+                        llvm::ArrayRef<const ConsElem *> elems);
 
     /// Support for llvm-style RTTI (isa<>, dyn_cast<>, etc.)
-    virtual DepsType type() const { return DT_LHJoin; }
     static inline bool classof(const LHJoin *) { return true; }
     static inline bool classof(const ConsElem *elem) { return elem->type() == DT_LHJoin; }
-    LHJoin(std::set<const ConsElem *> elems);
+    /// Create the join of the given elements, which must be ordered by
+    /// address and free of duplicates. The array is not copied, and must
+    /// outlive the join (see LHConstraintKit::upperBound).
+    explicit LHJoin(llvm::ArrayRef<const ConsElem *> elems);
 private:
-    const std::set<const ConsElem *> elems;
+    const llvm::ArrayRef<const ConsElem *> elems;
     LHJoin& operator=(const LHJoin&);
 };
 
@@ -0,0 +1,122 @@
+//===-- LaneSolution.h ------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Least solutions for many source kinds at once, each merged with the same
+// shared solution, propagated together one bit per kind.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LANESOLUTION_H_
+#define LANESOLUTION_H_
+
+#include "Constraints/ConstraintKit.h"
+#include "Constraints/LHConstraints.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/Support/DataTypes.h"
+
+#include <vector>
+
+namespace deps {
+
+class PartialSolution;
+
+/// LaneSolution - Solutions to Shared merged with each of a list of
+/// "lane" solutions, equal to copying each lane and merging Shared into
+/// it, but computed in one pass per 64 lanes instead of one per lane.
+///
+/// Variables changed in Shared are changed in every lane and are never
+/// propagated again. Every other changed variable carries a word with one
+/// bit per lane of its group, and propagating it follows the edges of
+/// Shared with the whole word, and each lane's own edges with just that
+/// lane's bit. Groups of lanes are solved in parallel on the ThreadPool.
+///
+/// Lanes may also be just seeds, with no constraints of their own, which
+/// makes each one a label of the powerset lattice of labels (see
+/// BitmaskLattice): a variable is changed in a lane iff the label reaches
+/// it, and every label reaches the variables changed in Shared.
+class LaneSolution : public llvm::RefCountedBase<LaneSolution> {
+public:
+  /// A variable, by index, changed in the given lane from the start
+  struct Seed {
+    Seed(unsigned Var, unsigned Lane) : Var(Var), Lane(Lane) {}
+    unsigned Var;
+    unsigned Lane;
+  };
+
+  /// Solve all the lanes. Takes ownership of Shared, which must still be
+  /// chained to the solutions merged into it. Lanes are least solutions
+  /// built by the normal constructor; they are not owned and only used
+  /// during construction.
+  LaneSolution(PartialSolution *Shared,
+               const std::vector<PartialSolution*> &Lanes);
+  /// Solve NumLanes lanes that have only the given seeds. Shared is as
+  /// above.
+  LaneSolution(PartialSolution *Shared, const std::vector<Seed> &Seeds,
+               unsigned NumLanes);
+  ~LaneSolution();
+
+  unsigned numLanes() const { return NumLanes; }
+
+  /// Lanes are solved, and evaluated, in groups of this many
+  static const unsigned LanesPerGroup = 64;
+
+  /// Is V changed in the merged solution of the given lane?
+  bool isChanged(unsigned V, unsigned Lane) const;
+
+  /// The level of E in each lane of a group, bit i for lane
+  /// Group * LanesPerGroup + i: E evaluated over BitmaskLattice<64>.
+  uint64_t levels(const ConsElem &E, unsigned Group) const;
+
+private:
+  LaneSolution(const LaneSolution &);
+  LaneSolution &operator=(const LaneSolution &);
+
+  typedef uint64_t Word;
+  typedef llvm::DenseMap<unsigned, Word> WordMap;
+
+  class GroupTask;
+  friend class GroupTask;
+  struct Propagator;
+  friend struct Propagator;
+  struct GroupLevel;
+  friend struct GroupLevel;
+
+  // Solve every group on the pool
+  void solveGroups(const std::vector<PartialSolution*> &Lanes,
+                   const std::vector<Seed> &Seeds);
+  // Solve the lanes [Group*64, Group*64+64). Lanes is empty for lanes
+  // with only seeds.
+  void solveGroup(unsigned Group, const std::vector<PartialSolution*> &Lanes,
+                  const std::vector<Seed> &Seeds);
+
+  PartialSolution *Shared;
+  // Words of the variables not changed in Shared, per group
+  std::vector<WordMap> Groups;
+  unsigned NumLanes;
+};
+
+/// LaneView - The solution of a single lane of a LaneSolution.
+class LaneView : public ConsSoln {
+public:
+  LaneView(const llvm::IntrusiveRefCntPtr<LaneSolution> &S, unsigned Lane)
+    : S(S), Lane(Lane) {}
+
+  // Evaluate the given ConsElem in our solution environment
+  const LHConstant &subst(const ConsElem &E);
+
+private:
+  llvm::IntrusiveRefCntPtr<LaneSolution> S;
+  unsigned Lane;
+};
+
+} // end namespace deps
+
+#endif // LANESOLUTION_H_
@@ -0,0 +1,101 @@
+//===-- Lattice.h -----------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Lattices as compile-time policies, and the evaluation of the constraint
+// elements built by LHConstraintKit over them without virtual calls.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LATTICE_H_
+#define LATTICE_H_
+
+#include "Constraints/LHConstraints.h"
+
+#include "llvm/Support/DataTypes.h"
+#include "llvm/Support/ErrorHandling.h"
+
+namespace deps {
+
+/// TwoPointLattice - The L-H lattice. Levels are plain bools, true being
+/// high.
+struct TwoPointLattice {
+  typedef bool Level;
+
+  static Level bottom() { return false; }
+  static Level top() { return true; }
+  static Level join(Level A, Level B) { return A || B; }
+  static bool leq(Level A, Level B) { return !A || B; }
+
+  /// The level of one of the L-H constants
+  static Level constant(const LHConstant &C) { return C.isHigh(); }
+};
+
+/// BitmaskLattice - The powerset lattice of 1 to 64 taint labels, each
+/// level a mask of the labels that reach. High stands for every label.
+/// LaneSolution propagates its levels, 64 labels at a time.
+template <unsigned NumLabels>
+struct BitmaskLattice {
+  typedef uint64_t Level;
+
+  // More labels don't fit in a Level
+  typedef char NumLabelsFitInALevel[NumLabels >= 1 && NumLabels <= 64 ? 1 : -1];
+
+  static Level bottom() { return 0; }
+  static Level top() {
+    return NumLabels == 64 ? ~uint64_t(0) : (uint64_t(1) << NumLabels) - 1;
+  }
+  static Level join(Level A, Level B) { return A | B; }
+  static bool leq(Level A, Level B) { return (A & ~B) == 0; }
+
+  static Level constant(const LHConstant &C) { return C.isHigh() ? top() : bottom(); }
+};
+
+/// LatticeKernel - The operations the solvers need on constraint
+/// elements, for the lattice policy L. L provides a Level type, bottom(),
+/// top(), join(), leq() and the level of each L-H constant. Everything is
+/// inline, and elements are told apart by their type tag.
+template <class L>
+struct LatticeKernel {
+  typedef typename L::Level Level;
+
+  /// Evaluate E, where Var(index) is the level of the variable with that
+  /// index. Joins are flat, so this recurses at most once.
+  template <class VarFn>
+  static Level eval(const ConsElem &E, const VarFn &Var) {
+    switch (E.type()) {
+    case DT_LHConsVar:
+      return Var(static_cast<const LHConsVar &>(E).index());
+    case DT_LHConstant:
+      return L::constant(static_cast<const LHConstant &>(E));
+    case DT_LHJoin: {
+      llvm::ArrayRef<const ConsElem *> Elems =
+        static_cast<const LHJoin &>(E).elements();
+      Level Result = L::bottom();
+      for (llvm::ArrayRef<const ConsElem *>::iterator I = Elems.begin(),
+           End = Elems.end(); I != End; ++I)
+        Result = L::join(Result, eval(**I, Var));
+      return Result;
+    }
+    }
+    llvm_unreachable("Unknown constraint element");
+  }
+
+  /// Is the constant side of a constraint the bottom of the lattice?
+  static bool isBottom(const ConsElem &Constant) {
+    assert(Constant.type() == DT_LHConstant && "Expected a constant!");
+    return L::leq(L::constant(static_cast<const LHConstant &>(Constant)),
+                  L::bottom());
+  }
+};
+
+typedef LatticeKernel<TwoPointLattice> LHKernel;
+
+}
+
+#endif /* LATTICE_H_ */
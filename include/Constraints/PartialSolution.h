@@ -15,28 +15,81 @@
 #define _PARTIAL_SOLUTION_H_
 
 #include "Constraints/ConstraintKit.h"
+#include "Constraints/CSRGraph.h"
 #include "Constraints/LHConstraintKit.h"
 #include "Constraints/LHConstraints.h"
+#include "Constraints/SCCRemap.h"
 
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/DenseMap.h"
-#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
 
 #include <vector>
 
 namespace deps {
 
+/// SharedGraph - The propagation edges of a set of constraints in both
+/// directions, along with the seeds of its least and greatest solutions,
+/// all found in one scan of the constraints. The least and the greatest
+/// PartialSolution of the constraints can then both be built over it,
+/// instead of each building a propagation map of its own.
+class SharedGraph : public llvm::RefCountedBase<SharedGraph> {
+public:
+  SharedGraph(const std::vector<LHConstraint> &C);
+  // Same, but taking the edges and seeds of S, which is left empty
+  SharedGraph(ConstraintStream &S);
+
+  // Edges from lhs to rhs, followed by the least solution
+  CSRGraph Forward;
+  // Edges from rhs to lhs, followed by the greatest solution
+  CSRGraph Backward;
+  // Variables a constant makes high, or low
+  std::vector<unsigned> LeastSeeds;
+  std::vector<unsigned> GreatestSeeds;
+};
+
+/// PartialSolution - Solution to one or more chained sets of constraints.
+/// Variables are identified by their dense LHConsVar index. Depending on
+/// -deps-dense-solver, the set of non-default variables and the propagation
+/// map are kept either in hash tables (sparse mode) or as a bitvector and a
+/// CSRGraph (dense mode). Chained solutions may use different modes.
+///
+/// The VSet of a solution always holds the union of the VSets of every
+/// solution chained to it, so queries never need to consult the chain.
+///
+/// If the constraints were condensed with SCCRemap::collapse, the
+/// propagation map is over representatives only, but VSet still holds
+/// every member of each changed component.
+///
+/// Adding constraints, or merging in another solution, can only add
+/// variables to VSet, whether solving for the least or the greatest
+/// solution. Both are therefore done by propagating just the newly
+/// changed variables, and the edges that were not followed yet.
 class PartialSolution : public ConsSoln {
 public:
   // Exported types:
-  typedef llvm::SmallPtrSet<const ConsVar*,1> VarSet;
-  typedef llvm::DenseMap<const ConsVar*, std::vector<const ConsVar*> > PMap;
+  typedef llvm::DenseSet<unsigned> VarSet;
+  typedef llvm::DenseMap<unsigned, std::vector<unsigned> > PMap;
   typedef std::vector<LHConstraint> Constraints;
 
-  // Constructor, constraints aren't stored
-  PartialSolution(Constraints & C, bool initial) : initial(initial) {
-    initialize(C);
-    propagate();
+  // Constructor, constraints aren't stored. If C has been condensed,
+  // Remap must describe the collapsed components (not owned).
+  PartialSolution(Constraints & C, bool initial, const SCCRemap *Remap = 0);
+
+  // Constructor propagating over a graph shared with the solution for the
+  // other initial value. Remap is as above, for the constraints G was
+  // built from. G is not retained here, as the two solutions are built on
+  // different threads and the reference count is not atomic: the caller
+  // keeps G alive, then hands each solution its reference with keepGraph.
+  PartialSolution(const SharedGraph *G, bool initial,
+                  const SCCRemap *Remap = 0);
+
+  // Keep G, the graph this solution was built over, alive for as long as
+  // the solution is.
+  void keepGraph(llvm::IntrusiveRefCntPtr<SharedGraph> G) {
+    assert(G.getPtr() == Graph && "Not the graph this was built over!");
+    Shared = G;
   }
 
   // copy constructor
@@ -45,31 +98,141 @@ public:
   // Merge in another PartialSolution with this, and re-solve.
   void mergeIn(PartialSolution &P);
 
+  // Add constraints to a solution built by the normal constructor, and
+  // propagate their consequences. If the solution was built from
+  // condensed constraints, C must be condensed in the same way. Copies of
+  // this solution made earlier are not updated.
+  void addConstraints(const Constraints &C);
+
+  // Drop the chain to the solutions merged into this one. Queries are
+  // unaffected, but no further merges are allowed and the merged solutions
+  // may be freed independently of this one.
+  void freeze();
+
   // Evaluate the given ConsElem in our solution environment
   const LHConstant& subst(const ConsElem& E);
 
 private:
+  friend class LaneSolution;
+  struct Marker;
+  friend struct Marker;
+  struct FrontierTask;
+  friend struct FrontierTask;
+  struct Level;
+  friend struct Level;
+
+  // Call Fn(W) for each variable W that our own propagation map says
+  // changes along with V.
+  template <class F> void forEachSucc(unsigned V, F &Fn) const {
+    // If we collapsed V's component, only its representative has edges.
+    // The representative takes care of the other members.
+    unsigned R = V;
+    if (Remap) {
+      R = Remap->rep(V);
+      if (R != V) {
+        Fn(R);
+        return;
+      }
+      for (SCCRemap::member_iterator I = Remap->member_begin(R),
+           E = Remap->member_end(R); I != E; ++I)
+        Fn(*I);
+    }
+
+    if (const CSRGraph *G = graph()) {
+      for (CSRGraph::iterator I = G->succ_begin(R),
+           E = G->succ_end(R); I != E; ++I)
+        Fn(*I);
+      if (P.empty()) return;
+    }
+
+    PMap::const_iterator I = P.find(R);
+    if (I == P.end()) return; // Not in map
+
+    const std::vector<unsigned> &Updates = I->second;
+    for (std::vector<unsigned>::const_iterator I = Updates.begin(),
+         E = Updates.end(); I != E; ++I)
+      Fn(*I);
+  }
+
+  // The propagation map kept as a CSRGraph, if any
+  const CSRGraph *graph() const {
+    if (Graph) return initial ? &Graph->Backward : &Graph->Forward;
+    return dense ? &Edges : 0;
+  }
+
   // Construct propagation map and seed VSet
   void initialize(Constraints & C);
 
-  // Solve by propagation
-  void propagate();
-  // Query VSets of this and all chained solutions
-  bool isChanged(const ConsVar*);
+  // Add the propagation edge or seed for a single constraint
+  void addConstraint(const LHConstraint &C, CSRGraph::EdgeList *EdgeList,
+                     std::vector<unsigned> &WorkList);
+
+  // Solve by propagation, starting from the given variables
+  void propagate(std::vector<unsigned> &WorkList);
+  // Returns true if propagate() may solve level by level on the pool,
+  // which needs every map in the chain to be a CSRGraph
+  bool canPropagateParallel() const;
+  // Same as propagate(), expanding each frontier of changed variables in
+  // parallel (see -deps-parallel-propagate)
+  void propagateParallel(std::vector<unsigned> &WorkList);
+  // Append the variables whose change our own propagation map acts on
+  void appendSources(std::vector<unsigned> &List) const;
+  // Add the contents of P's VSet to ours
+  void unionIn(const PartialSolution &P);
+  // Mark V as changed, queueing it for propagation if it wasn't already
+  void mark(unsigned V, std::vector<unsigned> &WorkList) {
+    if (isChanged(V)) return;
+    insert(V);
+    WorkList.push_back(V);
+  }
+
+  // Query and update our VSet
+  bool isChanged(unsigned V) const {
+    if (dense) return V < Bits.size() && Bits.test(V);
+    return VSet.count(V);
+  }
+  void insert(unsigned V) {
+    if (!dense) {
+      VSet.insert(V);
+      return;
+    }
+    if (V >= Bits.size()) Bits.resize(V + 1);
+    Bits.set(V);
+  }
+  // Append the contents of our own VSet to the given list
+  void appendChanged(std::vector<unsigned> &List) const;
 
   // Member variables:
 
   // TODO: This data really should be refactored out!!
   // Used to store by-value the PropagationMap when the non-merge ctor is used.
+  // In dense mode, holds only the edges added by addConstraints.
   PMap P;
+  // Propagation map in dense mode
+  CSRGraph Edges;
+  // Propagation map shared with the solution for the other initial value,
+  // used instead of Edges, and the reference that keeps it alive
+  const SharedGraph *Graph;
+  llvm::IntrusiveRefCntPtr<SharedGraph> Shared;
   // Set of variables with non-default values
   VarSet VSet;
+  // Set of variables with non-default values in dense mode
+  llvm::BitVector Bits;
+
+  // Components collapsed in the constraints P was built from, if any
+  const SCCRemap *Remap;
 
   // Chained solutions
   std::vector<PartialSolution*> Chained;
 
   // Do we consider variables 'high' intially?
   bool initial;
+
+  // Are VSet and P stored as Bits and Edges?
+  bool dense;
+
+  // Has freeze() been called?
+  bool frozen;
 };
 
 } // end namespace deps
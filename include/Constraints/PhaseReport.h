@@ -0,0 +1,97 @@
+//===-- PhaseReport.h -------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Wall time, counters and memory high-water marks of the phases of an
+// analysis run, reported with -deps-time-report.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef PHASEREPORT_H_
+#define PHASEREPORT_H_
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+namespace llvm {
+class raw_ostream;
+}
+
+namespace deps {
+
+/// Collects the time spent in each named phase, along with named counters,
+/// for the whole process. Phases are listed in the order they first ran.
+/// The report is printed to stderr, or written as JSON to the file given
+/// by -deps-time-report-json, when llvm_shutdown() runs. Everything may be
+/// called from any thread; time spent in a phase by several threads at
+/// once is summed.
+class PhaseReport {
+public:
+  /// Is -deps-time-report (or -deps-time-report-json) given? Nothing is
+  /// recorded otherwise.
+  static bool enabled();
+  static PhaseReport &get();
+
+  PhaseReport();
+  ~PhaseReport();
+
+  /// Adds one run of Seconds to the phase, and notes the process' peak
+  /// memory at its end.
+  void addTime(llvm::StringRef Phase, double Seconds);
+  /// Adds N to the counter.
+  void addCount(llvm::StringRef Counter, uint64_t N);
+  /// Sets the counter to N, if that is more than its current value.
+  void maxCount(llvm::StringRef Counter, uint64_t N);
+
+  void print(llvm::raw_ostream &OS) const;
+  void printJSON(llvm::raw_ostream &OS) const;
+
+  /// The peak resident set size of the process so far, in kilobytes.
+  static uint64_t peakMemory();
+
+private:
+  PhaseReport(const PhaseReport &);
+  PhaseReport &operator=(const PhaseReport &);
+
+  struct Phase {
+    std::string Name;
+    double Seconds;
+    unsigned Runs;
+    uint64_t PeakMemory;
+  };
+
+  std::vector<Phase> Phases;
+  std::map<std::string, uint64_t> Counters;
+  mutable pthread_mutex_t Lock;
+};
+
+/// Adds the wall time from its construction to its destruction to a phase.
+/// Phases may nest, and then include the time of the phases within them.
+class PhaseTimer {
+public:
+  explicit PhaseTimer(llvm::StringRef Phase);
+  ~PhaseTimer();
+
+private:
+  PhaseTimer(const PhaseTimer &);
+  PhaseTimer &operator=(const PhaseTimer &);
+
+  llvm::StringRef Phase;
+  double Start;
+  bool Enabled;
+};
+
+} // end namespace deps
+
+#endif // PHASEREPORT_H_
@@ -0,0 +1,75 @@
+//===-- SCCRemap.h ----------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Collapsing of cycles in a set of L-H constraints. Every variable in a
+// strongly connected component of the var-to-var constraint graph must have
+// the same solution, so each component is replaced by one representative.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef SCCREMAP_H_
+#define SCCREMAP_H_
+
+#include "Constraints/CSRGraph.h"
+#include "Constraints/LHConstraint.h"
+
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+
+#include <vector>
+
+namespace deps {
+
+class LHConsVar;
+
+/// Maps variable indices onto the representatives of their strongly
+/// connected components, and representatives back onto the other members
+/// of their component. Shared by the kit and the demand graphs built over
+/// the condensed constraints, which may outlive the kit's copy.
+class SCCRemap : public llvm::RefCountedBase<SCCRemap> {
+public:
+  typedef CSRGraph::iterator member_iterator;
+
+  /// Returns the representative of V.
+  unsigned rep(unsigned V) const {
+    return V < Rep.size() ? Rep[V] : V;
+  }
+
+  /// Iterate over the members of the component represented by R, not
+  /// including R itself.
+  member_iterator member_begin(unsigned R) const {
+    return Members.succ_begin(R);
+  }
+  member_iterator member_end(unsigned R) const {
+    return Members.succ_end(R);
+  }
+
+  /// Variables [0, numVars()) may have been collapsed; others never are.
+  unsigned numVars() const { return Rep.size(); }
+
+  /// Number of variables mapped to a representative other than themselves.
+  unsigned numCollapsed() const { return Members.numEdges(); }
+
+  /// Collapse the cycles among the variables of the constraints in C,
+  /// rewriting C in place to refer only to representatives. Constraints
+  /// made redundant by the rewriting are dropped. Vars maps indices back to
+  /// variables. Returns NULL if C has no cycles. The result has no
+  /// references yet.
+  static SCCRemap *collapse(std::vector<LHConstraint> &C,
+                            const std::vector<const LHConsVar *> &Vars);
+
+private:
+  SCCRemap() {}
+
+  std::vector<unsigned> Rep;
+  CSRGraph Members;
+};
+
+} // end namespace deps
+
+#endif // SCCREMAP_H_
@@ -0,0 +1,119 @@
+//===-- ThreadPool.h --------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// A small work-stealing pool of worker threads used to run independent
+// solver jobs.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <pthread.h>
+
+#include <deque>
+#include <vector>
+
+namespace deps {
+
+/// A unit of work to be run by a ThreadPool.
+class PoolTask {
+public:
+  virtual void run() = 0;
+  virtual ~PoolTask() {}
+};
+
+/// Fixed-size pool of worker threads. Every worker owns a deque of tasks:
+/// it takes work from the back of its own deque and, once that is empty,
+/// steals from the front of the others. Tasks submitted by a worker go to
+/// its own deque; tasks submitted from other threads are dealt out
+/// round-robin.
+class ThreadPool {
+public:
+  /// Tasks whose completion is waited for together.
+  class Batch {
+  public:
+    explicit Batch(ThreadPool &Pool) : Pool(Pool), Pending(0) {}
+    ~Batch() { wait(); }
+
+    /// Queue the given task. The pool deletes it once it has run.
+    void async(PoolTask *T);
+
+    /// Block until every task in this batch has run. The waiting thread
+    /// runs queued tasks itself in the meantime, so batches may be waited
+    /// for from within tasks.
+    void wait();
+
+  private:
+    Batch(const Batch &);
+    Batch &operator=(const Batch &);
+
+    ThreadPool &Pool;
+    unsigned Pending;
+    friend class ThreadPool;
+  };
+
+  /// Create a pool with the given number of workers, or
+  /// defaultThreadCount() workers if NumThreads is zero.
+  explicit ThreadPool(unsigned NumThreads = 0);
+  ~ThreadPool();
+
+  unsigned size() const { return Workers.size(); }
+
+  /// Returns the value of -deps-threads, or the number of online
+  /// processors if that is zero.
+  static unsigned defaultThreadCount();
+
+  /// A pool of defaultThreadCount() workers shared by all solvers, created
+  /// on first use and destroyed by llvm_shutdown().
+  static ThreadPool &global();
+
+private:
+  ThreadPool(const ThreadPool &);
+  ThreadPool &operator=(const ThreadPool &);
+
+  struct Job {
+    PoolTask *Task;
+    Batch *Owner;
+  };
+
+  struct Worker {
+    ThreadPool *Pool;
+    pthread_t Thread;
+    pthread_mutex_t Lock;
+    std::deque<Job> Jobs;
+  };
+
+  static void *workerMain(void *Arg);
+
+  void enqueue(const Job &J);
+  bool takeJob(Worker *Self, Job &J);
+  void runJob(const Job &J);
+  Worker *currentWorker() const;
+
+  std::vector<Worker*> Workers;
+
+  // Protects the counters below and Batch::Pending. May be taken while
+  // holding a Worker's Lock, never the other way around.
+  pthread_mutex_t Lock;
+  // Signalled when work is queued or the pool is shutting down
+  pthread_cond_t WorkAvailable;
+  // Broadcast whenever a job finishes
+  pthread_cond_t JobDone;
+
+  unsigned Queued;
+  unsigned NextWorker;
+  bool ShuttingDown;
+
+  friend class Batch;
+};
+
+} // end namespace deps
+
+#endif // THREADPOOL_H_
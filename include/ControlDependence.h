@@ -0,0 +1,58 @@
+//===- ControlDependence.h --------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines ControlDependence, the control dependence graph of a
+// function, which is what implicit flows are built from.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef CONTROLDEPENDENCE_H
+#define CONTROLDEPENDENCE_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+
+namespace llvm {
+class BasicBlock;
+class Function;
+class PostDominatorTree;
+}
+
+namespace deps {
+
+using namespace llvm;
+
+/// ControlDependence - For each block of a function, the blocks that are
+/// control dependent on its terminator: those that execute on some but not
+/// all of the paths leaving it. For an edge from A to S where S does not
+/// post-dominate A, these are S and its post-dominators up to, but not
+/// including, the immediate post-dominator of A (Ferrante et al.). Once
+/// built, it no longer needs the post-dominator tree.
+class ControlDependence {
+public:
+  typedef SmallVector<const BasicBlock *, 4> BlockList;
+
+  ControlDependence(const Function &F, const PostDominatorTree &PDT);
+
+  /// The blocks control dependent on the terminator of BB, without
+  /// duplicates. May include BB itself if it is in a loop.
+  const BlockList &dependents(const BasicBlock &BB) const {
+    DenseMap<const BasicBlock *, BlockList>::const_iterator I =
+      Dependents.find(&BB);
+    return I == Dependents.end() ? None : I->second;
+  }
+
+private:
+  DenseMap<const BasicBlock *, BlockList> Dependents;
+  static const BlockList None;
+};
+
+}
+
+#endif /* CONTROLDEPENDENCE_H */
@@ -20,16 +20,37 @@
 #include "llvm/Module.h"
 #include "llvm/ADT/DenseMap.h"
 
+#include <pthread.h>
+
 using namespace llvm;
 
 namespace deps {
 
 template <class FP>
 class FPCache : public ModulePass {
-  DenseMap<const Function*,FP*> Cache;
+  mutable DenseMap<const Function*,FP*> Cache;
+  // Are results computed by get() (and owned by us)?
+  bool Lazy;
+  // Protects Cache in lazy mode
+  mutable pthread_mutex_t Lock;
 protected:
-  FPCache(char & ID) : ModulePass(ID) {}
+  FPCache(char & ID) : ModulePass(ID), Lazy(false) {
+    ::pthread_mutex_init(&Lock, NULL);
+  }
+
+  // Should results be computed the first time they are asked for, instead
+  // of for every function when the pass is run? Lazily computed results
+  // are built by running a fresh FP on the function, so FP must not
+  // require any other analysis.
+  virtual bool computeLazily() const { return false; }
+  // Will any results be asked for at all?
+  virtual bool isNeeded() const { return true; }
 public:
+  ~FPCache() {
+    releaseMemory();
+    ::pthread_mutex_destroy(&Lock);
+  }
+
   virtual void getAnalysisUsage(AnalysisUsage &AU) const {
     AU.addRequired<FP>();
     AU.setPreservesAll();
@@ -39,6 +60,9 @@ public:
   // When the pass is run, get results for all functions.
   virtual bool runOnModule(Module &M) {
     releaseMemory();
+    Lazy = computeLazily();
+    if (Lazy || !isNeeded())
+      return false;
     for(Module::iterator I = M.begin(), E = M.end(); I != E; ++I) {
       if (!I->isDeclaration())
         Cache[I] = &getAnalysis<FP>(*I);
@@ -46,15 +70,56 @@ public:
     return false;
   }
 
-  // Cache accessor
+  // Cache accessor. In lazy mode, may be called from several threads at
+  // once.
   FP & get(const Function *F) const {
+    if (!Lazy) {
+      typename DenseMap<const Function*, FP*>::const_iterator I = Cache.find(F);
+      assert((I != Cache.end()) && "Function not in cache!");
+      return *I->second;
+    }
+
+    assert(!F->isDeclaration() && "No results for declarations!");
+    ::pthread_mutex_lock(&Lock);
     typename DenseMap<const Function*, FP*>::const_iterator I = Cache.find(F);
-    assert((I != Cache.end()) && "Function not in cache!");
-    return *I->second;
+    FP *Result = I == Cache.end() ? 0 : I->second;
+    ::pthread_mutex_unlock(&Lock);
+    if (Result)
+      return *Result;
+
+    // Build without the lock so other functions' results can be built
+    // meanwhile. If another thread got there first, theirs is kept.
+    FP *Built = new FP();
+    Built->runOnFunction(const_cast<Function &>(*F));
+    ::pthread_mutex_lock(&Lock);
+    FP *&Entry = Cache[F];
+    if (Entry == 0)
+      Entry = Built;
+    Result = Entry;
+    ::pthread_mutex_unlock(&Lock);
+    if (Result != Built)
+      delete Built;
+    return *Result;
+  }
+
+  // Free the results for F in lazy mode; they are computed again if asked
+  // for. References returned by get() for F are invalidated, so this must
+  // not be called while get() may be running on another thread.
+  void evict(const Function *F) {
+    if (!Lazy) return;
+    typename DenseMap<const Function*, FP*>::iterator I = Cache.find(F);
+    if (I == Cache.end()) return;
+    delete I->second;
+    Cache.erase(I);
   }
 
   // Clear cache when pass is invalidated
   virtual void releaseMemory() {
+    if (Lazy) {
+      for (typename DenseMap<const Function*, FP*>::iterator I = Cache.begin(),
+           E = Cache.end(); I != E; ++I)
+        delete I->second;
+    }
     Cache.clear();
   }
 
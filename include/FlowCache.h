@@ -0,0 +1,106 @@
+//===- FlowCache.h ----------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines FlowCache, an on-disk cache of the FlowRecords generated
+// for a function in a calling context, so that re-running the analysis only
+// regenerates the flows of functions that changed.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef FLOWCACHE_H
+#define FLOWCACHE_H
+
+#include "CallContext.h"
+#include "FlowRecord.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/DataTypes.h"
+
+#include <string>
+#include <vector>
+
+namespace llvm {
+class Function;
+class raw_ostream;
+}
+
+namespace deps {
+
+using namespace llvm;
+
+/// FlowCache - Stores the flows of each (function, context) in a file of
+/// the cache directory named after a key. The key is a hash of the
+/// function's IR and context, and of the IR and context of everything each
+/// of its call sites may invoke, since the flows reference the callees'
+/// parameters and returns.
+///
+/// Values are stored by name if they are named globals, by position in
+/// their function if they are arguments, blocks or instructions, and
+/// otherwise by the first operand of the function they appear as.
+/// Flows referencing any other value are not cached.
+class FlowCache {
+public:
+  typedef std::vector<FlowRecord> Flows;
+  typedef uint64_t Key;
+  /// Infoflow's contexts
+  typedef CallerContext<1> Context;
+  typedef ContextManager<Context> Contexts;
+
+  /// Cache in the given directory, which is created if needed. Contexts
+  /// are looked up and created in CM. Options describes the settings that
+  /// change which flows are generated; flows stored under other settings
+  /// are never loaded.
+  FlowCache(StringRef Dir, StringRef Options, Contexts &CM);
+  ~FlowCache();
+
+  /// Returns the key for the flows of F in context Ctxt, before any
+  /// callees are added.
+  Key key(const Function &F, ContextID Ctxt);
+  /// Adds Callee, invoked in context Ctxt by the call site CS, to K. The
+  /// order in which callees are added does not matter.
+  void addCallee(Key &K, const ImmutableCallSite &CS, const Function &Callee,
+                 ContextID Ctxt);
+
+  /// Loads the flows stored for F under K into flows. Returns false if
+  /// there are none, or they no longer fit the module.
+  bool load(Key K, const Function &F, Flows &flows);
+  /// Stores the flows of F under K, unless they can't be encoded.
+  void store(Key K, const Function &F, const Flows &flows);
+
+private:
+  FlowCache(const FlowCache &);
+  FlowCache &operator=(const FlowCache &);
+
+  struct Numbering;
+  class Reader;
+
+  Key functionHash(const Function &F);
+  Key hashContext(Key K, ContextID Ctxt) const;
+  Numbering &numberingFor(const Function &F);
+  std::string pathFor(Key K) const;
+
+  bool writeValue(raw_ostream &OS, const Function &F, const Value &V);
+  const Value *readValue(Reader &R, const Function &F);
+  template <typename it>
+  bool writeValues(raw_ostream &OS, const Function &F, it begin, it end);
+  unsigned contextIndex(ContextID Ctxt, std::vector<ContextID> &Table);
+
+  std::string Dir;
+  // Hash of Magic and the options, which begins every key
+  Key Seed;
+  Contexts &CM;
+  DenseMap<const Function *, Key> FunctionHashes;
+  DenseMap<const Function *, Numbering *> Numberings;
+};
+
+}
+
+#endif /* FLOWCACHE_H */
@@ -25,14 +25,54 @@
 
 #include "CallContext.h"
 #include "llvm/Value.h"
-#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
 
+#include <algorithm>
 #include <set>
 
 namespace deps {
 
 using namespace llvm;
 
+/// A set of pointers kept as a sorted array, with room for N of them
+/// inline. FlowRecords rarely have more than one or two sources or sinks
+/// of each kind, so this is smaller and cheaper to copy and walk than a
+/// hash set.
+template <typename T, unsigned N>
+class SortedPtrSet {
+public:
+  typedef const T * const *const_iterator;
+
+  void insert(const T *P) {
+    typename SmallVector<const T *, N>::iterator pos =
+      std::lower_bound(elems.begin(), elems.end(), P);
+    if (pos == elems.end() || *pos != P)
+      elems.insert(pos, P);
+  }
+  /// Insert a range of pointers, in any order. The array is sorted again
+  /// once, rather than shifted for every element.
+  template <typename it>
+  void insert(it begin, it end) {
+    unsigned old = elems.size();
+    elems.append(begin, end);
+    std::sort(elems.begin() + old, elems.end());
+    std::inplace_merge(elems.begin(), elems.begin() + old, elems.end());
+    elems.erase(std::unique(elems.begin(), elems.end()), elems.end());
+  }
+
+  bool count(const T *P) const {
+    return std::binary_search(elems.begin(), elems.end(), P);
+  }
+  bool empty() const { return elems.empty(); }
+  unsigned size() const { return elems.size(); }
+
+  const_iterator begin() const { return elems.begin(); }
+  const_iterator end() const { return elems.end(); }
+
+private:
+  SmallVector<const T *, N> elems;
+};
+
 /// A FlowRecord relates information flow sources to sinks. There are three
 /// types of sources/sinks:
 ///  - Values: An actual llvm value
@@ -43,9 +83,9 @@ using namespace llvm;
 ///  - Varg: ...
 class FlowRecord {
 public:
-  typedef SmallPtrSet<const Value *,1> value_set;
+  typedef SortedPtrSet<Value, 2> value_set;
   typedef value_set::const_iterator value_iterator;
-  typedef SmallPtrSet<const Function *, 1> fun_set;
+  typedef SortedPtrSet<Function, 1> fun_set;
   typedef fun_set::const_iterator fun_iterator;
 
   FlowRecord() : implicit(false), sourceCtxt(DefaultID), sinkCtxt(DefaultID) { }
@@ -59,6 +99,10 @@ public:
 
   ContextID sourceContext() const { return sourceCtxt; }
   ContextID sinkContext() const { return sinkCtxt; }
+  void setContexts(const ContextID source, const ContextID sink) {
+    sourceCtxt = source;
+    sinkCtxt = sink;
+  }
 
   void addSourceValue(const Value & V) { valueSources.insert(&V); }
   void addSourceDirectPtr(const Value & V) { directPtrSources.insert(&V); }
@@ -20,7 +20,9 @@
 #include "CallContext.h"
 #include "Constraints/LHConsSoln.h"
 #include "Constraints/LHConstraintKit.h"
+#include "ControlDependence.h"
 #include "FPCache.h"
+#include "FlowCache.h"
 #include "FlowRecord.h"
 #include "InfoflowSignature.h"
 #include "PointsToInterface.h"
@@ -35,6 +37,8 @@
 #include <map>
 #include <set>
 
+#include <pthread.h>
+
 namespace deps {
 
 using namespace llvm;
@@ -56,6 +60,10 @@ public:
   static char ID;
   PDTCache() : FPCache<PostDominatorTree>(ID) {}
   virtual const char * getPassName() const { return "PostDom Cache"; }
+protected:
+  // See -deps-lazy-postdom and -deps-implicit-flows
+  virtual bool computeLazily() const;
+  virtual bool isNeeded() const;
 };
 
 class Infoflow;
@@ -72,7 +80,7 @@ public:
                    DenseMap<const Function *, const ConsElem *> & vargMap) :
                    infoflow(infoflow), soln(s), highConstant(high),
                    defaultTainted(defaultTainted), valueMap(valueMap),
-                   locMap(locMap), vargMap(vargMap) { }
+                   locMap(locMap), vargMap(vargMap), precomputed(false) { }
   ~InfoflowSolution();
 
   /// isTainted - returns true if the security level of the value is High.
@@ -86,9 +94,22 @@ public:
   /// isVargTainted - returns true if the security level of the varargs of
   /// the function is High.
   bool isVargTainted(const Function &);
+  /// isLocTainted - returns true if the security level of the abstract
+  /// location is High. Locations without constraints have the default level.
+  bool isLocTainted(const AbstractLoc &);
+
+  /// precompute - solve for every abstract location once, and from then on
+  /// remember for each points-to set and reachable set whether any of its
+  /// locations is tainted, so isDirectPtrTainted and isReachPtrTainted cost
+  /// a lookup or two. Worth it when most values of the module are queried.
+  void precompute();
 private:
   InfoflowSolution & operator=(const InfoflowSolution& rhs);
 
+  // Is any of the locations tainted? Uses locTainted, and the solution for
+  // locations added to locMap since precompute().
+  bool anyLocTainted(const AbstractLocSet &locs) const;
+
   const Infoflow & infoflow;
   ConsSoln * soln;
   const ConsElem & highConstant;
@@ -96,6 +117,15 @@ private:
   DenseMap<const Value *, const ConsElem *> & valueMap;
   DenseMap<const AbstractLoc *, const ConsElem *> & locMap;
   DenseMap<const Function *, const ConsElem *> & vargMap;
+
+  // Filled in by precompute(): whether each location then in locMap is
+  // tainted, and the answers for the points-to sets (by leader) and
+  // reachable sets (by ID) seen so far.
+  // Reachable sets are 0 if not seen yet, 1 if untainted and 2 if tainted.
+  bool precomputed;
+  DenseMap<const AbstractLoc *, bool> locTainted;
+  DenseMap<const AbstractLocSet *, bool> directTainted;
+  std::vector<unsigned char> reachTainted;
 };
 
 /// A constraint-based, context-sensitive, interprocedural information
@@ -105,11 +135,21 @@ private:
 class Infoflow :
   public CallSensitiveAnalysisPass<Unit,Unit,1,CallerContext> {
   friend class InfoflowSolution;
+  friend class SolutionFile;
 
   public:
     static char ID;
     Infoflow ();
-  virtual ~Infoflow() { delete kit; delete signatureRegistrar; }
+  virtual ~Infoflow() {
+    delete kit;
+    delete signatureRegistrar;
+    delete flowCache;
+    clearFunctionElems();
+    clearControlDependence();
+    clearCanonicalInstances();
+    ::pthread_mutex_destroy(&preparedFlowsLock);
+    ::pthread_mutex_destroy(&controlDepsLock);
+  }
     const char *getPassName() const { return "Infoflow"; }
     virtual void getAnalysisUsage(AnalysisUsage &AU) const {
       CallSensitiveAnalysisPass<Unit,Unit,1,CallerContext>::getAnalysisUsage(AU);
@@ -120,13 +160,23 @@ class Infoflow :
     }
 
     virtual void releaseMemory() {
+      // Nothing was solved, so the dump wasn't written yet
+      if (kit) dumpConstraints();
+
       // Clear out all the maps
+      clearFunctionElems();
+      clearControlDependence();
+      clearCanonicalInstances();
       valueConstraintMap.clear();
-      vargConstraintMap.clear();
+      reachableJoinMap.clear();
+      for (unsigned kind = 0; kind != 4; ++kind)
+        reachableBoundMap[kind].clear();
       summarySinkValueConstraintMap.clear();
       summarySourceValueConstraintMap.clear();
       summarySinkVargConstraintMap.clear();
       summarySourceVargConstraintMap.clear();
+      LHConstraintKit::LabelSeeds().swap(labelSeeds);
+      numLabels = 0;
 
       // And free the kit and all its constraints
       delete kit;
@@ -186,8 +236,9 @@ class Infoflow :
     /// of the constraint system: unconstrained values and locations
     /// are considered UNTAINTED.
     ///
-    /// Once a solution is requested for a given kind, no further
-    /// constriants may be added to that kind.
+    /// Constraints added to a kind after a solution was requested for it
+    /// are propagated incrementally, but do not affect solutions that were
+    /// returned before.
     InfoflowSolution *leastSolution(std::set<std::string> kinds, bool implicit, bool sinks);
 
     /// Solve the default information flow constraints combined
@@ -196,8 +247,9 @@ class Infoflow :
     /// of the constraint system: unconstrained values and locations 
     /// are considered TAINTED.
     ///
-    /// Once a solution is requested for a given kind, no further
-    /// constriants may be added to that kind.
+    /// Constraints added to a kind after a solution was requested for it
+    /// are propagated incrementally, but do not affect solutions that were
+    /// returned before.
     InfoflowSolution *greatestSolution(std::set<std::string> kinds, bool implicit);
 
 
@@ -207,31 +259,162 @@ class Infoflow :
     // Solve the given kind using two threads.
     void solveMT(std::string kind="default") {
       assert(kit);
+      dumpConstraints();
       kit->solveMT(kind);
     }
     std::vector<InfoflowSolution*> solveLeastMT(std::vector<std::string> kinds, bool useDefaultSinks);
+
+    //////////////////////////////////////////////////////////////
+    /// Labeled sources
+    ///-----------------------------------------------------------
+    /// Instead of a kind per class of sources, each class can be given
+    /// a label (numbered from 0), and the solutions of all labels found
+    /// in one propagation over the default constraints.
+
+    /// Taints the value with the given label
+    void setLabelTainted(unsigned label, const Value &);
+    /// Taints all locations the value could point to with the label
+    void setDirectPtrLabelTainted(unsigned label, const Value &);
+    /// Taints all locations reachable through the pointer with the label
+    void setReachPtrLabelTainted(unsigned label, const Value &);
+    /// Taints the varargs of the function with the label
+    void setVargLabelTainted(unsigned label, const Function &);
+
+    /// Solve for every label from 0 up to the highest one used. Element i
+    /// is the least solution of the default constraints (and the default
+    /// sinks, if useDefaultSinks) with the sources of label i tainted, the
+    /// same as solveLeastMT on a kind per label. As for solveLeastMT, the
+    /// default kinds must have been solved already. (caller delete)
+    std::vector<InfoflowSolution*> solveLabels(bool useDefaultSinks);
+
+    /// Free the per-context state of the analysis and everything the
+    /// constraint kit only needs to solve, keeping just what the solutions
+    /// handed out query through: the summary maps and the locations. Call
+    /// it once all solutions were asked for; no constraints may be added
+    /// and no solutions asked for afterwards.
+    void compactSolverState();
+    /// Was -deps-compact-after-solve given? Clients should then call
+    /// compactSolverState once they have all their solutions.
+    bool compactAfterSolve() const;
   private:
     virtual void doInitialization();
     virtual void doFinalization();
     virtual const Unit bottomInput() const;
     virtual const Unit bottomOutput() const;
     virtual const Unit runOnContext(const AUnitType unit, const Unit input);
+    virtual void prepareContext(const AUnitType unit);
+    virtual unsigned prepareBatchSize() const;
+    virtual bool scheduleBottomUp() const;
 
     LHConstraintKit *kit;
 
     PointsToInterface *pti;
+    PDTCache *pdtCache;
     SourceSinkAnalysis *sourceSinkAnalysis;
 
     SignatureRegistrar *signatureRegistrar;
 
+    /// Flows of the analysis units prepared on worker threads, waiting to
+    /// be turned into constraints by runOnContext.
+    std::map<AUnitType, Flows> preparedFlows;
+    pthread_mutex_t preparedFlowsLock;
+
+    /// The control dependence graph of each function, built the first time
+    /// one of its branches is constrained and shared by all its contexts
+    DenseMap<const Function *, const ControlDependence *> controlDeps;
+    pthread_mutex_t controlDepsLock;
+    const ControlDependence &getOrCreateControlDependence(const Function &);
+    void clearControlDependence();
+
+    /// The sources of each label, and how many labels there are
+    LHConstraintKit::LabelSeeds labelSeeds;
+    unsigned numLabels;
+    void addLabelSeed(unsigned label, const ConsElem &);
+
+    /// Flows of earlier runs, if -deps-flow-cache is given
+    FlowCache *flowCache;
+
+    /// Writes the constraints for -deps-dump-constraints, once. Called
+    /// before anything is solved, since solving locks kinds, which may
+    /// rewrite and free their constraints.
+    void dumpConstraints();
+    bool constraintsDumped;
+
+    /// The flows of the function runOnContext is working on. Kept between
+    /// runs so its storage is reused.
+    Flows functionFlows;
+
     FlowRecord currentContextFlowRecord(bool implicit) const;
 
     const std::set<const AbstractLoc *> &locsForValue(const Value & value) const;
     const std::set<const AbstractLoc *> &reachableLocsForValue(const Value & value) const;
-
+    /// The ID of reachableLocsForValue(value), which values with the same
+    /// reachable locations share
+    ReachableSetID reachableSetIDForValue(const Value & value) const;
+    const std::set<const AbstractLoc *> &reachableLocsForID(ReachableSetID id) const;
+
+    /// The ConsElems of a function's arguments, blocks and instructions,
+    /// and of its varargs, in each context it was analyzed in. Each
+    /// context's are in an array of numSlots: the varargs first, then the
+    /// function's values by number.
+    struct FunctionElems {
+      unsigned numSlots;
+      DenseMap<ContextID, const ConsElem **> byContext;
+      // The context looked up last, which is usually the next one too
+      ContextID lastContext;
+      const ConsElem **lastElems;
+    };
+    /// The function of each numbered value, and its slot
+    typedef std::pair<FunctionElems *, unsigned> LocalSlot;
+    DenseMap<const Function *, FunctionElems *> functionElems;
+    DenseMap<const Value *, LocalSlot> localSlots;
+
+    /// Numbers the values of the function, the first time it's called
+    FunctionElems &getOrCreateFunctionElems(const Function &);
+    const ConsElem *&getOrCreateSlot(FunctionElems &, const ContextID, unsigned);
+    void clearFunctionElems();
+
+    /// With -deps-canonical-contexts, a function whose flows are the same
+    /// in every context (it calls no code we analyze) has its constraints
+    /// generated once, in a context of its own. Each context it is analyzed
+    /// in only gets its interface: its arguments, varargs and entry pc
+    /// flow into those of the canonical instance, and its returns get what
+    /// reaches the canonical ones. What reaches a return from the interface
+    /// of the canonical instance, through the function's own values, comes
+    /// from the same context; all else comes through a base variable.
+    struct CanonicalInstance {
+      ContextID context;
+      struct Transfer {
+        Transfer() : ret(NULL), kind(0), varargs(false), base(NULL) {}
+        const ReturnInst *ret;
+        // Where the paths lead through (by implicit + 2 * sink)
+        unsigned kind;
+        SmallVector<const Value *, 4> inputs;
+        bool varargs;
+        const ConsElem *base;
+      };
+      std::vector<Transfer> transfers;
+    };
+    /// NULL for functions that do depend on their context
+    DenseMap<const Function *, CanonicalInstance *> canonicalInstances;
+
+    /// The canonical instance of the function, generating its constraints
+    /// from the given flows (or its own) the first time. NULL if the
+    /// function can't have one.
+    CanonicalInstance *getOrCreateCanonicalInstance(const Function &, Flows *);
+    void summarizeCanonicalInstance(const Function &, const Flows &, CanonicalInstance &);
+    void instantiateCanonicalInstance(const Function &, const CanonicalInstance &, const ContextID);
+    void clearCanonicalInstances();
+
+    /// ConsElems of the values that belong to no function, by context
     DenseMap<ContextID, DenseMap<const Value *, const ConsElem *> > valueConstraintMap;
     DenseMap<const AbstractLoc *, const ConsElem *> locConstraintMap;
-    DenseMap<ContextID, DenseMap<const Function *, const ConsElem *> > vargConstraintMap;
+    /// The join of the locations of each reachable set
+    DenseMap<ReachableSetID, const ConsElem *> reachableJoinMap;
+    /// A variable below every location of each reachable set, so a level
+    /// can flow to all of them with one constraint, for each of the kinds
+    /// (by implicit * 2 + sink)
+    DenseMap<ReachableSetID, const ConsElem *> reachableBoundMap[4];
 
     DenseMap<const Value *, const ConsElem *> summarySinkValueConstraintMap;
     DenseMap<const Value *, const ConsElem *> summarySourceValueConstraintMap;
@@ -239,7 +422,6 @@ class Infoflow :
     DenseMap<const Function *, const ConsElem *> summarySourceVargConstraintMap;
 
     DenseMap<const Value *, const ConsElem *> &getOrCreateValueConstraintMap(const ContextID);
-    DenseMap<const Function *, const ConsElem *> &getOrCreateVargConstraintMap(const ContextID);
 
     virtual const Unit signatureForExternalCall(const ImmutableCallSite & cs, const Unit input);
 
@@ -268,6 +450,9 @@ class Infoflow :
     void putOrConstrainVargConsElem(bool imp, bool sink, const Function &, const ConsElem &);
 
     void generateFunctionConstraints(const Function &);
+    void cachedFunctionConstraints(const Function &);
+    void getFunctionFlows(const Function &, Flows &);
+    void constrainPreparedFunction(const Function &, const Flows &);
     void generateBasicBlockConstraints(const BasicBlock &, Flows &);
     void getInstructionFlowsInternal(const Instruction &, bool callees, Flows &);
 
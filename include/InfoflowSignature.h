@@ -19,9 +19,14 @@
 #define INFOFLOWSIGNATURE_H_
 
 #include "CallContext.h"
+#include "llvm/ADT/DenseMap.h"
 #include <set>
 #include <vector>
 
+namespace llvm {
+class Module;
+}
+
 namespace deps {
 
 using namespace llvm;
@@ -31,6 +36,19 @@ class FlowRecord;
 /// The public interface of an information flow signature.
 class Signature {
 public:
+  /// What acceptCallee knows about the call sites of a function.
+  enum CalleeAccept {
+    RejectsCallee,      ///< accept is false for every call site
+    AcceptsCallee,      ///< accept is true for every call site
+    DependsOnCallSite   ///< accept has to look at the call site
+  };
+
+  /// AcceptCallee should say whether accept holds for every direct call
+  /// to F, if that doesn't depend on the call site. The registrar asks
+  /// once per function, before any call site is processed.
+  virtual CalleeAccept acceptCallee(const Function &F) const {
+    return DependsOnCallSite;
+  }
   /// Accept should return true if this signature is valid for the given call
   /// site and false otherwise. If a signature accepts a call site, it's
   /// result may be used as a summary for the given call.
@@ -56,6 +74,12 @@ public:
   /// new signature types.
   void registerSignature(const SigInfo si);
 
+  /// Resolves the signature of every function in the module whose
+  /// signatures all answer acceptCallee, so processing a direct call to
+  /// one is a single lookup. Call once the signatures are registered and
+  /// before any call site is processed.
+  void compile(const Module &M);
+
   /// For a given call site, returns a summary of the information flows
   /// that may occur as a result of the call.
   /// Currently uses the first signature to accept the call, in order
@@ -63,6 +87,8 @@ public:
   std::vector<FlowRecord> process(const ContextID ctxt, const ImmutableCallSite cs);
 private:
   std::vector<const Signature *> sigs;
+  /// The signature for direct calls to each function compiled
+  DenseMap<const Function *, const Signature *> calleeSigs;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
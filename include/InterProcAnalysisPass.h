@@ -24,16 +24,25 @@
 #ifndef INTERPROC_ANALYSIS_PASS_H
 #define INTERPROC_ANALYSIS_PASS_H
 
+#include "Constraints/PhaseReport.h"
+#include "Constraints/ThreadPool.h"
+
 #include "assistDS/DataStructureCallGraph.h"
 
 #include "llvm/Pass.h"
 #include "llvm/Module.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
 #include <map>
 #include <set>
-#include <deque>
+#include <vector>
+
+#include <pthread.h>
 
 namespace llvm {
 
@@ -83,45 +92,96 @@ private:
 /// The InterProcWorkQueue manages AnalysisUnits that still need
 /// to be processed. Each AnalysisUnit may appear at most once in
 /// the work queue (though it can be added again).
+///
+/// Units are dequeued in order of the rank of their function, and in the
+/// order they were enqueued among functions of the same rank. Without
+/// ranks the queue is first-in first-out.
 template<class C>
 class InterProcWorkQueue {
 public:
   typedef AnalysisUnit<C> AUnitType;
   typedef typename std::set<AUnitType>::iterator AUnitIterator;
 
+  InterProcWorkQueue() : enqueued(0) { }
+
   bool empty() { return queue.empty(); }
 
-  void enqueue(AUnitType unit) {
-    if (set.find(unit) == set.end()) {
-      set.insert(unit);
-      queue.push_back(unit);
-    }
+  /// setRanks - Orders units by the given rank of their function. Functions
+  /// without a rank come after all the others. The queue must be empty.
+  void setRanks(const std::map<const Function *, unsigned> &newRanks) {
+    assert(queue.empty() && "Ranks must be set before queueing units!");
+    ranks = newRanks;
+  }
+
+  /// enqueue - Adds the unit to the queue. Returns false if it was
+  /// already queued.
+  bool enqueue(AUnitType unit) {
+    if (keys.find(unit) != keys.end()) return false;
+    Key key(rankOf(unit.function()), enqueued++);
+    keys.insert(std::make_pair(unit, key));
+    queue.insert(std::make_pair(key, unit));
+    return true;
   }
 
-  void enqueue(AUnitIterator start, AUnitIterator end) {
+  /// enqueue - Adds the units to the queue, returning how many of them
+  /// were already queued.
+  unsigned enqueue(AUnitIterator start, AUnitIterator end) {
+    unsigned queued = 0;
     for (; start != end; ++start) {
-      enqueue(*start);
+      if (!enqueue(*start)) ++queued;
     }
+    return queued;
   }
 
   AUnitType dequeue() {
     assert(!queue.empty());
-    AUnitType unit = *queue.begin();
-    queue.pop_front();
-    set.erase(unit);
-    return unit;
+    return take(queue.begin()->second);
+  }
+
+  /// take - Removes a particular unit from the queue.
+  AUnitType take(const AUnitType &unit) {
+    typename std::map<AUnitType, Key>::iterator key = keys.find(unit);
+    assert(key != keys.end() && "Unit is not queued!");
+    typename std::map<Key, AUnitType>::iterator entry = queue.find(key->second);
+    const AUnitType taken = entry->second;
+    keys.erase(key);
+    queue.erase(entry);
+    return taken;
+  }
+
+  /// front - Copies up to max units from the front of the queue, in order,
+  /// stopping before the first unit for a function that was already copied.
+  /// The units are left in the queue.
+  void front(unsigned max, std::vector<AUnitType> &units) const {
+    std::set<const Function *> functions;
+    for (typename std::map<Key, AUnitType>::const_iterator entry = queue.begin(),
+         end = queue.end(); entry != end && units.size() < max; ++entry) {
+      if (!functions.insert(&entry->second.function()).second) break;
+      units.push_back(entry->second);
+    }
   }
 
 private:
-  std::set<AUnitType > set;
-  std::deque<AUnitType > queue;
+  /// The rank of the unit's function, then the time it was enqueued
+  typedef std::pair<unsigned, unsigned long> Key;
+
+  unsigned rankOf(const Function &fun) const {
+    if (ranks.empty()) return 0;
+    std::map<const Function *, unsigned>::const_iterator rank = ranks.find(&fun);
+    return rank == ranks.end() ? ~0U : rank->second;
+  }
+
+  std::map<const Function *, unsigned> ranks;
+  std::map<AUnitType, Key> keys;
+  std::map<Key, AUnitType> queue;
+  unsigned long enqueued;
 };
 
 /// InterProcAnalysisPass can be extended to implement interprocedural
 /// analysis for different contexts and analysis input/output types.
 ///
 /// The context type, C, must be default and copy constructible, assignable,
-/// and have a valid < operator.
+/// have a valid < operator, and have a DenseMapInfo.
 ///
 /// The input and output types must implement the operators for
 /// <=, ==, and !=, and be default constructible.
@@ -134,7 +194,13 @@ public:
   typedef AnalysisUnit<C> AUnitType;
   typedef typename std::set<AUnitType>::iterator AUnitIterator;
 
-  explicit InterProcAnalysisPass(char &pid) : ModulePass(pid) {}
+  explicit InterProcAnalysisPass(char &pid)
+    : ModulePass(pid), currentAnalysisUnit(NULL), currentUnitID(0) {
+    ::pthread_key_create(&preparingAnalysisUnit, NULL);
+  }
+  virtual ~InterProcAnalysisPass() {
+    ::pthread_key_delete(preparingAnalysisUnit);
+  }
 
   /// bottomInput - This method should be implemented by the subclass as the
   /// initial input to use for each analysis unit. It should represent the
@@ -157,6 +223,23 @@ public:
   /// runOnContext - This method should be implemented by the subclass to
   /// perform the desired analysis on the current analysis unit.
   virtual const O runOnContext(const AUnitType unit, const I input) = 0;
+  /// prepareContext - This method may be implemented by the subclass to do
+  /// the part of the analysis of a unit that does not depend on the results
+  /// for any other unit. Batches of queued units are prepared concurrently
+  /// on worker threads before runOnContext(..) is called for each of them,
+  /// in order, on the main thread. The units of a batch are all for distinct
+  /// functions, and getCurrentContext() returns the context of the unit
+  /// being prepared. Implementations must not request analysis results.
+  virtual void prepareContext(const AUnitType unit) { }
+  /// prepareBatchSize - The largest number of analysis units to prepare at
+  /// once. With the default of zero, prepareContext(..) is never called.
+  virtual unsigned prepareBatchSize() const { return 0; }
+  /// scheduleBottomUp - If this returns true, queued units are processed
+  /// bottom-up over the strongly connected components of the call graph,
+  /// callees before callers, so that callers are reanalyzed once their
+  /// callees have settled rather than after every change. Otherwise units
+  /// are processed in the order they are queued.
+  virtual bool scheduleBottomUp() const { return false; }
   /// doInitialization - This method is called before any analysis units are
   /// analyzed, allowing the pass to do initialization.
   virtual void doInitialization() { }
@@ -169,24 +252,19 @@ public:
   const O getAnalysisResult(const AUnitType unit, const I input) {
     // First, check if we have analyzed (or added to the queue) the
     // requested analysis unit. Create an entry if one does not exist.
-    bool validOutput = true;
-    if (analysisRecords.find(unit) == analysisRecords.end()) {
-      analysisRecords[unit] = AnalysisRecord<I,O>(bottomInput());
-      validOutput = false;
-    }
-    ARecord rec = analysisRecords[unit];
+    bool fresh;
+    const unsigned id = internUnit(unit, fresh);
 
     // Is the existing result suitable?
-    if (validOutput && input <= rec.input()) {
+    if (!fresh && input <= analysisRecords[id].input()) {
       // If so, just return it
-      return rec.output();
+      return analysisRecords[id].output();
     } else {
       // Otherwise, put it in the queue and return a "good enough" answer
       // If the answer improves, we'll re-analyze the caller with the new
       // answer.
-      requestProcessing(unit, input);
-      rec = analysisRecords[unit];
-      return rec.output();
+      requestProcessing(id, input);
+      return analysisRecords[id].output();
     }
   }
 
@@ -194,13 +272,27 @@ public:
   /// the current function. (i.e., what context are we currently executing
   /// runOnContext(..) for?)
   const C getCurrentContext() const {
-    if (currentAnalysisUnit != NULL) {
+    if (const AUnitType *preparing =
+          static_cast<const AUnitType *>(::pthread_getspecific(preparingAnalysisUnit))) {
+      return preparing->context();
+    } else if (currentAnalysisUnit != NULL) {
       return currentAnalysisUnit->context();
     } else {
       return C();
     }
   }
 
+  /// releaseAnalysisUnits - Free the analysis units and the records of
+  /// their inputs, outputs and dependencies, once nothing will be
+  /// reanalyzed.
+  void releaseAnalysisUnits() {
+    unitIDs.shrink_and_clear();
+    std::vector<AUnitType>().swap(units);
+    std::vector<ARecord>().swap(analysisRecords);
+    std::vector<Dependents>().swap(dependencies);
+    analyzedFunctions.clear();
+  }
+
   /// getAnalysisUsage - InterProcAnalysisPass requires and preserves the
   /// call graph. Derived methods must call this implementation.
   virtual void getAnalysisUsage(AnalysisUsage &Info) const {
@@ -214,44 +306,128 @@ public:
     doInitialization();
 
     analyzedFunctions.clear();
+    if (scheduleBottomUp()) rankFunctionsBottomUp();
 
     // Add the main function to the queue. If there isn't
     // a main function, add any externally linkable functions.
     addStartItemsToWorkQueue();
     // Do work until we're done.
-    while (!workQueue.empty()) {
-      AnalysisUnit<C> unit = workQueue.dequeue();
-      processAnalysisUnit(unit);
-    }
+    processWorkQueue();
 
     // Some functions may not have been analyzed because they
     // appear unreachable. Analyze them now just in case.
     addUnanalyzedFunctionsToWorkQueue();
-    while (!workQueue.empty()) {
-      AnalysisUnit<C> unit = workQueue.dequeue();
-      processAnalysisUnit(unit);
-    }
+    processWorkQueue();
 
     currentAnalysisUnit = NULL;
 
+    // Units processed beyond these were reanalyses
+    if (deps::PhaseReport::enabled())
+      deps::PhaseReport::get().maxCount("distinct analysis units", units.size());
+
     doFinalization();
     return false;
   }
 
 private:
   typedef AnalysisRecord<I,O> ARecord;
-  typedef typename std::map<AUnitType,ARecord>::iterator ARecordIterator;
-  typedef typename std::map<AUnitType, std::set<AUnitType> >::iterator DependencyIterator;
+  typedef std::pair<const Function *, C> UnitKey;
+  /// Sorted IDs of the units that depend on a unit
+  typedef SmallVector<unsigned, 4> Dependents;
 
   InterProcWorkQueue<C> workQueue;
-  std::map<AUnitType,ARecord> analysisRecords;
+  /// Every unit analyzed or requested so far is given a dense ID, which
+  /// indexes the vectors below.
+  DenseMap<UnitKey, unsigned> unitIDs;
+  std::vector<AUnitType> units;
+  std::vector<ARecord> analysisRecords;
   /// For each analysis unit, we track the analysis units that requested
   /// its analysis results. If those results change, we reanalyze all
   /// dependencies.
-  std::map<AUnitType, std::set<AUnitType> > dependencies;
+  std::vector<Dependents> dependencies;
   const AUnitType *currentAnalysisUnit;
+  unsigned currentUnitID;
+  /// The unit a worker thread is running prepareContext(..) for, if any.
+  pthread_key_t preparingAnalysisUnit;
   std::set<const Function *> analyzedFunctions;
 
+  /// Runs prepareContext(..) for one unit of a batch on a worker thread.
+  class PrepareTask : public deps::PoolTask {
+  public:
+    PrepareTask(InterProcAnalysisPass &pass, const AUnitType &unit)
+      : pass(pass), unit(unit) { }
+    virtual void run() {
+      ::pthread_setspecific(pass.preparingAnalysisUnit, &unit);
+      pass.prepareContext(unit);
+      ::pthread_setspecific(pass.preparingAnalysisUnit, NULL);
+    }
+  private:
+    InterProcAnalysisPass &pass;
+    const AUnitType &unit;
+  };
+  friend class PrepareTask;
+
+  /// Processes analysis units until the work queue is empty. If the
+  /// subclass prepares units, the units at the front of the queue are
+  /// prepared in parallel first. They are still processed one at a time
+  /// and in queue order, so the analysis proceeds exactly as it would
+  /// without preparation.
+  void processWorkQueue() {
+    const unsigned batchSize = prepareBatchSize();
+    while (!workQueue.empty()) {
+      if (batchSize > 1) {
+        std::vector<AUnitType> batch;
+        workQueue.front(batchSize, batch);
+        {
+          deps::ThreadPool::Batch tasks(deps::ThreadPool::global());
+          for (typename std::vector<AUnitType>::const_iterator unit = batch.begin(),
+               end = batch.end(); unit != end; ++unit) {
+            tasks.async(new PrepareTask(*this, *unit));
+          }
+        }
+        // Processing may queue units ahead of the rest of the batch, but
+        // not remove any, so take the prepared ones in batch order.
+        for (unsigned i = 0, e = batch.size(); i != e; ++i) {
+          processAnalysisUnit(workQueue.take(batch[i]));
+        }
+      } else {
+        processAnalysisUnit(workQueue.dequeue());
+      }
+    }
+  }
+
+  /// Returns the ID of the unit, giving it one and a record with the bottom
+  /// input if it has none. Sets fresh if it had none.
+  unsigned internUnit(const AUnitType &unit, bool &fresh) {
+    std::pair<typename DenseMap<UnitKey, unsigned>::iterator, bool> entry =
+      unitIDs.insert(std::make_pair(UnitKey(&unit.function(), unit.context()),
+                                    (unsigned)units.size()));
+    fresh = entry.second;
+    if (fresh) {
+      units.push_back(unit);
+      analysisRecords.push_back(ARecord(bottomInput()));
+      dependencies.push_back(Dependents());
+    }
+    return entry.first->second;
+  }
+
+  /// Ranks each function by the position of its call graph SCC in a
+  /// post-order traversal, so that callees come before their callers.
+  void rankFunctionsBottomUp() {
+    const CallGraph &cg = getAnalysis<DataStructureCallGraph>();
+    std::map<const Function *, unsigned> ranks;
+    unsigned rank = 0;
+    for (scc_iterator<const CallGraph *> scc = scc_begin(&cg), end = scc_end(&cg);
+         scc != end; ++scc, ++rank) {
+      const std::vector<const CallGraphNode *> &nodes = *scc;
+      for (std::vector<const CallGraphNode *>::const_iterator node = nodes.begin(),
+           nend = nodes.end(); node != nend; ++node) {
+        if (const Function *fun = (*node)->getFunction()) ranks[fun] = rank;
+      }
+    }
+    workQueue.setRanks(ranks);
+  }
+
   /// Adds entry points to the module to the work queue.
   void addStartItemsToWorkQueue() {
     const CallGraph & cg = getAnalysis<DataStructureCallGraph>();
@@ -276,7 +452,8 @@ private:
     const I initInput = bottomInput();
     for (AUnitIterator item = startItems.begin(), end = startItems.end();
                item != end; ++item) {
-     analysisRecords[*item] = AnalysisRecord<I,O>(initInput);
+     bool fresh;
+     analysisRecords[internUnit(*item, fresh)] = ARecord(initInput);
      workQueue.enqueue(*item);
     }
   }
@@ -300,7 +477,8 @@ private:
     const I initInput = bottomInput();
     for (AUnitIterator item = startItems.begin(), end = startItems.end();
                item != end; ++item) {
-     analysisRecords[*item] = AnalysisRecord<I,O>(initInput);
+     bool fresh;
+     analysisRecords[internUnit(*item, fresh)] = ARecord(initInput);
      workQueue.enqueue(*item);
     }
   }
@@ -309,39 +487,60 @@ private:
   /// If the result changes, adds the invalidated dependencies
   /// to the work queue.
   void processAnalysisUnit(const AUnitType unit) {
+    typename DenseMap<UnitKey, unsigned>::const_iterator entry =
+      unitIDs.find(UnitKey(&unit.function(), unit.context()));
+    assert(entry != unitIDs.end() && "No input!");
+    const unsigned id = entry->second;
     currentAnalysisUnit = &unit;
-    ARecordIterator rec = analysisRecords.find(unit);
-    assert(rec != analysisRecords.end() && "No input!");
-    const O prevOutput = rec->second.output();
-    const I input = rec->second.input();
+    currentUnitID = id;
+    const O prevOutput = analysisRecords[id].output();
+    const I input = analysisRecords[id].input();
+    // runOnContext may request other units, which reallocates the records
     const O output = runOnContext(unit, input);
     analyzedFunctions.insert(&unit.function());
 
-    analysisRecords[unit] = AnalysisRecord<I,O>(input, output);
+    analysisRecords[id] = ARecord(input, output);
+
+    const bool report = deps::PhaseReport::enabled();
+    if (report) deps::PhaseReport::get().addCount("analysis units processed", 1);
 
     // Did the result change?
     if (prevOutput != output) {
       // need to add any consumers back to the workQueue
-      workQueue.enqueue(dependencies[unit].begin(), dependencies[unit].end());
+      const Dependents &consumers = dependencies[id];
+      unsigned queued = 0;
+      for (Dependents::const_iterator consumer = consumers.begin(),
+           end = consumers.end(); consumer != end; ++consumer) {
+        if (!workQueue.enqueue(units[*consumer])) ++queued;
+      }
+      if (report) {
+        deps::PhaseReport::get().addCount("analysis units requeued", consumers.size() - queued);
+        // Each of these would otherwise have been analyzed once more
+        deps::PhaseReport::get().addCount("analysis units requeued while queued", queued);
+      }
     }
   }
 
   /// Adds an analysis unit to the work queue. Takes care of navigating the
   /// lattice of analysis inputs.
-  void requestProcessing(const AUnitType unit, const I input) {
+  void requestProcessing(const unsigned id, const I input) {
     // If we've analyzed this record before, we need to join the currently
     // requested input with the input we used before (to reach a fixpoint
     // in the analysis).
-    ARecord rec = analysisRecords[unit];
-    I newInput = input.upperBound(rec.input());
-    analysisRecords[unit] = AnalysisRecord<I,O>(newInput, rec.output());
+    ARecord &rec = analysisRecords[id];
+    rec = ARecord(input.upperBound(rec.input()), rec.output());
 
     // Add the current analysis unit to the dependencies for the requested
     // analysis unit. That way we can re-analyze the current unit if the
     // result for the requested unit changes.
-    dependencies[unit].insert(*currentAnalysisUnit);
-
-    workQueue.enqueue(unit);
+    assert(currentAnalysisUnit && "Requesting results outside of a unit!");
+    Dependents &consumers = dependencies[id];
+    Dependents::iterator pos =
+      std::lower_bound(consumers.begin(), consumers.end(), currentUnitID);
+    if (pos == consumers.end() || *pos != currentUnitID)
+      consumers.insert(pos, currentUnitID);
+
+    workQueue.enqueue(units[id]);
   }
 };
 
@@ -20,10 +20,12 @@
 
 #include "llvm/Pass.h"
 #include "llvm/Value.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/EquivalenceClasses.h"
 
 #include <set>
 #include <map>
+#include <vector>
 
 using namespace llvm;
 
@@ -36,6 +38,13 @@ typedef DSNode AbstractLoc;
 
 typedef std::set<const AbstractLoc *> AbstractLocSet;
 
+//
+// Identifies one distinct set of reachable abstract locations. Values whose
+// reachable sets are equal share an ID; the empty set is EmptyReachableSetID.
+//
+typedef unsigned ReachableSetID;
+static const ReachableSetID EmptyReachableSetID = 0;
+
 //
 // This pass provides an interface to a points-to analysis (currently DSA) that
 // returns sets of abstracts locations for pointer expressions.
@@ -44,23 +53,39 @@ class PointsToInterface : public ModulePass {
 private:
   static const AbstractLocSet EmptySet;
 
+  // A reachable set, as the sorted IDs of its merged leaders.
+  typedef std::vector<unsigned> LeaderIDSet;
+
   std::map<const DSNode *, AbstractLocSet> ClassForLeader;
-  std::map<const DSNode *, AbstractLocSet> ReachablesForLeader;
   DenseMap<const Value*, const DSNode*> LeaderForValue;
 
   EquivalenceClasses<const DSNode *> MergedLeaders;
 
+  // Merged leaders are numbered densely for the reachable sets.
+  DenseMap<const DSNode *, unsigned> IDForLeader;
+  std::vector<const DSNode *> LeaderForID;
+
+  // The distinct reachable sets, the one of each merged leader, and the
+  // AbstractLocSets of those that have been asked for.
+  std::map<LeaderIDSet, ReachableSetID> IDForReachableSet;
+  std::vector<const LeaderIDSet *> ReachableSets;
+  DenseMap<const DSNode *, ReachableSetID> ReachableSetForLeader;
+  std::vector<AbstractLocSet *> ReachableLocSets;
+
   const EquivalenceClasses<const DSNode *> *Classes;
   DSNodeEquivs *EquivsAnalysis;
 
   void mergeAllIncomplete();
   const DSNode *getMergedLeaderForValue(const Value *V);
-  void findReachableAbstractLocSetForNode(AbstractLocSet &S, const DSNode *Nd);
+  unsigned getLeaderID(const DSNode *Node);
+  ReachableSetID internReachableSet(const LeaderIDSet &Set);
+  void computeReachableSets();
 
 public:
   static char ID;
 
   PointsToInterface() : ModulePass(ID) {}
+  ~PointsToInterface();
 
   virtual bool runOnModule(Module &M);
 
@@ -80,6 +105,18 @@ public:
   // locations reachable from that value.
   //
   const AbstractLocSet *getReachableAbstractLocSetForValue(const Value *V);
+
+  //
+  // For a given value in the module, returns the ID of the set of abstract
+  // memory locations reachable from it, which is the same for every value
+  // with the same reachable set.
+  //
+  ReachableSetID getReachableSetIDForValue(const Value *V);
+
+  //
+  // Returns the set of abstract memory locations with the given ID.
+  //
+  const AbstractLocSet *getReachableAbstractLocSet(ReachableSetID ID);
 };
 
 }
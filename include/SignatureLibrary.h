@@ -32,6 +32,7 @@ using namespace llvm;
 ///   - The return value (if applicable) is a sink
 class TaintReachable : public Signature {
 public:
+  virtual CalleeAccept acceptCallee(const Function &F) const { return AcceptsCallee; }
   virtual bool accept(const ContextID ctxt, const ImmutableCallSite cs) const;
   virtual std::vector<FlowRecord> process(const ContextID ctxt, const ImmutableCallSite cs) const;
 };
@@ -43,12 +44,14 @@ public:
 ///   - None
 class NoFlows : public Signature {
 public:
+  virtual CalleeAccept acceptCallee(const Function &F) const { return AcceptsCallee; }
   virtual bool accept(const ContextID ctxt, const ImmutableCallSite cs) const;
   virtual std::vector<FlowRecord> process(const ContextID ctxt, const ImmutableCallSite cs) const;
 };
 
 class ArgsToRet : public Signature {
 public:
+  virtual CalleeAccept acceptCallee(const Function &F) const { return AcceptsCallee; }
   virtual bool accept(const ContextID ctxt, const ImmutableCallSite cs) const;
   virtual std::vector<FlowRecord> process(const ContextID ctxt, const ImmutableCallSite cs) const;
 };
@@ -58,10 +61,15 @@ public:
 struct CallSummary;
 class StdLib: public Signature {
   std::vector<const CallSummary*> Calls;
+  // The summary of each callee acceptCallee was asked about, which is
+  // done before any call site is processed
+  mutable DenseMap<const Function *, const CallSummary *> CalleeCalls;
   void initCalls();
+  bool findEntry(const Function &F, const CallSummary *& S) const;
   bool findEntry(const ImmutableCallSite cs, const CallSummary *& S) const;
 public:
   StdLib() : Signature() { initCalls(); }
+  virtual CalleeAccept acceptCallee(const Function &F) const;
   virtual bool accept(const ContextID ctxt, const ImmutableCallSite cs) const;
   virtual std::vector<FlowRecord> process(const ContextID ctxt, const ImmutableCallSite cs) const;
 };
@@ -72,6 +80,7 @@ public:
 // Flows: From all arguments to return value, no direct/reachable pointers.
 class OverflowChecks : public Signature {
 public:
+  virtual CalleeAccept acceptCallee(const Function &F) const;
   virtual bool accept(const ContextID ctxt, const ImmutableCallSite cs) const;
   virtual std::vector<FlowRecord> process(const ContextID ctxt, const ImmutableCallSite cs) const;
 };
@@ -26,6 +26,8 @@ namespace deps {
 
 using namespace llvm;
 
+class ValueNumbering;
+
 class Slice {
 public:
   Slice(Infoflow & info,
@@ -36,6 +38,11 @@ public:
   bool directPtrInSlice(const Value & value);
   bool reachPtrInSlice(const Value & value);
   bool vargInSlice(const Function & fun);
+  /// Writes the forward and backward solutions to a SolutionFile, whose
+  /// Least and Greatest solutions then answer the queries above. Returns
+  /// false and sets error if the file could not be written.
+  bool writeSolutionFile(StringRef path, const ValueNumbering & numbering,
+                         std::string & error);
   ~Slice();
 private:
   bool cutAfterSinks;
@@ -0,0 +1,124 @@
+//===- SolutionFile.h -------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines SolutionFile, a binary file holding the taint of every
+// value of a module in a least and a greatest InfoflowSolution, which is
+// memory-mapped to answer queries without rerunning the analysis.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef SOLUTIONFILE_H
+#define SOLUTIONFILE_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+
+#include <string>
+
+namespace llvm {
+class Function;
+class Value;
+}
+
+namespace deps {
+
+using namespace llvm;
+
+class Infoflow;
+class InfoflowSolution;
+class ValueNumbering;
+
+/// SolutionFile - A mapped solution file. The file is a header followed by
+/// bitmaps indexed by ValueNumbering IDs: for each of the least and the
+/// greatest solution, whether each value, the locations it points to
+/// directly and the locations reachable from it are tainted, and whether
+/// the varargs of each function are.
+///
+/// Abstract locations have no identity outside of the process that
+/// computed them, so their taint is stored through the pointers that
+/// reach them. Bits are stored in host byte order; files written on a
+/// host with a different one fail to open.
+class SolutionFile {
+public:
+  enum Which { Least = 0, Greatest = 1 };
+
+  /// Writes the solutions of the module VN numbers to Path. LeastSoln and
+  /// GreatestSoln must come from infoflow. Returns false and sets Error if
+  /// the file could not be written.
+  static bool write(StringRef Path, const ValueNumbering &VN,
+                    Infoflow &infoflow, InfoflowSolution &LeastSoln,
+                    InfoflowSolution &GreatestSoln, std::string &Error);
+
+  /// Maps the solution file at Path, which must have been written for the
+  /// module VN numbers. Returns NULL and sets Error if it can't be mapped,
+  /// isn't a solution file or was written for a different module.
+  /// (caller delete)
+  static SolutionFile *open(StringRef Path, const ValueNumbering &VN,
+                            std::string &Error);
+  ~SolutionFile();
+
+  uint64_t fingerprint() const;
+  unsigned numValues() const;
+  unsigned numFunctions() const;
+
+  /// Queries by ValueNumbering ID
+  bool isTainted(Which W, unsigned ValueID) const {
+    return test(Bits[W][ValueBits], ValueID);
+  }
+  bool isDirectPtrTainted(Which W, unsigned ValueID) const {
+    return test(Bits[W][DirectPtrBits], ValueID);
+  }
+  bool isReachPtrTainted(Which W, unsigned ValueID) const {
+    return test(Bits[W][ReachPtrBits], ValueID);
+  }
+  bool isVargTainted(Which W, unsigned FunctionID) const {
+    return test(Bits[W][VargBits], FunctionID);
+  }
+
+private:
+  SolutionFile(const char *Base, size_t Size);
+  SolutionFile(const SolutionFile &);
+  SolutionFile &operator=(const SolutionFile &);
+
+  enum Bitmap { ValueBits = 0, DirectPtrBits, ReachPtrBits, VargBits,
+                NumBitmaps };
+  struct Header;
+
+  static bool test(const uint64_t *Words, unsigned ID) {
+    return (Words[ID / 64] >> (ID % 64)) & 1;
+  }
+
+  const char *Base;
+  size_t Size;
+  const uint64_t *Bits[2][NumBitmaps];
+};
+
+/// MappedSolution - One of the solutions in a SolutionFile, queried by
+/// value like an InfoflowSolution. Values that aren't numbered have the
+/// default level, and don't point to any tainted locations.
+class MappedSolution {
+public:
+  /// VN must be the numbering File was opened with.
+  MappedSolution(const SolutionFile &File, SolutionFile::Which W,
+                 const ValueNumbering &VN);
+
+  bool isTainted(const Value &) const;
+  bool isDirectPtrTainted(const Value &) const;
+  bool isReachPtrTainted(const Value &) const;
+  bool isVargTainted(const Function &) const;
+
+private:
+  const SolutionFile &File;
+  SolutionFile::Which W;
+  const ValueNumbering &VN;
+};
+
+}
+
+#endif /* SOLUTIONFILE_H */
@@ -15,16 +15,21 @@
 #define SOURCESINKANALYSIS_H_
 
 #include "llvm/Pass.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/Support/CallSite.h"
 #include "FlowRecord.h"
 
 #include <string>
 #include <set>
+#include <vector>
 
 using namespace llvm;
 
 namespace deps {
 
+struct CallTaintEntry;
+
 class SourceSinkAnalysis : public ModulePass {
 public:
   static char ID;
@@ -39,6 +44,22 @@ public:
     AU.setPreservesAll();
   }
 
+  /// The sources and sinks found in one function, each sorted and without
+  /// duplicates.
+  struct FunctionTaint {
+    std::vector<const Value *> Sources;
+    std::vector<const Value *> DirectPtrSources;
+    std::vector<const Value *> ReachPtrSources;
+    std::vector<const Value *> Sinks;
+    std::vector<const Value *> DirectPtrSinks;
+    std::vector<const Value *> ReachPtrSinks;
+  };
+
+  /// Find the sources and sinks of the arguments and instructions of F, in
+  /// one sweep over its call sites. Only reads the module and the tables
+  /// resolved by runOnModule, so functions may be classified in parallel.
+  void classifyFunction(Function &F, FunctionTaint &Taint) const;
+
   // Moved over from MISO so we can get at it from Infoflow...
   const FlowRecord & getSourcesAndSinks() const;
 
@@ -114,6 +135,14 @@ public:
 
   private:
   FlowRecord sourcesAndSinks;
+
+  // The source and sink table entries of each external function of the
+  // module, resolved once by name at the start of runOnModule.
+  DenseMap<const Function *, const CallTaintEntry *> SourceEntries;
+  DenseMap<const Function *, const CallTaintEntry *> SinkEntries;
+  // The functions whose demangled names make them C++ sinks
+  DenseSet<const Function *> CXXSinks;
+  void resolveTaintEntries(const Module &M);
 };
 
 }
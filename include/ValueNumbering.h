@@ -0,0 +1,70 @@
+//===- ValueNumbering.h -----------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines ValueNumbering, a dense numbering of the values of a
+// module that is the same every time the module is loaded.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef VALUENUMBERING_H
+#define VALUENUMBERING_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/DataTypes.h"
+
+#include <vector>
+
+namespace llvm {
+class Function;
+class Module;
+class Value;
+}
+
+namespace deps {
+
+using namespace llvm;
+
+/// ValueNumbering - Numbers the globals of a module, followed by each
+/// function together with its arguments, blocks and instructions, in module
+/// order. Functions are also numbered separately, for their varargs.
+/// Constants other than globals are not numbered.
+class ValueNumbering {
+public:
+  /// Returned for values and functions that aren't numbered
+  static const unsigned None = ~0U;
+
+  explicit ValueNumbering(const Module &M);
+
+  unsigned numValues() const { return Values.size(); }
+  unsigned numFunctions() const { return Functions.size(); }
+
+  unsigned valueID(const Value &V) const;
+  unsigned functionID(const Function &F) const;
+
+  const Value *value(unsigned ID) const { return Values[ID]; }
+  const Function *function(unsigned ID) const { return Functions[ID]; }
+
+  /// A hash of the shape of the module: the kind of every numbered value
+  /// and the names of the globals. Numberings of modules with the same
+  /// fingerprint agree.
+  uint64_t fingerprint() const { return Fingerprint; }
+
+private:
+  void add(const Value &V);
+
+  std::vector<const Value *> Values;
+  DenseMap<const Value *, unsigned> ValueIDs;
+  std::vector<const Function *> Functions;
+  DenseMap<const Function *, unsigned> FunctionIDs;
+  uint64_t Fingerprint;
+};
+
+}
+
+#endif /* VALUENUMBERING_H */
@@ -0,0 +1,47 @@
+//===-- CSRGraph.cpp --------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Counting-sort construction of compressed sparse row adjacency lists.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Constraints/CSRGraph.h"
+
+#include <cassert>
+
+using namespace deps;
+
+void CSRGraph::build(unsigned NumNodes, const EdgeList &Edges, bool Reverse) {
+  clear();
+  Offsets.resize(NumNodes + 1, 0);
+  Targets.resize(Edges.size());
+
+  // Count the out-degree of each node, shifted by one so that the
+  // prefix sum below leaves Offsets[N] at the start of N's row.
+  for (EdgeList::const_iterator I = Edges.begin(), E = Edges.end();
+       I != E; ++I) {
+    assert(I->first < NumNodes && I->second < NumNodes && "Edge out of range");
+    ++Offsets[(Reverse ? I->second : I->first) + 1];
+  }
+  for (unsigned N = 0; N < NumNodes; ++N)
+    Offsets[N + 1] += Offsets[N];
+
+  // Scatter the targets, using a copy of the row starts as insert cursors.
+  std::vector<unsigned> Cursor(Offsets.begin(), Offsets.end() - 1);
+  for (EdgeList::const_iterator I = Edges.begin(), E = Edges.end();
+       I != E; ++I) {
+    if (Reverse) Targets[Cursor[I->second]++] = I->first;
+    else Targets[Cursor[I->first]++] = I->second;
+  }
+}
+
+void CSRGraph::clear() {
+  std::vector<unsigned>().swap(Offsets);
+  std::vector<unsigned>().swap(Targets);
+}
@@ -0,0 +1,68 @@
+//===-- ConstraintStream.cpp ------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Appending constraints to, and recovering them from, a ConstraintStream.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Constraints/ConstraintStream.h"
+#include "Constraints/LHConstraints.h"
+#include "Constraints/Lattice.h"
+
+#include "llvm/Support/Casting.h"
+
+#include <algorithm>
+
+using namespace deps;
+using namespace llvm;
+
+void ConstraintStream::add(const ConsElem &lhs, const ConsElem &rhs) {
+  assert(!isa<LHJoin>(&lhs) && !isa<LHJoin>(&rhs) && "Joins must be expanded!");
+  const LHConsVar *L = dyn_cast<LHConsVar>(&lhs);
+  const LHConsVar *R = dyn_cast<LHConsVar>(&rhs);
+
+  if (L && R) {
+    Edges.push_back(std::make_pair(L->index(), R->index()));
+    NumNodes = std::max(NumNodes, std::max(L->index(), R->index()) + 1);
+  } else if (R) {
+    // A <= B, 'A' is high: 'B' is high
+    if (!LHKernel::isBottom(lhs)) LeastSeeds.push_back(R->index());
+  } else if (L) {
+    // A <= B, 'B' is low: 'A' is low
+    if (LHKernel::isBottom(rhs)) GreatestSeeds.push_back(L->index());
+  }
+}
+
+void ConstraintStream::appendTo(std::vector<LHConstraint> &C,
+                                const std::vector<const LHConsVar *> &Vars) const {
+  C.reserve(C.size() + size());
+  for (CSRGraph::EdgeList::const_iterator I = Edges.begin(), E = Edges.end();
+       I != E; ++I)
+    C.push_back(LHConstraint(*Vars[I->first], *Vars[I->second]));
+  for (std::vector<unsigned>::const_iterator I = LeastSeeds.begin(),
+       E = LeastSeeds.end(); I != E; ++I)
+    C.push_back(LHConstraint(LHConstant::high(), *Vars[*I]));
+  for (std::vector<unsigned>::const_iterator I = GreatestSeeds.begin(),
+       E = GreatestSeeds.end(); I != E; ++I)
+    C.push_back(LHConstraint(*Vars[*I], LHConstant::low()));
+}
+
+void ConstraintStream::markUsed(BitVector &Used) const {
+  for (CSRGraph::EdgeList::const_iterator I = Edges.begin(), E = Edges.end();
+       I != E; ++I) {
+    Used.set(I->first);
+    Used.set(I->second);
+  }
+  for (std::vector<unsigned>::const_iterator I = LeastSeeds.begin(),
+       E = LeastSeeds.end(); I != E; ++I)
+    Used.set(*I);
+  for (std::vector<unsigned>::const_iterator I = GreatestSeeds.begin(),
+       E = GreatestSeeds.end(); I != E; ++I)
+    Used.set(*I);
+}
@@ -0,0 +1,143 @@
+//===-- DemandSolution.cpp --------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Query-driven solutions of L-H constraints, by backward search.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Constraints/DemandSolution.h"
+#include "Constraints/LHConstraints.h"
+#include "Constraints/Lattice.h"
+#include "Constraints/SCCRemap.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Casting.h"
+
+#include <algorithm>
+
+using namespace deps;
+using namespace llvm;
+
+DemandGraph::DemandGraph(const std::vector<LHConstraint> &C, bool initial,
+                         const IntrusiveRefCntPtr<SCCRemap> &Remap)
+  : Remap(Remap) {
+  CSRGraph::EdgeList Edges;
+  unsigned NumNodes = 0;
+
+  // Same edges and seeds as PartialSolution::initialize, edges reversed
+  for (std::vector<LHConstraint>::const_iterator I = C.begin(), E = C.end();
+       I != E; ++I) {
+    const ConsElem &From = initial ? I->rhs() : I->lhs();
+    const ConsElem &To = initial ? I->lhs() : I->rhs();
+
+    const LHConsVar *Target = dyn_cast<LHConsVar>(&To);
+    if (!Target) continue;
+
+    if (const LHConsVar *Source = dyn_cast<LHConsVar>(&From)) {
+      Edges.push_back(std::make_pair(Target->index(), Source->index()));
+      NumNodes = std::max(NumNodes,
+                          std::max(Target->index(), Source->index()) + 1);
+      continue;
+    }
+
+    assert(isa<LHConstant>(&From) && "Unexpected join in constraint!");
+    if (initial == LHKernel::isBottom(From)) {
+      if (Target->index() >= Seeds.size()) Seeds.resize(Target->index() + 1);
+      Seeds.set(Target->index());
+    }
+  }
+
+  Preds.build(NumNodes, Edges);
+}
+
+unsigned DemandGraph::rep(unsigned V) const {
+  return Remap ? Remap->rep(V) : V;
+}
+
+bool DemandGraph::isSeed(unsigned V) const {
+  unsigned R = rep(V);
+  return R < Seeds.size() && Seeds.test(R);
+}
+
+void DemandGraph::appendPreds(unsigned V, std::vector<unsigned> &List) const {
+  // Every member of a collapsed component can change every other one
+  unsigned R = rep(V);
+  if (R != V) {
+    List.push_back(R);
+    return;
+  }
+  if (Remap)
+    List.insert(List.end(), Remap->member_begin(R), Remap->member_end(R));
+  List.insert(List.end(), Preds.succ_begin(R), Preds.succ_end(R));
+}
+
+bool DemandSolution::isChanged(unsigned Query) {
+  switch (state(Query)) {
+  case Changed: return true;
+  case Unchanged: return false;
+  default: break;
+  }
+
+  // Breadth first search backwards from Query, remembering where each
+  // variable was reached from so the path to a seed can be recovered.
+  DenseMap<unsigned, unsigned> Parent;
+  std::vector<unsigned> Queue;
+  std::vector<unsigned> Preds;
+  Parent[Query] = Query;
+  Queue.push_back(Query);
+
+  for (unsigned Next = 0; Next != Queue.size(); ++Next) {
+    unsigned V = Queue[Next];
+
+    bool Found = state(V) == Changed;
+    Preds.clear();
+    for (Graphs::const_iterator I = G.begin(), E = G.end();
+         I != E && !Found; ++I) {
+      Found = (*I)->isSeed(V);
+      (*I)->appendPreds(V, Preds);
+    }
+
+    if (Found) {
+      // Everything on the path from V to the query is changed as well
+      while (true) {
+        state(V) = Changed;
+        if (V == Query) return true;
+        V = Parent[V];
+      }
+    }
+
+    for (std::vector<unsigned>::iterator I = Preds.begin(), E = Preds.end();
+         I != E; ++I) {
+      // Known unchanged variables have no seed anywhere behind them
+      if (state(*I) == Unchanged) continue;
+      if (Parent.insert(std::make_pair(*I, V)).second)
+        Queue.push_back(*I);
+    }
+  }
+
+  // Everything that could change anything we visited was visited, and
+  // none of it is a seed.
+  for (std::vector<unsigned>::iterator I = Queue.begin(), E = Queue.end();
+       I != E; ++I)
+    state(*I) = Unchanged;
+  return false;
+}
+
+// The level of each variable, solving for it on demand, for LHKernel::eval
+struct DemandSolution::Level {
+  explicit Level(DemandSolution &S) : S(S) {}
+  bool operator()(unsigned V) const { return S.initial != S.isChanged(V); }
+  DemandSolution &S;
+};
+
+const LHConstant &DemandSolution::subst(const ConsElem &E) {
+  // Joins evaluate as in PartialSolution::subst
+  return LHKernel::eval(E, Level(*this)) ? LHConstant::high()
+                                         : LHConstant::low();
+}
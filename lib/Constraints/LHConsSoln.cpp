@@ -32,9 +32,9 @@ namespace deps {
         } else if (const LHConstant *var = llvm::dyn_cast<LHConstant>(&elem)) {
             return *var;
         } else if (const LHJoin *join = llvm::dyn_cast<LHJoin>(&elem)) {
-            const std::set<const ConsElem *> & elements = join->elements();
+            llvm::ArrayRef<const ConsElem *> elements = join->elements();
             const LHConstant *substVal = &defaultValue;
-            for (std::set<const ConsElem *>::iterator elem = elements.begin(), end = elements.end(); elem != end; ++elem) {
+            for (llvm::ArrayRef<const ConsElem *>::iterator elem = elements.begin(), end = elements.end(); elem != end; ++elem) {
                 substVal = &(substVal->join(subst(**elem)));
             }
             return *substVal;
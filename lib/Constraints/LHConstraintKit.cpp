@@ -14,26 +14,47 @@
 #define DEBUG_TYPE "deps"
 
 #include "Constraints/LHConstraintKit.h"
+#include "Constraints/DemandSolution.h"
 #include "Constraints/LHConstraints.h"
 #include "Constraints/LHConsSoln.h"
 #include "Constraints/PartialSolution.h"
+#include "Constraints/PhaseReport.h"
+#include "Constraints/SCCRemap.h"
 
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/Statistic.h"
 
+#include <algorithm>
+
 namespace deps {
 
 STATISTIC(explicitLHConstraints, "Number of explicit flow constraints");
 STATISTIC(implicitLHConstraints, "Number of implicit flow constraints");
+STATISTIC(collapsedLHConsVars, "Number of variables collapsed into cycles");
+STATISTIC(uniqueLHJoins, "Number of distinct joins");
+
+static llvm::cl::opt<bool> DepsCollapseCycles(
+  "deps-collapse-cycles", llvm::cl::desc("Collapse cycles in the constraint graph before solving"),
+  llvm::cl::init(false));
 
-LHConstraintKit::LHConstraintKit() {}
+static llvm::cl::opt<bool> DepsStreamConstraints(
+  "deps-stream-constraints",
+  llvm::cl::desc("Store constraints as graph edges as they are added, instead of as a list"),
+  llvm::cl::init(false));
+
+LHConstraintKit::LHConstraintKit() : compacted(false) {
+    // Create the constant singletons now, before any solver threads
+    // might race to do so.
+    LHConstant::low();
+    LHConstant::high();
+}
 
 LHConstraintKit::~LHConstraintKit() {
-    // Delete all associated LHConsVars
-    for (std::vector<const LHConsVar *>::iterator var = vars.begin(), end = vars.end();
-            var != end; ++var) {
-        delete(*var);
-    }
+    // LHConsVars and LHJoins own nothing, so freeing the allocator is
+    // enough to clean them up.
 
     for (llvm::StringMap<PartialSolution*>::iterator I = leastSolutions.begin(),
          E = leastSolutions.end(); I != E; ++I)
@@ -43,8 +64,10 @@ LHConstraintKit::~LHConstraintKit() {
       delete I->second;
 }
 
-const ConsVar &LHConstraintKit::newVar(const std::string description) {
-    LHConsVar *var = new LHConsVar(description);
+const ConsVar &LHConstraintKit::newVar(const llvm::StringRef description) {
+    assert(!compacted && "Kit was compacted");
+    llvm::StringRef desc = descriptions.GetOrCreateValue(description).getKey();
+    LHConsVar *var = new (allocator.Allocate<LHConsVar>()) LHConsVar(desc, vars.size());
     vars.push_back(var);
     return *var;
 }
@@ -57,50 +80,116 @@ const ConsElem &LHConstraintKit::highConstant() const {
     return LHConstant::high();
 }
 
+// Appends the elements of e to elems, looking through joins
+static void appendJoinElements(const ConsElem &e,
+                               llvm::SmallVectorImpl<const ConsElem *> &elems) {
+    if (const LHJoin *join = llvm::dyn_cast<LHJoin>(&e)) {
+        llvm::ArrayRef<const ConsElem *> elements = join->elements();
+        elems.append(elements.begin(), elements.end());
+    } else {
+        elems.push_back(&e);
+    }
+}
+
+const ConsElem &LHConstraintKit::getOrCreateJoin(llvm::SmallVectorImpl<const ConsElem *> &elems) {
+    // Low is the identity of join, so it can be left out
+    elems.erase(std::remove(elems.begin(), elems.end(), &LHConstant::low()), elems.end());
+    std::sort(elems.begin(), elems.end());
+    elems.erase(std::unique(elems.begin(), elems.end()), elems.end());
+
+    if (elems.empty()) return LHConstant::low();
+    if (elems.size() == 1) return *elems.front();
+
+    // Look for an existing join without copying the elements
+    llvm::FoldingSetNodeID ID;
+    LHJoin::Profile(ID, elems);
+    void *insertPos;
+    if (LHJoin *join = joins.FindNodeOrInsertPos(ID, insertPos)) return *join;
+
+    const ConsElem **copy = allocator.Allocate<const ConsElem *>(elems.size());
+    std::copy(elems.begin(), elems.end(), copy);
+    LHJoin *join = new (allocator.Allocate<LHJoin>())
+        LHJoin(llvm::ArrayRef<const ConsElem *>(copy, elems.size()));
+    joins.InsertNode(join, insertPos);
+    ++uniqueLHJoins;
+    return *join;
+}
+
 const ConsElem &LHConstraintKit::upperBound(const ConsElem &e1, const ConsElem &e2) {
-    const LHJoin *join = LHJoin::create(e1, e2);
-    std::set<LHJoin>::iterator J = joins.insert(*join).first;
-    delete join;
-    return *J;
+    llvm::SmallVector<const ConsElem *, 8> elems;
+    appendJoinElements(e1, elems);
+    appendJoinElements(e2, elems);
+    return getOrCreateJoin(elems);
 }
 
 const ConsElem *LHConstraintKit::upperBound(const ConsElem *e1, const ConsElem *e2) {
     if (e1 == NULL) return e2;
     if (e2 == NULL) return e1;
 
-    const LHJoin *join = LHJoin::create(*e1, *e2);
-    std::set<LHJoin>::iterator J = joins.insert(*join).first;
-    delete join;
-    return &*J;
+    return &upperBound(*e1, *e2);
 }
 
 const ConsElem &LHConstraintKit::upperBound(std::set<const ConsElem*> elems) {
-    const LHJoin join = LHJoin(elems);
-    std::set<LHJoin>::iterator J = joins.insert(join).first;
-    return *J;
+    llvm::SmallVector<const ConsElem *, 8> elements;
+    for (std::set<const ConsElem *>::iterator elem = elems.begin(),
+            end = elems.end(); elem != end; ++elem) {
+        appendJoinElements(**elem, elements);
+    }
+    return getOrCreateJoin(elements);
+}
+
+const ConsElem &LHConstraintKit::upperBound(llvm::ArrayRef<const ConsElem*> elems) {
+    llvm::SmallVector<const ConsElem *, 8> elements;
+    for (llvm::ArrayRef<const ConsElem *>::iterator elem = elems.begin(),
+            end = elems.end(); elem != end; ++elem) {
+        appendJoinElements(**elem, elements);
+    }
+    return getOrCreateJoin(elements);
 }
 
 std::vector<LHConstraint> &LHConstraintKit::getOrCreateConstraintSet(
         const std::string kind) {
-    return constraints.GetOrCreateValue(kind).getValue();
+    std::vector<LHConstraint> &set = constraints.GetOrCreateValue(kind).getValue();
+    llvm::StringMap<ConstraintStream>::iterator stream = streams.find(kind);
+    if (stream != streams.end()) {
+        stream->second.appendTo(set, vars);
+        streams.erase(stream);
+    }
+    return set;
 }
 
 void LHConstraintKit::addConstraint(const std::string kind,
         const ConsElem &lhs, const ConsElem &rhs) {
+    assert(!compacted && "Kit was compacted");
+    if (kind == "default") explicitLHConstraints++;
+    if (kind == "implicit") implicitLHConstraints++;
+
+    assert(!llvm::isa<LHJoin>(&rhs) && "We shouldn't have joins on rhs!");
+
     if (lockedConstraintKinds.find(kind) != lockedConstraintKinds.end()) {
-        assert(false && "Have already started solving this kind and cannot add more constraints.");
+        addToLockedKind(kind, lhs, rhs);
+        return;
     }
 
-    if (kind == "default") explicitLHConstraints++;
-    if (kind == "implicit") implicitLHConstraints++;
+    if (DepsStreamConstraints) {
+        ConstraintStream &stream = streams[kind];
+        if (const LHJoin *left = llvm::dyn_cast<LHJoin>(&lhs)) {
+            llvm::ArrayRef<const ConsElem *> elems = left->elements();
+            for (llvm::ArrayRef<const ConsElem *>::iterator elem = elems.begin(),
+                    end = elems.end(); elem != end; ++elem) {
+                stream.add(**elem, rhs);
+            }
+        } else {
+            stream.add(lhs, rhs);
+        }
+        return;
+    }
 
     std::vector<LHConstraint> &set = getOrCreateConstraintSet(kind);
 
-    assert(!llvm::isa<LHJoin>(&rhs) && "We shouldn't have joins on rhs!");
-
     if (const LHJoin *left = llvm::dyn_cast<LHJoin>(&lhs)) {
-        std::set<const ConsElem *> elems = left->elements();
-        for (std::set<const ConsElem *>::iterator elem = elems.begin(),
+        llvm::ArrayRef<const ConsElem *> elems = left->elements();
+        for (llvm::ArrayRef<const ConsElem *>::iterator elem = elems.begin(),
                 end = elems.end(); elem != end; ++elem) {
             const LHConstraint c(**elem, rhs);
             set.push_back(c);
@@ -111,12 +200,59 @@ void LHConstraintKit::addConstraint(const std::string kind,
     }
 }
 
+const ConsElem &LHConstraintKit::condense(const SCCRemap *Remap,
+                                          const ConsElem &elem) const {
+    if (Remap) {
+        if (const LHConsVar *var = llvm::dyn_cast<LHConsVar>(&elem))
+            return *vars[Remap->rep(var->index())];
+    }
+    return elem;
+}
+
+void LHConstraintKit::addToLockedKind(const std::string kind,
+        const ConsElem &lhs, const ConsElem &rhs) {
+    // Condense the new constraints the same way as the rest of the kind
+    const SCCRemap *Remap = remapFor(kind);
+    std::vector<LHConstraint> added;
+    const ConsElem &right = condense(Remap, rhs);
+    if (const LHJoin *left = llvm::dyn_cast<LHJoin>(&lhs)) {
+        llvm::ArrayRef<const ConsElem *> elems = left->elements();
+        for (llvm::ArrayRef<const ConsElem *>::iterator elem = elems.begin(),
+                end = elems.end(); elem != end; ++elem) {
+            added.push_back(LHConstraint(condense(Remap, **elem), right));
+        }
+    } else {
+        added.push_back(LHConstraint(condense(Remap, lhs), right));
+    }
+
+    // Graphs handed out to demand solutions stay as they are, but are
+    // rebuilt for later ones
+    leastGraphs.erase(kind);
+    greatestGraphs.erase(kind);
+
+    // Solutions that exist already only need to propagate the new
+    // constraints. Keep them for the ones still to be built.
+    llvm::StringMap<PartialSolution*>::iterator least = leastSolutions.find(kind);
+    llvm::StringMap<PartialSolution*>::iterator greatest = greatestSolutions.find(kind);
+    if (least == leastSolutions.end() || greatest == greatestSolutions.end()) {
+        std::vector<LHConstraint> &set = getOrCreateConstraintSet(kind);
+        set.insert(set.end(), added.begin(), added.end());
+    }
+    if (least != leastSolutions.end())
+        least->second->addConstraints(added);
+    if (greatest != greatestSolutions.end())
+        greatest->second->addConstraints(added);
+}
+
 ConsSoln *LHConstraintKit::leastSolution(const std::set<std::string> kinds) {
+  PhaseTimer T("least solution");
+  assert(!compacted && "Kit was compacted");
   PartialSolution *PS = NULL;
   for (std::set<std::string>::iterator kind = kinds.begin(), end = kinds.end(); kind != end; ++kind) {
     if (!leastSolutions.count(*kind)) {
-      lockedConstraintKinds.insert(*kind);
-      leastSolutions[*kind] = new PartialSolution(getOrCreateConstraintSet(*kind), false);
+      lockKind(*kind);
+      leastSolutions[*kind] = new PartialSolution(getOrCreateConstraintSet(*kind), false,
+                                                  remapFor(*kind));
       freeUnneededConstraints(*kind);
     }
     PartialSolution *P = leastSolutions[*kind];
@@ -125,15 +261,19 @@ ConsSoln *LHConstraintKit::leastSolution(const std::set<std::string> kinds) {
     else PS->mergeIn(*P);
   }
   assert(PS && "No kinds given?");
+  PS->freeze();
   return PS;
 }
 
 ConsSoln *LHConstraintKit::greatestSolution(const std::set<std::string> kinds) {
+  PhaseTimer T("greatest solution");
+  assert(!compacted && "Kit was compacted");
   PartialSolution *PS = NULL;
   for (std::set<std::string>::iterator kind = kinds.begin(), end = kinds.end(); kind != end; ++kind) {
     if (!greatestSolutions.count(*kind)) {
-      lockedConstraintKinds.insert(*kind);
-      greatestSolutions[*kind] = new PartialSolution(getOrCreateConstraintSet(*kind), true);
+      lockKind(*kind);
+      greatestSolutions[*kind] = new PartialSolution(getOrCreateConstraintSet(*kind), true,
+                                                     remapFor(*kind));
       freeUnneededConstraints(*kind);
     }
     PartialSolution *P = greatestSolutions[*kind];
@@ -142,17 +282,170 @@ ConsSoln *LHConstraintKit::greatestSolution(const std::set<std::string> kinds) {
     else PS->mergeIn(*P);
   }
   assert(PS && "No kinds given?");
+  PS->freeze();
   return PS;
 }
 
+ConsSoln *LHConstraintKit::leastDemandSolution(const std::set<std::string> kinds) {
+  return demandSolution(kinds, false);
+}
+
+ConsSoln *LHConstraintKit::greatestDemandSolution(const std::set<std::string> kinds) {
+  return demandSolution(kinds, true);
+}
+
+ConsSoln *LHConstraintKit::demandSolution(const std::set<std::string> kinds, bool initial) {
+  llvm::StringMap<llvm::IntrusiveRefCntPtr<DemandGraph> > &graphs =
+    initial ? greatestGraphs : leastGraphs;
+
+  PhaseTimer T("demand solution setup");
+  assert(!compacted && "Kit was compacted");
+  DemandSolution::Graphs G;
+  for (std::set<std::string>::iterator kind = kinds.begin(), end = kinds.end(); kind != end; ++kind) {
+    lockKind(*kind);
+    if (!graphs.count(*kind)) {
+      // Once both full solutions exist, the constraints are gone, but
+      // the full solutions are cheap to merge
+      if (leastSolutions.count(*kind) && greatestSolutions.count(*kind))
+        return initial ? greatestSolution(kinds) : leastSolution(kinds);
+      graphs[*kind] = new DemandGraph(getOrCreateConstraintSet(*kind),
+                                      initial, remaps.lookup(*kind));
+    }
+    G.push_back(graphs[*kind]);
+  }
+  assert(!G.empty() && "No kinds given?");
+  return new DemandSolution(G, initial);
+}
+
+bool LHConstraintKit::lockKind(const std::string kind) {
+  if (!lockedConstraintKinds.insert(kind).second)
+    return false;
+
+  if (PhaseReport::enabled())
+    reportKindSize(kind);
+
+  if (DepsCollapseCycles) {
+    if (SCCRemap *Remap = SCCRemap::collapse(getOrCreateConstraintSet(kind), vars)) {
+      collapsedLHConsVars += Remap->numCollapsed();
+      remaps[kind] = Remap;
+    }
+  }
+  return true;
+}
+
+void LHConstraintKit::reportKindSize(const std::string kind) {
+  // Count streamed constraints where they are
+  size_t size = 0;
+  llvm::BitVector used(vars.size());
+  llvm::StringMap<ConstraintStream>::const_iterator stream = streams.find(kind);
+  if (stream != streams.end()) {
+    size += stream->second.size();
+    stream->second.markUsed(used);
+  }
+  std::vector<LHConstraint> &set = constraints.GetOrCreateValue(kind).getValue();
+  size += set.size();
+  for (std::vector<LHConstraint>::const_iterator c = set.begin(), end = set.end();
+       c != end; ++c) {
+    if (const LHConsVar *var = llvm::dyn_cast<LHConsVar>(&c->lhs()))
+      used.set(var->index());
+    if (const LHConsVar *var = llvm::dyn_cast<LHConsVar>(&c->rhs()))
+      used.set(var->index());
+  }
+
+  PhaseReport &report = PhaseReport::get();
+  report.maxCount("variables", vars.size());
+  report.maxCount("distinct joins", joins.size());
+  report.maxCount("constraints in kind " + kind, size);
+  report.maxCount("variables in kind " + kind, used.count());
+}
+
+const SCCRemap *LHConstraintKit::remapFor(const std::string kind) const {
+  llvm::StringMap<llvm::IntrusiveRefCntPtr<SCCRemap> >::const_iterator I =
+    remaps.find(kind);
+  return I == remaps.end() ? NULL : I->second.getPtr();
+}
+
+void LHConstraintKit::compact() {
+  PhaseTimer T("compact constraint kit");
+  compacted = true;
+
+  // Solutions handed out are frozen copies, or hold references to what
+  // they share with others (demand graphs and the remaps they were built
+  // over, lane solutions), so the kit's own can go.
+  for (llvm::StringMap<PartialSolution*>::iterator I = leastSolutions.begin(),
+       E = leastSolutions.end(); I != E; ++I)
+    delete I->second;
+  leastSolutions.clear();
+  for (llvm::StringMap<PartialSolution*>::iterator I = greatestSolutions.begin(),
+       E = greatestSolutions.end(); I != E; ++I)
+    delete I->second;
+  greatestSolutions.clear();
+  remaps.clear();
+  leastGraphs.clear();
+  greatestGraphs.clear();
+
+  constraints.clear();
+  streams.clear();
+
+  // The variables and joins themselves are still referred to by the
+  // solutions' users, but nothing looks them up any more.
+  for (std::vector<const LHConsVar *>::iterator I = vars.begin(), E = vars.end();
+       I != E; ++I)
+    const_cast<LHConsVar *>(*I)->desc = llvm::StringRef();
+  std::vector<const LHConsVar *>().swap(vars);
+  descriptions.clear();
+  descriptions.getAllocator().Reset();
+  joins.clear();
+}
+
 void LHConstraintKit::freeUnneededConstraints(std::string kind) {
   // If we have the two kinds of PartialSolutions already generated
   // for this kind, then we no longer need the original constraints
   if (lockedConstraintKinds.count(kind) &&
       leastSolutions.count(kind) &&
       greatestSolutions.count(kind)) {
-    // Clear out the constraints for this kind!
-    getOrCreateConstraintSet(kind).clear();
+    // Clear out the constraints for this kind! (clear() alone would
+    // keep the memory.)
+    std::vector<LHConstraint>().swap(getOrCreateConstraintSet(kind));
+  }
+}
+
+// Variables by index, constants as L and H
+static void writeElem(llvm::raw_ostream &OS, const ConsElem &elem) {
+  if (const LHConsVar *var = llvm::dyn_cast<LHConsVar>(&elem))
+    OS << ' ' << var->index();
+  else
+    OS << ' ' << (elem.leq(LHConstant::low()) ? 'L' : 'H');
+}
+
+void LHConstraintKit::writeConstraints(llvm::raw_ostream &OS) const {
+  OS << "deps-constraints 1\n";
+  OS << "vars " << vars.size() << "\n";
+  std::set<std::string> kinds;
+  for (llvm::StringMap<std::vector<LHConstraint> >::const_iterator
+       I = constraints.begin(), E = constraints.end(); I != E; ++I)
+    kinds.insert(I->getKey().str());
+  for (llvm::StringMap<ConstraintStream>::const_iterator
+       I = streams.begin(), E = streams.end(); I != E; ++I)
+    kinds.insert(I->getKey().str());
+
+  for (std::set<std::string>::const_iterator
+       I = kinds.begin(), E = kinds.end(); I != E; ++I) {
+    std::vector<LHConstraint> set;
+    llvm::StringMap<std::vector<LHConstraint> >::const_iterator
+      listed = constraints.find(*I);
+    if (listed != constraints.end()) set = listed->getValue();
+    llvm::StringMap<ConstraintStream>::const_iterator stream = streams.find(*I);
+    if (stream != streams.end()) stream->second.appendTo(set, vars);
+
+    OS << "kind " << *I << "\n";
+    for (std::vector<LHConstraint>::const_iterator C = set.begin(),
+         CE = set.end(); C != CE; ++C) {
+      OS << 'c';
+      writeElem(OS, C->lhs());
+      writeElem(OS, C->rhs());
+      OS << "\n";
+    }
   }
 }
 
@@ -19,7 +19,7 @@ namespace deps {
 LHConstant *LHConstant::lowSingleton = NULL;
 LHConstant *LHConstant::highSingleton = NULL;
 
-LHConstant::LHConstant(LHLevel level) : level(level) { }
+LHConstant::LHConstant(LHLevel level) : ConsElem(DT_LHConstant), level(level) { }
 
 const LHConstant &LHConstant::low() {
     if (LHConstant::lowSingleton == NULL) {
@@ -57,7 +57,8 @@ bool LHConstant::operator== (const ConsElem& elem) const {
 }
 
 
-LHConsVar::LHConsVar(const std::string description) : desc(description) { }
+LHConsVar::LHConsVar(llvm::StringRef description, unsigned index)
+  : ConsVar(DT_LHConsVar), desc(description), idx(index) { }
 
 bool LHConsVar::leq(const ConsElem &elem) const {
     return false;
@@ -71,10 +72,11 @@ bool LHConsVar::operator== (const ConsElem& elem) const {
     }
 }
 
-LHJoin::LHJoin(std::set<const ConsElem *> elements) : elems(elements) { }
+LHJoin::LHJoin(llvm::ArrayRef<const ConsElem *> elements)
+  : ConsElem(DT_LHJoin), elems(elements) { }
 
 bool LHJoin::leq(const ConsElem &other) const {
-    for (std::set<const ConsElem *>::iterator elem = elems.begin(), end = elems.end(); elem != end; ++elem) {
+    for (llvm::ArrayRef<const ConsElem *>::iterator elem = elems.begin(), end = elems.end(); elem != end; ++elem) {
         if (!(*elem)->leq(other)) {
             return false;
         }
@@ -83,29 +85,17 @@ bool LHJoin::leq(const ConsElem &other) const {
 }
 
 void LHJoin::variables(std::set<const ConsVar*> & vars) const {
-    for (std::set<const ConsElem *>::iterator elem = elems.begin(), end = elems.end(); elem != end; ++elem) {
+    for (llvm::ArrayRef<const ConsElem *>::iterator elem = elems.begin(), end = elems.end(); elem != end; ++elem) {
         (*elem)->variables(vars);
     }
 }
 
-const LHJoin *LHJoin::create(const ConsElem &e1, const ConsElem &e2) {
-    std::set<const ConsElem *> elements;
-
-    if (const LHJoin *j1 = llvm::dyn_cast<LHJoin>(&e1)) {
-        const std::set<const ConsElem *> & j1elements = j1->elements();
-        elements.insert(j1elements.begin(), j1elements.end());
-    } else {
-        elements.insert(&e1);
-    }
-
-    if (const LHJoin *j2 = llvm::dyn_cast<LHJoin>(&e2)) {
-        const std::set<const ConsElem *> & j2elements = j2->elements();
-        elements.insert(j2elements.begin(), j2elements.end());
-    } else {
-        elements.insert(&e2);
+void LHJoin::Profile(llvm::FoldingSetNodeID &ID,
+                     llvm::ArrayRef<const ConsElem *> elems) {
+    ID.AddInteger(elems.size());
+    for (llvm::ArrayRef<const ConsElem *>::iterator elem = elems.begin(), end = elems.end(); elem != end; ++elem) {
+        ID.AddPointer(*elem);
     }
-
-    return new LHJoin(elements);
 }
 
 bool LHJoin::operator== (const ConsElem& elem) const {
@@ -0,0 +1,216 @@
+//===-- LaneSolution.cpp ----------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Bit-parallel propagation of many least solutions over a shared one.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Constraints/LaneSolution.h"
+#include "Constraints/Lattice.h"
+#include "Constraints/PartialSolution.h"
+#include "Constraints/PhaseReport.h"
+#include "Constraints/ThreadPool.h"
+
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/MathExtras.h"
+
+#include <algorithm>
+
+using namespace deps;
+using namespace llvm;
+
+// Solve one group of lanes
+class LaneSolution::GroupTask : public PoolTask {
+public:
+  GroupTask(LaneSolution &S, unsigned Group,
+            const std::vector<PartialSolution*> &Lanes,
+            const std::vector<Seed> &Seeds)
+    : S(S), Group(Group), Lanes(Lanes), Seeds(Seeds) {}
+
+  virtual void run() { S.solveGroup(Group, Lanes, Seeds); }
+
+private:
+  LaneSolution &S;
+  unsigned Group;
+  const std::vector<PartialSolution*> &Lanes;
+  const std::vector<Seed> &Seeds;
+};
+
+// Adds Bits to the words of the variables forEachSucc() visits, queueing
+// the variables that gained any.
+struct LaneSolution::Propagator {
+  Propagator(const PartialSolution &Shared, WordMap &Words, WordMap &Pending,
+             std::vector<unsigned> &WorkList)
+    : Shared(Shared), Words(Words), Pending(Pending), WorkList(WorkList),
+      Bits(0) {}
+
+  void operator()(unsigned V) {
+    // Already changed in every lane
+    if (Shared.isChanged(V)) return;
+
+    Word &Old = Words[V];
+    Word New = Bits & ~Old;
+    if (!New) return;
+    Old |= New;
+
+    // Propagate only the bits that haven't been propagated from V yet
+    Word &Queued = Pending[V];
+    if (!Queued) WorkList.push_back(V);
+    Queued |= New;
+  }
+
+  const PartialSolution &Shared;
+  WordMap &Words;
+  WordMap &Pending;
+  std::vector<unsigned> &WorkList;
+  Word Bits;
+};
+
+LaneSolution::LaneSolution(PartialSolution *Shared,
+                           const std::vector<PartialSolution*> &Lanes)
+  : Shared(Shared), NumLanes(Lanes.size()) {
+  solveGroups(Lanes, std::vector<Seed>());
+}
+
+LaneSolution::LaneSolution(PartialSolution *Shared,
+                           const std::vector<Seed> &Seeds, unsigned NumLanes)
+  : Shared(Shared), NumLanes(NumLanes) {
+  solveGroups(std::vector<PartialSolution*>(), Seeds);
+}
+
+void LaneSolution::solveGroups(const std::vector<PartialSolution*> &Lanes,
+                               const std::vector<Seed> &Seeds) {
+  Groups.resize((NumLanes + LanesPerGroup - 1) / LanesPerGroup);
+
+  {
+    ThreadPool::Batch B(ThreadPool::global());
+    for (unsigned G = 0, E = Groups.size(); G != E; ++G)
+      B.async(new GroupTask(*this, G, Lanes, Seeds));
+    B.wait();
+  }
+
+  // Only Shared's own VSet is needed from here on
+  Shared->freeze();
+}
+
+LaneSolution::~LaneSolution() {
+  delete Shared;
+}
+
+void LaneSolution::solveGroup(unsigned Group,
+                              const std::vector<PartialSolution*> &Lanes,
+                              const std::vector<Seed> &Seeds) {
+  WordMap &Words = Groups[Group];
+  WordMap Pending;
+  std::vector<unsigned> WorkList;
+  Propagator Prop(*Shared, Words, Pending, WorkList);
+
+  unsigned Begin = Group * LanesPerGroup;
+  unsigned End = std::min(Begin + LanesPerGroup, NumLanes);
+
+  // Each lane starts out with its own changed variables, and with the
+  // consequences of its own edges out of the variables Shared changed,
+  // exactly what merging Shared into a copy of the lane would propagate.
+  std::vector<unsigned> Vars;
+  for (unsigned L = Begin; L != End && !Lanes.empty(); ++L) {
+    const PartialSolution &Lane = *Lanes[L];
+    assert(!Lane.initial && "Lanes must be least solutions!");
+    Prop.Bits = Word(1) << (L - Begin);
+
+    Vars.clear();
+    Lane.appendChanged(Vars);
+    for (std::vector<unsigned>::iterator I = Vars.begin(), E = Vars.end();
+         I != E; ++I)
+      Prop(*I);
+
+    Vars.clear();
+    Lane.appendSources(Vars);
+    for (std::vector<unsigned>::iterator I = Vars.begin(), E = Vars.end();
+         I != E; ++I)
+      if (Shared->isChanged(*I)) Lane.forEachSucc(*I, Prop);
+  }
+
+  // Lanes of seeds only start out with those
+  for (std::vector<Seed>::const_iterator I = Seeds.begin(), E = Seeds.end();
+       I != E; ++I) {
+    assert(I->Lane < NumLanes && "Seed of an unknown lane!");
+    if (I->Lane < Begin || I->Lane >= End) continue;
+    Prop.Bits = Word(1) << (I->Lane - Begin);
+    Prop(I->Var);
+  }
+
+  uint64_t Steps = 0;
+  while (!WorkList.empty()) {
+    unsigned V = WorkList.back();
+    WorkList.pop_back();
+    ++Steps;
+
+    WordMap::iterator I = Pending.find(V);
+    assert(I != Pending.end());
+    Word Bits = I->second;
+    Pending.erase(I);
+
+    // Shared edges carry every lane...
+    Prop.Bits = Bits;
+    for (std::vector<PartialSolution*>::iterator CI = Shared->Chained.begin(),
+         CE = Shared->Chained.end(); CI != CE; ++CI)
+      (*CI)->forEachSucc(V, Prop);
+
+    // ...a lane's own edges only that lane
+    while (Bits && !Lanes.empty()) {
+      unsigned L = CountTrailingZeros_64(Bits);
+      Bits &= Bits - 1;
+      Prop.Bits = Word(1) << L;
+      Lanes[Begin + L]->forEachSucc(V, Prop);
+    }
+  }
+  if (Steps && PhaseReport::enabled())
+    PhaseReport::get().addCount("lane propagation steps", Steps);
+}
+
+bool LaneSolution::isChanged(unsigned V, unsigned Lane) const {
+  assert(Lane < NumLanes);
+  if (Shared->isChanged(V)) return true;
+
+  const WordMap &Words = Groups[Lane / LanesPerGroup];
+  WordMap::const_iterator I = Words.find(V);
+  if (I == Words.end()) return false;
+  return (I->second >> (Lane % LanesPerGroup)) & 1;
+}
+
+typedef LatticeKernel<BitmaskLattice<LaneSolution::LanesPerGroup> > GroupKernel;
+
+// The level of each variable in the lanes of one group, for
+// GroupKernel::eval. Variables changed in Shared are in every lane.
+struct LaneSolution::GroupLevel {
+  GroupLevel(const PartialSolution &Shared, const WordMap &Words)
+    : Shared(Shared), Words(Words) {}
+
+  Word operator()(unsigned V) const {
+    if (Shared.isChanged(V)) return BitmaskLattice<LanesPerGroup>::top();
+    WordMap::const_iterator I = Words.find(V);
+    return I == Words.end() ? 0 : I->second;
+  }
+
+  const PartialSolution &Shared;
+  const WordMap &Words;
+};
+
+uint64_t LaneSolution::levels(const ConsElem &E, unsigned Group) const {
+  assert(Group < Groups.size());
+  return GroupKernel::eval(E, GroupLevel(*Shared, Groups[Group]));
+}
+
+const LHConstant &LaneView::subst(const ConsElem &E) {
+  // Joins evaluate as in PartialSolution::subst, for all the group's lanes
+  // at once
+  uint64_t Levels = S->levels(E, Lane / LaneSolution::LanesPerGroup);
+  return (Levels >> (Lane % LaneSolution::LanesPerGroup)) & 1
+    ? LHConstant::high() : LHConstant::low();
+}
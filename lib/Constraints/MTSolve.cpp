@@ -7,159 +7,272 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// Solve for greatest and least using two threads.
+// Solve for greatest and least solutions using the shared ThreadPool.
 //
 //===----------------------------------------------------------------------===//
 
 #include "Infoflow.h"
 #include "Constraints/LHConstraintKit.h"
+#include "Constraints/LaneSolution.h"
 #include "Constraints/LHConstraints.h"
 #include "Constraints/PartialSolution.h"
-#include "Constraints/SolverThread.h"
+#include "Constraints/PhaseReport.h"
+#include "Constraints/ThreadPool.h"
+
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/CommandLine.h"
 
-#include "llvm/Support/Threading.h"
-#include "llvm/Support/Atomic.h"
 #include <cassert>
 
 using namespace llvm;
 
+static cl::opt<bool> DepsLaneSolver(
+  "deps-lane-solver",
+  cl::desc("Solve many source kinds at once, one bit per kind"),
+  cl::init(false));
+
 namespace deps {
 
-SolverThread* SolverThread::spawn(Constraints &C, bool greatest) {
-  SolverThread *T = new SolverThread(C, greatest);
+typedef std::vector<LHConstraint> Constraints;
+
+namespace {
+
+// Solve the given constraints for the least or greatest solution
+class SolveTask : public PoolTask {
+public:
+  SolveTask(Constraints &C, bool greatest, const SCCRemap *Remap,
+            PartialSolution *&Result)
+    : C(C), greatest(greatest), Remap(Remap), Result(Result) {}
 
-  if (::pthread_create(&T->thread, NULL, solve, T)) {
-    assert(0 && "Failed to create thread?!");
+  virtual void run() {
+    Result = new PartialSolution(C, greatest, Remap);
   }
 
-  return T;
-}
+private:
+  Constraints &C;
+  bool greatest;
+  const SCCRemap *Remap;
+  PartialSolution *&Result;
+};
 
-void* SolverThread::solve(void* arg) {
-  assert(arg);
-  SolverThread *T = (SolverThread*)arg;
-  PartialSolution *P = new PartialSolution(T->C, T->greatest);
-  return (void*)P;
-}
+// Solve for the least or greatest solution over a graph shared by both.
+// The graph is only borrowed: its reference count must not be touched from
+// the pool.
+class SharedSolveTask : public PoolTask {
+public:
+  SharedSolveTask(const SharedGraph *G, bool greatest,
+                  const SCCRemap *Remap, PartialSolution *&Result)
+    : G(G), greatest(greatest), Remap(Remap), Result(Result) {}
+
+  virtual void run() {
+    Result = new PartialSolution(G, greatest, Remap);
+  }
 
-void SolverThread::join(PartialSolution*& P) {
-  ::pthread_join(thread, (void**)&P);
-}
+private:
+  const SharedGraph *G;
+  bool greatest;
+  const SCCRemap *Remap;
+  PartialSolution *&Result;
+};
+
+// Solve the constraints for one source kind, and merge a copy of that
+// solution with the default solution(s)
+class MergeTask : public PoolTask {
+public:
+  MergeTask(Constraints &C, const SCCRemap *Remap,
+            PartialSolution *Default, PartialSolution *DefaultSinks,
+            PartialSolution *&Solution, PartialSolution *&Merged)
+    : C(C), Remap(Remap), Default(Default), DefaultSinks(DefaultSinks),
+      Solution(Solution), Merged(Merged) {}
+
+  virtual void run() {
+    Solution = new PartialSolution(C, false, Remap);
+    Merged = new PartialSolution(*Solution);
+    Merged->mergeIn(*Default);
+    if (DefaultSinks)
+      Merged->mergeIn(*DefaultSinks);
+  }
+
+private:
+  Constraints &C;
+  const SCCRemap *Remap;
+  PartialSolution *Default;
+  PartialSolution *DefaultSinks;
+  PartialSolution *&Solution;
+  PartialSolution *&Merged;
+};
+
+} // end anonymous namespace
 
 void LHConstraintKit::solveMT(std::string kind) {
-  assert(lockedConstraintKinds.insert(kind).second && "Already solved");
+  PhaseTimer T("solveMT");
+  assert(!compacted && "Kit was compacted");
+  bool Fresh = lockKind(kind);
+  assert(Fresh && "Already solved");
+  (void)Fresh;
   assert(!leastSolutions.count(kind));
   assert(!greatestSolutions.count(kind));
 
-  PartialSolution*& G = greatestSolutions[kind];
-  PartialSolution*& L = leastSolutions[kind];
-
-  Constraints &C = getOrCreateConstraintSet(kind);
-
-  SolverThread *TG = SolverThread::spawn(C, true);
-  SolverThread *TL = SolverThread::spawn(C, false);
+  PartialSolution *G = NULL;
+  PartialSolution *L = NULL;
+
+  // Scan the constraints once, into one graph both solutions propagate
+  // over at the same time. Streamed constraints are in the right form
+  // already.
+  IntrusiveRefCntPtr<SharedGraph> Graph;
+  llvm::StringMap<ConstraintStream>::iterator Stream = streams.find(kind);
+  if (Stream != streams.end()) {
+    Graph = new SharedGraph(Stream->second);
+    streams.erase(Stream);
+  } else {
+    Graph = new SharedGraph(getOrCreateConstraintSet(kind));
+  }
 
-  TG->join(G);
-  TL->join(L);
+  {
+    ThreadPool::Batch B(ThreadPool::global());
+    B.async(new SharedSolveTask(Graph.getPtr(), true, remapFor(kind), G));
+    B.async(new SharedSolveTask(Graph.getPtr(), false, remapFor(kind), L));
+    B.wait();
+  }
 
-  delete TG;
-  delete TL;
+  // Back on this thread, so the solutions may take their references
+  G->keepGraph(Graph);
+  L->keepGraph(Graph);
 
-  assert(leastSolutions.count(kind));
-  assert(greatestSolutions.count(kind));
+  greatestSolutions[kind] = G;
+  leastSolutions[kind] = L;
 
   // Cleanup
   freeUnneededConstraints(kind);
 }
 
-
-struct MergeInfo {
-  PartialSolution * Default;
-  PartialSolution * DefaultSinks;
-  bool useDefaultSinks;
-  std::vector<PartialSolution*> Mergees;
-};
-
-void* merge(void *arg) {
-  MergeInfo *MI = (MergeInfo*)arg;
-  for (std::vector<PartialSolution*>::iterator I = MI->Mergees.begin(),
-	 E = MI->Mergees.end(); I != E; ++I) {
-    (*I)->mergeIn(*MI->Default);
-    if (MI->useDefaultSinks) {
-      (*I)->mergeIn(*MI->DefaultSinks);
-    }
-  }
-  return NULL;
-}
-
-std::vector<PartialSolution*>
+std::vector<ConsSoln*>
 LHConstraintKit::solveLeastMT(std::vector<std::string> kinds, bool useDefaultSinks) {
+  PhaseTimer T("solveLeastMT");
+  assert(!compacted && "Kit was compacted");
   assert(leastSolutions.count("default"));
+  assert((!useDefaultSinks || leastSolutions.count("default-sinks")) &&
+         "Default sinks not solved yet!");
 
   PartialSolution *P = leastSolutions["default"];
-  PartialSolution *DS = leastSolutions["default-sinks"];
-  std::vector<PartialSolution*> ToMerge;
+  PartialSolution *DS = useDefaultSinks ? leastSolutions["default-sinks"] : NULL;
+
+  // Lock (and condense) all the kinds up front, the workers only read
+  // from the kit.
   for (std::vector<std::string>::iterator kind = kinds.begin(), end = kinds.end();
        kind != end; ++kind) {
-    assert(lockedConstraintKinds.insert(*kind).second && "Already solved");
+    bool Fresh = lockKind(*kind);
+    assert(Fresh && "Already solved");
+    (void)Fresh;
     assert(!leastSolutions.count(*kind));
-    leastSolutions[*kind] = new PartialSolution(getOrCreateConstraintSet(*kind), false);
-    ToMerge.push_back(new PartialSolution(*leastSolutions[*kind]));
   }
 
-  // Make copy of the set of solutions for returning when we're done
-  std::vector<PartialSolution*> Merged(ToMerge);
+  std::vector<PartialSolution*> Solutions(kinds.size());
+  std::vector<ConsSoln*> Result;
+
+  if (DepsLaneSolver) {
+    // The kinds on their own are cheap to solve, they are mostly seeds.
+    // Merging is what's expensive, so merge the defaults just once and
+    // propagate every kind over the result at the same time.
+    {
+      ThreadPool::Batch B(ThreadPool::global());
+      for (unsigned i = 0, e = kinds.size(); i != e; ++i) {
+        B.async(new SolveTask(getOrCreateConstraintSet(kinds[i]), false,
+                              remapFor(kinds[i]), Solutions[i]));
+      }
+      B.wait();
+    }
 
-  const unsigned T = 16;
-  // Now kick off up to 'T' jobs, each with a vector of merges to do
-  MergeInfo MI[T];
+    PartialSolution *Shared = new PartialSolution(*P);
+    if (DS) Shared->mergeIn(*DS);
+    IntrusiveRefCntPtr<LaneSolution> Lanes =
+      new LaneSolution(Shared, Solutions);
 
-  // Make sure all threads know the default solution:
-  for (unsigned i = 0; i < T; ++i) {
-    MI[i].Default = P;
-    MI[i].DefaultSinks = DS;
-    MI[i].useDefaultSinks = useDefaultSinks;
+    for (unsigned i = 0, e = kinds.size(); i != e; ++i) {
+      leastSolutions[kinds[i]] = Solutions[i];
+      Result.push_back(new LaneView(Lanes, i));
+    }
+    return Result;
   }
 
-  // And round-robin hand out merge jobs:
-  unsigned TID = 0;
-  while (!ToMerge.empty()) {
-    MergeInfo* M = &MI[TID];
-    TID = (TID + 1) % T;
+  // One job per kind; the pool balances the uneven merge costs.
+  std::vector<PartialSolution*> Merged(kinds.size());
+  {
+    ThreadPool::Batch B(ThreadPool::global());
+    for (unsigned i = 0, e = kinds.size(); i != e; ++i) {
+      B.async(new MergeTask(getOrCreateConstraintSet(kinds[i]),
+                            remapFor(kinds[i]), P, DS,
+                            Solutions[i], Merged[i]));
+    }
+    B.wait();
+  }
 
-    M->Mergees.push_back(ToMerge.back());
-    ToMerge.pop_back();
+  for (unsigned i = 0, e = kinds.size(); i != e; ++i) {
+    leastSolutions[kinds[i]] = Solutions[i];
+    // Nothing gets merged into these again
+    Merged[i]->freeze();
+    Result.push_back(Merged[i]);
   }
 
-  // Finally, kick off all the threads
-  // with non-empty work queues
-  std::vector<pthread_t> Threads;
-  for (unsigned i = 0; i < T; ++i) {
-    MergeInfo *M = &MI[i];
-    if (!M->Mergees.empty()) {
-      pthread_t Thread;
-      if (::pthread_create(&Thread, NULL, merge, M)) {
-        assert(0 && "Failed to create thread!");
-      }
-      Threads.push_back(Thread);
-    }
+  return Result;
+}
+
+std::vector<ConsSoln*>
+LHConstraintKit::solveLabels(const LabelSeeds &seeds, unsigned numLabels,
+                             bool useDefaultSinks) {
+  PhaseTimer T("solveLabels");
+  assert(!compacted && "Kit was compacted");
+  assert(leastSolutions.count("default"));
+  assert((!useDefaultSinks || leastSolutions.count("default-sinks")) &&
+         "Default sinks not solved yet!");
+
+  std::vector<LaneSolution::Seed> Seeds;
+  for (LabelSeeds::const_iterator seed = seeds.begin(), end = seeds.end();
+       seed != end; ++seed) {
+    assert(seed->second < numLabels && "Label out of range!");
+    const LHConsVar *var = llvm::cast<LHConsVar>(seed->first);
+    Seeds.push_back(LaneSolution::Seed(var->index(), seed->second));
   }
 
-  // Wait for them all to finish
-  while (!Threads.empty()) {
-    ::pthread_join(Threads.back(), NULL);
-    Threads.pop_back();
+  // The labels all propagate over one copy of the default solution(s)
+  PartialSolution *Shared = new PartialSolution(*leastSolutions["default"]);
+  if (useDefaultSinks) Shared->mergeIn(*leastSolutions["default-sinks"]);
+  IntrusiveRefCntPtr<LaneSolution> Lanes =
+    new LaneSolution(Shared, Seeds, numLabels);
+
+  std::vector<ConsSoln*> Result;
+  for (unsigned i = 0; i != numLabels; ++i)
+    Result.push_back(new LaneView(Lanes, i));
+  return Result;
+}
+
+std::vector<InfoflowSolution*>
+Infoflow::solveLabels(bool useDefaultSinks) {
+  dumpConstraints();
+  std::vector<ConsSoln*> PS = kit->solveLabels(labelSeeds, numLabels, useDefaultSinks);
+
+  std::vector<InfoflowSolution*> Solns;
+  for (std::vector<ConsSoln*>::iterator I = PS.begin(), E = PS.end();
+       I != E; ++I) {
+    Solns.push_back(new InfoflowSolution(*this,
+                                         *I,
+                                         kit->highConstant(),
+                                         false, /* default to untainted */
+                                         summarySinkValueConstraintMap,
+                                         locConstraintMap,
+                                         summarySinkVargConstraintMap));
   }
 
-  return Merged;
+  return Solns;
 }
 
 std::vector<InfoflowSolution*>
 Infoflow::solveLeastMT(std::vector<std::string> kinds, bool useDefaultSinks) {
-  std::vector<PartialSolution*> PS = kit->solveLeastMT(kinds, useDefaultSinks);
+  dumpConstraints();
+  std::vector<ConsSoln*> PS = kit->solveLeastMT(kinds, useDefaultSinks);
 
   std::vector<InfoflowSolution*> Solns;
-  for (std::vector<PartialSolution*>::iterator I = PS.begin(), E = PS.end();
+  for (std::vector<ConsSoln*>::iterator I = PS.begin(), E = PS.end();
        I != E; ++I) {
     Solns.push_back(new InfoflowSolution(*this,
                                          *I,
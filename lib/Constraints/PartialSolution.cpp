@@ -12,59 +12,168 @@
 //===----------------------------------------------------------------------===//
 
 #include "Constraints/PartialSolution.h"
+#include "Constraints/Lattice.h"
+#include "Constraints/PhaseReport.h"
+#include "Constraints/ThreadPool.h"
 
+#include "llvm/Support/Atomic.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/CommandLine.h"
 
-#include <deque>
+#include <algorithm>
+#include <climits>
 
 using namespace deps;
 using namespace llvm;
 
+static cl::opt<bool> DepsDenseSolver(
+  "deps-dense-solver", cl::desc("Store partial solutions as bitvectors over dense variable indices"),
+  cl::init(false));
+
+static cl::opt<bool> DepsParallelPropagate(
+  "deps-parallel-propagate",
+  cl::desc("Expand large propagation frontiers on the solver threads (dense mode only)"),
+  cl::init(false));
+
+static cl::opt<unsigned> DepsFrontierGrain(
+  "deps-frontier-grain",
+  cl::desc("Number of frontier variables expanded per parallel propagation task"),
+  cl::init(4096));
+
 // Helper function
 static const LHConstant & boolToLHC(bool B) {
   return B ? LHConstant::high() : LHConstant::low();
 }
 
-bool PartialSolution::isChanged(const ConsVar *V) {
-  for (std::vector<PartialSolution*>::iterator CI = Chained.begin(),
-      CE = Chained.end(); CI != CE; ++CI) {
-    if ((*CI)->VSet.count(V)) return true;
+// Helper function, returns the index of a variable appearing in a
+// constraint, or -1 if the element is a constant.
+// Joins are expanded by LHConstraintKit before we ever see them.
+static int varIndex(const ConsElem &E) {
+  if (const LHConsVar *V = dyn_cast<LHConsVar>(&E))
+    return V->index();
+  assert(isa<LHConstant>(&E) && "Unexpected join in constraint!");
+  return -1;
+}
+
+PartialSolution::PartialSolution(Constraints & C, bool initial,
+                                 const SCCRemap *Remap)
+  : Graph(NULL), Remap(Remap), initial(initial), dense(DepsDenseSolver),
+    frozen(false) {
+  initialize(C);
+
+  std::vector<unsigned> WorkList;
+  appendChanged(WorkList);
+  propagate(WorkList);
+}
+
+SharedGraph::SharedGraph(const std::vector<LHConstraint> &C) {
+  CSRGraph::EdgeList EdgeList;
+  unsigned NumNodes = 0;
+  for (std::vector<LHConstraint>::const_iterator I = C.begin(), E = C.end();
+       I != E; ++I) {
+    int L = varIndex(I->lhs());
+    int R = varIndex(I->rhs());
+    if (L >= 0 && R >= 0) {
+      EdgeList.push_back(std::make_pair(L, R));
+      NumNodes = std::max(NumNodes, (unsigned)std::max(L, R) + 1);
+    } else if (R >= 0) {
+      // A <= B, 'A' is high: 'B' is high
+      if (!LHKernel::isBottom(I->lhs())) LeastSeeds.push_back(R);
+    } else if (L >= 0) {
+      // A <= B, 'B' is low: 'A' is low
+      if (LHKernel::isBottom(I->rhs())) GreatestSeeds.push_back(L);
+    }
   }
-  return false;
+  Forward.build(NumNodes, EdgeList);
+  Backward.build(NumNodes, EdgeList, true);
 }
 
-const LHConstant& PartialSolution::subst(const ConsElem& E) {
-  // If this is a variable, look it up in VSet:
-  if (const LHConsVar* V = dyn_cast<LHConsVar>(&E))
-    return boolToLHC(initial != isChanged(V));
+SharedGraph::SharedGraph(ConstraintStream &S) {
+  Forward.build(S.NumNodes, S.Edges);
+  Backward.build(S.NumNodes, S.Edges, true);
+  CSRGraph::EdgeList().swap(S.Edges);
+  S.NumNodes = 0;
+  LeastSeeds.swap(S.LeastSeeds);
+  GreatestSeeds.swap(S.GreatestSeeds);
+}
+
+PartialSolution::PartialSolution(const SharedGraph *G,
+                                 bool initial, const SCCRemap *Remap)
+  : Graph(G), Remap(Remap), initial(initial), dense(DepsDenseSolver),
+    frozen(false) {
+  Chained.push_back(this);
+
+  std::vector<unsigned> WorkList;
+  const std::vector<unsigned> &Seeds =
+    initial ? G->GreatestSeeds : G->LeastSeeds;
+  for (std::vector<unsigned>::const_iterator I = Seeds.begin(),
+       E = Seeds.end(); I != E; ++I)
+    mark(*I, WorkList);
+  propagate(WorkList);
+}
+
+void PartialSolution::appendChanged(std::vector<unsigned> &List) const {
+  if (!dense) {
+    List.insert(List.end(), VSet.begin(), VSet.end());
+    return;
+  }
+  for (int I = Bits.find_first(); I != -1; I = Bits.find_next(I))
+    List.push_back(I);
+}
 
-  // If this is already a constant, return it
-  if (const LHConstant *LHC = dyn_cast<LHConstant>(&E))
-    return *LHC;
+void PartialSolution::appendSources(std::vector<unsigned> &List) const {
+  if (const CSRGraph *G = graph()) {
+    for (unsigned V = 0, E = G->numNodes(); V != E; ++V)
+      if (G->succ_begin(V) != G->succ_end(V)) List.push_back(V);
+  }
+  for (PMap::const_iterator I = P.begin(), E = P.end(); I != E; ++I)
+    List.push_back(I->first);
+  // Marking any member of a collapsed component marks all of them
+  if (Remap) {
+    for (unsigned V = 0, E = Remap->numVars(); V != E; ++V) {
+      if (Remap->rep(V) == V) continue;
+      List.push_back(V);
+      List.push_back(Remap->rep(V));
+    }
+  }
+}
 
-  // Otherwise, this better be a join (asserting cast)
-  const LHJoin *J = cast<LHJoin>(&E);
-  // Find all elements of the join, and evaluate it recursively
-  const std::set<const ConsElem *> & elements = J->elements();
+void PartialSolution::unionIn(const PartialSolution &P) {
+  if (dense && P.dense && Bits.size() == P.Bits.size()) {
+    Bits |= P.Bits;
+    return;
+  }
+  std::vector<unsigned> Changed;
+  P.appendChanged(Changed);
+  for (std::vector<unsigned>::iterator I = Changed.begin(), E = Changed.end();
+       I != E; ++I)
+    insert(*I);
+}
 
+// The level of each variable, for LHKernel::eval
+struct PartialSolution::Level {
+  explicit Level(const PartialSolution &PS) : PS(PS) {}
+  bool operator()(unsigned V) const { return PS.initial != PS.isChanged(V); }
+  const PartialSolution &PS;
+};
+
+const LHConstant& PartialSolution::subst(const ConsElem& E) {
+  // Variables are looked up in VSet, and joins are evaluated starting
+  // from low.
+  //
   // XXX: LHConsSoln starts with substVal as the defaultValue,
   // which ...seems wrong?  Seems like this would make all join's
   // evaluate to 'high' unconditionally when solving for greatest.
   // Curiously, however, I'm not seeing any differences in the solutions
   // produced across various CINT2006 benchmarks.  Oh well.
-  const LHConstant *substVal = &LHConstant::low();
-
-  for (std::set<const ConsElem *>::iterator elem = elements.begin(),
-       end = elements.end(); elem != end; ++elem) {
-    substVal = &(substVal->join(subst(**elem)));
-  }
-
-  return *substVal;
+  return boolToLHC(LHKernel::eval(E, Level(*this)));
 }
 
 // Copy constructor
-PartialSolution::PartialSolution(PartialSolution &P) {
-  initial = P.initial;
+PartialSolution::PartialSolution(PartialSolution &P)
+  : Graph(NULL), VSet(P.VSet), Bits(P.Bits), Remap(NULL), initial(P.initial),
+    dense(P.dense), frozen(false) {
+  assert(!P.frozen && "Cannot chain to a frozen solution!");
 
   // Chain to it
   Chained.push_back(this);
@@ -80,6 +189,30 @@ PartialSolution::PartialSolution(PartialSolution &P) {
 void PartialSolution::mergeIn(PartialSolution &P) {
   // Sanity check
   assert(initial == P.initial);
+  assert(!frozen && !P.frozen && "Cannot merge frozen solutions!");
+
+  // Our VSet is closed under our maps, and P's under P's. What is left to
+  // propagate is P's variables through our maps, and ours through the
+  // maps we newly chain to.
+  std::vector<unsigned> workList;
+  std::vector<unsigned> Changed;
+  P.appendChanged(Changed);
+  for (std::vector<unsigned>::iterator I = Changed.begin(), E = Changed.end();
+       I != E; ++I)
+    if (!isChanged(*I)) workList.push_back(*I);
+
+  for (std::vector<PartialSolution*>::iterator CI = P.Chained.begin(),
+       CE = P.Chained.end(); CI != CE; ++CI) {
+    if (std::binary_search(Chained.begin(), Chained.end(), *CI)) continue;
+    std::vector<unsigned> Sources;
+    (*CI)->appendSources(Sources);
+    for (std::vector<unsigned>::iterator I = Sources.begin(), E = Sources.end();
+         I != E; ++I)
+      if (isChanged(*I)) workList.push_back(*I);
+  }
+
+  // Pick up everything P already knows to be changed
+  unionIn(P);
 
   // Chain to it
   Chained.insert(Chained.end(), P.Chained.begin(), P.Chained.end());
@@ -90,7 +223,23 @@ void PartialSolution::mergeIn(PartialSolution &P) {
   assert(std::find(Chained.begin(), Chained.end(), &P) != Chained.end());
 
   // And propagate
-  propagate();
+  propagate(workList);
+}
+
+void PartialSolution::addConstraints(const Constraints &C) {
+  assert(!frozen && Chained.size() == 1 && Chained[0] == this &&
+         "Can only add constraints to an unmerged solution!");
+
+  std::vector<unsigned> workList;
+  for (Constraints::const_iterator I = C.begin(), E = C.end(); I != E; ++I)
+    addConstraint(*I, NULL, workList);
+  propagate(workList);
+}
+
+void PartialSolution::freeze() {
+  Chained.clear();
+  Chained.push_back(this);
+  frozen = true;
 }
 
 // Only run for normal constructor.
@@ -100,83 +249,223 @@ void PartialSolution::initialize(Constraints & C) {
   // Add ourselves to the chained list
   Chained.push_back(this);
 
-  // Build propagation map
-  std::set<const ConsVar *> vars;
-  std::set<const ConsVar *> targets;
-  // Build propagation map
-  for (Constraints::iterator I = C.begin(), E = C.end(); I != E; ++I) {
-    vars.clear();
-    targets.clear();
-    const ConsElem &From = initial ? I->rhs() : I->lhs();
-    const ConsElem &To = initial ? I->lhs() : I->rhs();
+  // Propagation edges, gathered up front in dense mode
+  CSRGraph::EdgeList EdgeList;
+  // Seeds; our VSet holds them all by the end
+  std::vector<unsigned> Seeds;
 
-    From.variables(vars);
-    To.variables(targets);
+  // Build propagation map
+  for (Constraints::iterator I = C.begin(), E = C.end(); I != E; ++I)
+    addConstraint(*I, dense ? &EdgeList : NULL, Seeds);
+
+  if (dense) {
+    unsigned NumNodes = 0;
+    for (CSRGraph::EdgeList::iterator I = EdgeList.begin(), E = EdgeList.end();
+         I != E; ++I)
+      NumNodes = std::max(NumNodes, std::max(I->first, I->second) + 1);
+    Edges.build(NumNodes, EdgeList);
+  }
+}
 
-    if (targets.empty()) continue;
+// Record the constraint in the propagation map, or in EdgeList if given.
+// Variables the constraint changes are marked and added to WorkList.
+void PartialSolution::addConstraint(const LHConstraint &C,
+                                    CSRGraph::EdgeList *EdgeList,
+                                    std::vector<unsigned> &WorkList) {
+  const ConsElem &From = initial ? C.rhs() : C.lhs();
+  const ConsElem &To = initial ? C.lhs() : C.rhs();
+
+  int Target = varIndex(To);
+  if (Target < 0) return;
+
+  int Source = varIndex(From);
+  if (Source >= 0) {
+    // Update PMap for this var
+    if (EdgeList) EdgeList->push_back(std::make_pair(Source, Target));
+    else P[Source].push_back(Target);
+    // Only matters when adding to an existing solution
+    if (isChanged(Source)) mark(Target, WorkList);
+    return;
+  }
 
-    for (std::set<const ConsVar *>::iterator var = vars.begin(),
-         end = vars.end(); var != end; ++var) {
-      // Update PMap for this var
-      P[*var].insert(P[*var].end(), targets.begin(), targets.end());
+  // Initialize varset:
+  if (initial) {
+    if (LHKernel::isBottom(From)) {
+      // A <= B, 'B' is low
+      // Mark all in 'A' as low also
+      mark(Target, WorkList);
     }
-
-    // Initialize varset:
-    if (initial) {
-      if (subst(From).leq(LHConstant::low())) {
-        // A <= B, 'B' is low
-        // Mark all in 'A' as low also
-        VSet.insert(targets.begin(), targets.end());
-      }
-    } else {
-      if (!subst(From).leq(LHConstant::low())) {
-        // A <= B, 'A' is high
-        // Mark all in 'B' as high also
-        VSet.insert(targets.begin(), targets.end());
-      }
+  } else {
+    if (!LHKernel::isBottom(From)) {
+      // A <= B, 'A' is high
+      // Mark all in 'B' as high also
+      mark(Target, WorkList);
     }
   }
-
 }
 
-void PartialSolution::propagate() {
-  std::deque<const ConsVar *> workList;
+// Marks the variables forEachSucc() visits as changed
+struct PartialSolution::Marker {
+  Marker(PartialSolution &PS, std::vector<unsigned> &WorkList)
+    : PS(PS), WorkList(WorkList) {}
+  void operator()(unsigned V) { PS.mark(V, WorkList); }
+  PartialSolution &PS;
+  std::vector<unsigned> &WorkList;
+};
 
+void PartialSolution::propagate(std::vector<unsigned> &workList) {
   assert(!Chained.empty());
   assert(std::find(Chained.begin(), Chained.end(), this) != Chained.end());
 
-  // Enqueue all known changed variables
-  for (std::vector<PartialSolution*>::iterator CI = Chained.begin(),
-      CE = Chained.end(); CI != CE; ++CI) {
-    workList.insert(workList.end(),
-                    (*CI)->VSet.begin(), (*CI)->VSet.end());
+  if (DepsParallelPropagate && canPropagateParallel()) {
+    propagateParallel(workList);
+    return;
   }
 
   // Compute transitive closure of the non-default variables,
-  // using all propagation maps in PMaps.
+  // using all propagation maps in PMaps. Only our own VSet is updated.
+  Marker Mark(*this, workList);
+  uint64_t steps = 0;
   while (!workList.empty()) {
     // Dequeue variable
-    const ConsVar * V = workList.front();
-    workList.pop_front();
+    unsigned V = workList.back();
+    workList.pop_back();
+    ++steps;
 
     for (std::vector<PartialSolution*>::iterator CI = Chained.begin(),
-         CE = Chained.end(); CI != CE; ++CI) {
-      PartialSolution &PS = **CI;
-
-      PMap::iterator I = PS.P.find(V);
-      if (I == PS.P.end()) continue; // Not in map
-
-      std::vector<const ConsVar*> &Updates = I->second;
-      // For each such variable...
-      for (std::vector<const ConsVar*>::iterator I = Updates.begin(),
-           E = Updates.end(); I != E; ++I) {
-        // If we haven't changed it already, add it to the worklist:
-        if (!isChanged(*I)) {
-          VSet.insert(*I);
-          workList.push_back(*I);
-        }
-      }
-    }
+         CE = Chained.end(); CI != CE; ++CI)
+      (*CI)->forEachSucc(V, Mark);
   }
+  if (steps && PhaseReport::enabled())
+    PhaseReport::get().addCount("propagation steps", steps);
 }
 
+bool PartialSolution::canPropagateParallel() const {
+  if (!dense) return false;
+  for (std::vector<PartialSolution*>::const_iterator CI = Chained.begin(),
+       CE = Chained.end(); CI != CE; ++CI)
+    if (!(*CI)->P.empty()) return false;
+  return true;
+}
+
+namespace {
+
+// Bits that are set with an atomic compare and swap, so that threads
+// racing to mark the same variable agree on which of them did.
+class AtomicBits {
+public:
+  typedef sys::cas_flag Word;
+  static const unsigned WordBits = sizeof(Word) * CHAR_BIT;
+
+  explicit AtomicBits(unsigned Size) : Words((Size + WordBits - 1) / WordBits) {}
+
+  unsigned size() const { return Words.size() * WordBits; }
+
+  // Set bit V, returning true if it wasn't set before
+  bool testAndSet(unsigned V) {
+    volatile Word *W = &Words[V / WordBits];
+    Word Mask = Word(1) << (V % WordBits);
+    Word Old = *W;
+    while (!(Old & Mask)) {
+      Word Seen = sys::CompareAndSwap(W, Old | Mask, Old);
+      if (Seen == Old) return true;
+      Old = Seen;
+    }
+    return false;
+  }
+
+private:
+  std::vector<Word> Words;
+};
+
+} // end anonymous namespace
+
+// Expands a slice of the frontier: every variable the maps of the chain
+// change along with one in the slice, and that no other task marked
+// first, ends up in Next.
+struct PartialSolution::FrontierTask : public PoolTask {
+  FrontierTask(const PartialSolution &PS, AtomicBits &Bits,
+               const unsigned *Begin, const unsigned *End,
+               std::vector<unsigned> &Next)
+    : PS(PS), Bits(Bits), Begin(Begin), End(End), Next(Next) {}
+
+  virtual void run() {
+    for (const unsigned *V = Begin; V != End; ++V)
+      for (std::vector<PartialSolution*>::const_iterator CI = PS.Chained.begin(),
+           CE = PS.Chained.end(); CI != CE; ++CI)
+        (*CI)->forEachSucc(*V, *this);
+  }
+
+  void operator()(unsigned V) {
+    if (Bits.testAndSet(V)) Next.push_back(V);
+  }
+
+  const PartialSolution &PS;
+  AtomicBits &Bits;
+  const unsigned *Begin;
+  const unsigned *End;
+  std::vector<unsigned> &Next;
+};
+
+// Level-synchronous propagation. The fixpoint doesn't depend on the order
+// variables are visited in, so each frontier is split among the pool and
+// the next frontier is the variables marked while expanding it. Marking
+// goes through a copy of Bits that is updated atomically, and the newly
+// marked variables are copied back as each level finishes.
+void PartialSolution::propagateParallel(std::vector<unsigned> &workList) {
+  // Nothing the chain propagates to lies outside of its graphs and remaps
+  unsigned Size = Bits.size();
+  for (std::vector<PartialSolution*>::iterator CI = Chained.begin(),
+       CE = Chained.end(); CI != CE; ++CI) {
+    if (const CSRGraph *G = (*CI)->graph())
+      Size = std::max(Size, G->numNodes());
+    if ((*CI)->Remap)
+      Size = std::max(Size, (*CI)->Remap->numVars());
+  }
+  AtomicBits Marked(Size);
+  for (int I = Bits.find_first(); I != -1; I = Bits.find_next(I))
+    Marked.testAndSet(I);
+
+  // Variables on the work list may be unmarked, or outside of every graph
+  std::vector<unsigned> Frontier;
+  for (std::vector<unsigned>::iterator I = workList.begin(), E = workList.end();
+       I != E; ++I)
+    if (*I < Size) Frontier.push_back(*I);
+  workList.clear();
+
+  unsigned Grain = std::max(1u, (unsigned)DepsFrontierGrain);
+  uint64_t steps = 0;
+  unsigned levels = 0;
+  std::vector<std::vector<unsigned> > Next;
+  while (!Frontier.empty()) {
+    steps += Frontier.size();
+    ++levels;
+    unsigned Tasks = (Frontier.size() + Grain - 1) / Grain;
+    Next.resize(Tasks);
+    const unsigned *Begin = &Frontier[0];
+    const unsigned *End = Begin + Frontier.size();
+    if (Tasks == 1) {
+      FrontierTask(*this, Marked, Begin, End, Next[0]).run();
+    } else {
+      ThreadPool::Batch B(ThreadPool::global());
+      for (unsigned i = 0; i != Tasks; ++i)
+        B.async(new FrontierTask(*this, Marked, Begin + i * Grain,
+                                 std::min(Begin + (i + 1) * Grain, End),
+                                 Next[i]));
+      B.wait();
+    }
+
+    Frontier.clear();
+    for (unsigned i = 0; i != Tasks; ++i) {
+      for (std::vector<unsigned>::iterator I = Next[i].begin(),
+           E = Next[i].end(); I != E; ++I)
+        insert(*I);
+      Frontier.insert(Frontier.end(), Next[i].begin(), Next[i].end());
+      Next[i].clear();
+    }
+  }
+  if (steps && PhaseReport::enabled()) {
+    PhaseReport::get().addCount("propagation steps", steps);
+    PhaseReport::get().addCount("parallel propagation levels", levels);
+  }
+}
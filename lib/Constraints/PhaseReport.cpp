@@ -0,0 +1,169 @@
+//===-- PhaseReport.cpp -----------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Collecting and printing phase timings and counters.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Constraints/PhaseReport.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+
+#include <sys/resource.h>
+
+using namespace deps;
+using namespace llvm;
+
+static cl::opt<bool> DepsTimeReport(
+  "deps-time-report", cl::desc("Print the time, counters and peak memory of each analysis phase at exit"),
+  cl::init(false));
+static cl::opt<std::string> DepsTimeReportJSON(
+  "deps-time-report-json", cl::desc("Write the -deps-time-report as JSON to the given file"),
+  cl::init(""));
+
+static ManagedStatic<PhaseReport> GlobalReport;
+
+bool PhaseReport::enabled() {
+  return DepsTimeReport || !DepsTimeReportJSON.empty();
+}
+
+PhaseReport &PhaseReport::get() {
+  return *GlobalReport;
+}
+
+PhaseReport::PhaseReport() {
+  ::pthread_mutex_init(&Lock, NULL);
+}
+
+PhaseReport::~PhaseReport() {
+  if (enabled() && (!Phases.empty() || !Counters.empty())) {
+    if (DepsTimeReportJSON.empty()) {
+      print(errs());
+    } else {
+      std::string Error;
+      raw_fd_ostream OS(DepsTimeReportJSON.c_str(), Error);
+      if (Error.empty())
+        printJSON(OS);
+      else
+        errs() << "Cannot write time report: " << Error << "\n";
+    }
+  }
+  ::pthread_mutex_destroy(&Lock);
+}
+
+uint64_t PhaseReport::peakMemory() {
+  struct rusage Usage;
+  if (::getrusage(RUSAGE_SELF, &Usage)) return 0;
+#ifdef __APPLE__
+  return Usage.ru_maxrss / 1024;
+#else
+  return Usage.ru_maxrss;
+#endif
+}
+
+void PhaseReport::addTime(StringRef Name, double Seconds) {
+  uint64_t Peak = peakMemory();
+  ::pthread_mutex_lock(&Lock);
+  std::vector<Phase>::iterator P = Phases.begin(), E = Phases.end();
+  while (P != E && P->Name != Name) ++P;
+  if (P == E) {
+    Phase New;
+    New.Name = Name.str();
+    New.Seconds = 0;
+    New.Runs = 0;
+    New.PeakMemory = 0;
+    P = Phases.insert(E, New);
+  }
+  P->Seconds += Seconds;
+  ++P->Runs;
+  P->PeakMemory = std::max(P->PeakMemory, Peak);
+  ::pthread_mutex_unlock(&Lock);
+}
+
+void PhaseReport::addCount(StringRef Counter, uint64_t N) {
+  ::pthread_mutex_lock(&Lock);
+  Counters[Counter.str()] += N;
+  ::pthread_mutex_unlock(&Lock);
+}
+
+void PhaseReport::maxCount(StringRef Counter, uint64_t N) {
+  ::pthread_mutex_lock(&Lock);
+  uint64_t &Value = Counters[Counter.str()];
+  Value = std::max(Value, N);
+  ::pthread_mutex_unlock(&Lock);
+}
+
+void PhaseReport::print(raw_ostream &OS) const {
+  ::pthread_mutex_lock(&Lock);
+  OS << "===" << std::string(73, '-') << "===\n"
+     << "                      Information flow phase report\n"
+     << "===" << std::string(73, '-') << "===\n";
+  OS << "   Wall time      Runs   Peak memory  Phase\n";
+  for (std::vector<Phase>::const_iterator P = Phases.begin(),
+       E = Phases.end(); P != E; ++P)
+    OS << format("  %9.4fs  %8u  %10lluKB  %s\n", P->Seconds, P->Runs,
+                 (unsigned long long)P->PeakMemory, P->Name.c_str());
+  OS << "\n";
+  for (std::map<std::string, uint64_t>::const_iterator C = Counters.begin(),
+       E = Counters.end(); C != E; ++C)
+    OS << format("  %12llu  %s\n", (unsigned long long)C->second,
+                 C->first.c_str());
+  OS << format("\n  Peak memory: %lluKB\n\n",
+               (unsigned long long)peakMemory());
+  ::pthread_mutex_unlock(&Lock);
+}
+
+static void printJSONString(raw_ostream &OS, StringRef S) {
+  OS << '"';
+  for (StringRef::iterator I = S.begin(), E = S.end(); I != E; ++I) {
+    unsigned char C = *I;
+    if (C == '"' || C == '\\') OS << '\\' << C;
+    else if (C < 0x20) OS << format("\\u%04x", C);
+    else OS << C;
+  }
+  OS << '"';
+}
+
+void PhaseReport::printJSON(raw_ostream &OS) const {
+  ::pthread_mutex_lock(&Lock);
+  OS << "{\n  \"phases\": [";
+  for (std::vector<Phase>::const_iterator P = Phases.begin(),
+       E = Phases.end(); P != E; ++P) {
+    OS << (P == Phases.begin() ? "\n" : ",\n") << "    { \"name\": ";
+    printJSONString(OS, P->Name);
+    OS << format(", \"seconds\": %.6f, \"runs\": %u, \"peak_kb\": %llu }",
+                 P->Seconds, P->Runs, (unsigned long long)P->PeakMemory);
+  }
+  OS << "\n  ],\n  \"counters\": {";
+  for (std::map<std::string, uint64_t>::const_iterator C = Counters.begin(),
+       E = Counters.end(); C != E; ++C) {
+    OS << (C == Counters.begin() ? "\n" : ",\n") << "    ";
+    printJSONString(OS, C->first);
+    OS << ": " << C->second;
+  }
+  OS << "\n  },\n  \"peak_kb\": " << peakMemory() << "\n}\n";
+  ::pthread_mutex_unlock(&Lock);
+}
+
+PhaseTimer::PhaseTimer(StringRef Phase)
+  : Phase(Phase), Start(0), Enabled(PhaseReport::enabled()) {
+  if (Enabled) Start = TimeRecord::getCurrentTime(true).getWallTime();
+}
+
+PhaseTimer::~PhaseTimer() {
+  if (Enabled)
+    PhaseReport::get().addTime(
+      Phase, TimeRecord::getCurrentTime(false).getWallTime() - Start);
+}
@@ -0,0 +1,168 @@
+//===-- SCCRemap.cpp --------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Cycle collapsing for L-H constraint sets, using an iterative version of
+// Pearce's space-efficient variant of Tarjan's SCC algorithm.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Constraints/SCCRemap.h"
+#include "Constraints/LHConstraints.h"
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/Casting.h"
+
+#include <algorithm>
+
+using namespace deps;
+using namespace llvm;
+
+namespace {
+
+/// Finds the strongly connected components of a CSRGraph. Following
+/// Pearce ("A Space-Efficient Algorithm for Finding Strongly Connected
+/// Components", IPL 2016), a single rindex array serves as the visitation
+/// order, the lowlink, and finally the component number of each node.
+/// Component numbers count down from numNodes() - 1. The recursion is
+/// kept on an explicit stack, since the graphs can be very deep.
+class SCCFinder {
+public:
+  explicit SCCFinder(const CSRGraph &G)
+    : G(G), RIndex(G.numNodes(), 0), Index(1), Component(G.numNodes() - 1) {}
+
+  /// Compute components; returns the component number of each node.
+  const std::vector<unsigned> &run() {
+    for (unsigned V = 0, E = G.numNodes(); V != E; ++V)
+      if (RIndex[V] == 0) visit(V);
+    return RIndex;
+  }
+
+private:
+  struct Frame {
+    unsigned V;
+    CSRGraph::iterator Next;
+    bool Root;
+  };
+
+  void begin(unsigned V) {
+    RIndex[V] = Index++;
+    Frame F = { V, G.succ_begin(V), true };
+    Frames.push_back(F);
+  }
+
+  void finish(const Frame &F) {
+    if (!F.Root) {
+      Stack.push_back(F.V);
+      return;
+    }
+    --Index;
+    while (!Stack.empty() && RIndex[F.V] <= RIndex[Stack.back()]) {
+      RIndex[Stack.back()] = Component;
+      Stack.pop_back();
+      --Index;
+    }
+    RIndex[F.V] = Component--;
+  }
+
+  void visit(unsigned V) {
+    begin(V);
+    while (!Frames.empty()) {
+      unsigned Top = Frames.size() - 1;
+      if (Frames[Top].Next == G.succ_end(Frames[Top].V)) {
+        finish(Frames[Top]);
+        Frames.pop_back();
+        continue;
+      }
+
+      unsigned W = *Frames[Top].Next;
+      if (RIndex[W] == 0) {
+        // Recurse; we come back to this edge once W is finished.
+        begin(W);
+        continue;
+      }
+
+      if (RIndex[W] < RIndex[Frames[Top].V]) {
+        RIndex[Frames[Top].V] = RIndex[W];
+        Frames[Top].Root = false;
+      }
+      ++Frames[Top].Next;
+    }
+  }
+
+  const CSRGraph &G;
+  std::vector<unsigned> RIndex;
+  std::vector<unsigned> Stack;
+  std::vector<Frame> Frames;
+  unsigned Index;
+  unsigned Component;
+};
+
+} // end anonymous namespace
+
+SCCRemap *SCCRemap::collapse(std::vector<LHConstraint> &C,
+                             const std::vector<const LHConsVar *> &Vars) {
+  // Build the var-to-var constraint graph
+  CSRGraph::EdgeList Edges;
+  unsigned NumNodes = 0;
+  for (std::vector<LHConstraint>::iterator I = C.begin(), E = C.end();
+       I != E; ++I) {
+    const LHConsVar *L = dyn_cast<LHConsVar>(&I->lhs());
+    const LHConsVar *R = dyn_cast<LHConsVar>(&I->rhs());
+    if (!L || !R) continue;
+    Edges.push_back(std::make_pair(L->index(), R->index()));
+    NumNodes = std::max(NumNodes, std::max(L->index(), R->index()) + 1);
+  }
+  if (Edges.empty()) return NULL;
+
+  CSRGraph G;
+  G.build(NumNodes, Edges);
+  CSRGraph::EdgeList().swap(Edges);
+
+  // The first (lowest numbered) variable of each component represents it
+  std::vector<unsigned> Components = SCCFinder(G).run();
+  G.clear();
+  std::vector<unsigned> Leader(NumNodes, ~0U);
+  std::vector<unsigned> Rep(NumNodes);
+  CSRGraph::EdgeList MemberEdges;
+  for (unsigned V = 0; V != NumNodes; ++V) {
+    unsigned &L = Leader[Components[V]];
+    if (L == ~0U) L = V;
+    Rep[V] = L;
+    if (L != V) MemberEdges.push_back(std::make_pair(L, V));
+  }
+  if (MemberEdges.empty()) return NULL;
+
+  SCCRemap *Remap = new SCCRemap();
+  Remap->Rep.swap(Rep);
+  Remap->Members.build(NumNodes, MemberEdges);
+
+  // Rewrite the constraints onto representatives, dropping those that
+  // became self loops or duplicates.
+  DenseSet<std::pair<unsigned, unsigned> > Seen;
+  std::vector<LHConstraint>::iterator Out = C.begin();
+  for (std::vector<LHConstraint>::iterator I = C.begin(), E = C.end();
+       I != E; ++I) {
+    const ConsElem *L = &I->lhs();
+    const ConsElem *R = &I->rhs();
+    const LHConsVar *LV = dyn_cast<LHConsVar>(L);
+    const LHConsVar *RV = dyn_cast<LHConsVar>(R);
+    if (LV) L = LV = Vars[Remap->rep(LV->index())];
+    if (RV) R = RV = Vars[Remap->rep(RV->index())];
+    if (LV && RV) {
+      if (LV == RV) continue;
+      if (!Seen.insert(std::make_pair(LV->index(), RV->index())).second)
+        continue;
+    }
+    *Out++ = LHConstraint(L, R);
+  }
+  C.erase(Out, C.end());
+  std::vector<LHConstraint>(C).swap(C);
+
+  return Remap;
+}
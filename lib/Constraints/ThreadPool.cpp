@@ -0,0 +1,203 @@
+//===-- ThreadPool.cpp ------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Work-stealing thread pool built directly on pthreads.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Constraints/ThreadPool.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ManagedStatic.h"
+
+#include <cassert>
+#include <unistd.h>
+
+using namespace deps;
+using namespace llvm;
+
+static cl::opt<unsigned> DepsThreads(
+  "deps-threads", cl::desc("Number of worker threads used by the solvers (0 = one per processor)"),
+  cl::init(0));
+
+static ManagedStatic<ThreadPool> GlobalPool;
+
+unsigned ThreadPool::defaultThreadCount() {
+  if (DepsThreads) return DepsThreads;
+  long N = ::sysconf(_SC_NPROCESSORS_ONLN);
+  return N > 0 ? N : 1;
+}
+
+ThreadPool &ThreadPool::global() {
+  return *GlobalPool;
+}
+
+ThreadPool::ThreadPool(unsigned NumThreads)
+  : Queued(0), NextWorker(0), ShuttingDown(false) {
+  if (NumThreads == 0) NumThreads = defaultThreadCount();
+
+  ::pthread_mutex_init(&Lock, NULL);
+  ::pthread_cond_init(&WorkAvailable, NULL);
+  ::pthread_cond_init(&JobDone, NULL);
+
+  // Create all the deques before any thread may try to steal from them
+  for (unsigned i = 0; i < NumThreads; ++i) {
+    Worker *W = new Worker();
+    W->Pool = this;
+    ::pthread_mutex_init(&W->Lock, NULL);
+    Workers.push_back(W);
+  }
+  for (unsigned i = 0; i < NumThreads; ++i) {
+    if (::pthread_create(&Workers[i]->Thread, NULL, workerMain, Workers[i])) {
+      assert(0 && "Failed to create thread!");
+    }
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  ::pthread_mutex_lock(&Lock);
+  ShuttingDown = true;
+  ::pthread_cond_broadcast(&WorkAvailable);
+  ::pthread_mutex_unlock(&Lock);
+
+  for (std::vector<Worker*>::iterator I = Workers.begin(), E = Workers.end();
+       I != E; ++I) {
+    ::pthread_join((*I)->Thread, NULL);
+    assert((*I)->Jobs.empty() && "Pool destroyed with queued work!");
+    ::pthread_mutex_destroy(&(*I)->Lock);
+    delete *I;
+  }
+
+  ::pthread_cond_destroy(&JobDone);
+  ::pthread_cond_destroy(&WorkAvailable);
+  ::pthread_mutex_destroy(&Lock);
+}
+
+void *ThreadPool::workerMain(void *Arg) {
+  Worker *Self = static_cast<Worker*>(Arg);
+  ThreadPool &Pool = *Self->Pool;
+
+  while (true) {
+    Job J;
+    if (Pool.takeJob(Self, J)) {
+      Pool.runJob(J);
+      continue;
+    }
+
+    // Nothing to run or steal, sleep until more work shows up
+    ::pthread_mutex_lock(&Pool.Lock);
+    while (Pool.Queued == 0 && !Pool.ShuttingDown)
+      ::pthread_cond_wait(&Pool.WorkAvailable, &Pool.Lock);
+    bool Exit = Pool.ShuttingDown && Pool.Queued == 0;
+    ::pthread_mutex_unlock(&Pool.Lock);
+    if (Exit) return NULL;
+  }
+}
+
+ThreadPool::Worker *ThreadPool::currentWorker() const {
+  pthread_t Self = ::pthread_self();
+  for (std::vector<Worker*>::const_iterator I = Workers.begin(),
+       E = Workers.end(); I != E; ++I) {
+    if (::pthread_equal((*I)->Thread, Self)) return *I;
+  }
+  return NULL;
+}
+
+void ThreadPool::enqueue(const Job &J) {
+  Worker *W = currentWorker();
+
+  // Count the job against its batch before anyone can run it...
+  ::pthread_mutex_lock(&Lock);
+  ++J.Owner->Pending;
+  if (!W) W = Workers[NextWorker++ % Workers.size()];
+  ::pthread_mutex_unlock(&Lock);
+
+  // ...but only wake a worker once the job is there to be taken. Queued is
+  // bumped before the deque is unlocked, so no taker can decrement first.
+  ::pthread_mutex_lock(&W->Lock);
+  W->Jobs.push_back(J);
+  ::pthread_mutex_lock(&Lock);
+  ++Queued;
+  ::pthread_cond_signal(&WorkAvailable);
+  ::pthread_mutex_unlock(&Lock);
+  ::pthread_mutex_unlock(&W->Lock);
+}
+
+bool ThreadPool::takeJob(Worker *Self, Job &J) {
+  bool Found = false;
+
+  // Newest job of our own first...
+  if (Self) {
+    ::pthread_mutex_lock(&Self->Lock);
+    if (!Self->Jobs.empty()) {
+      J = Self->Jobs.back();
+      Self->Jobs.pop_back();
+      Found = true;
+    }
+    ::pthread_mutex_unlock(&Self->Lock);
+  }
+
+  // ...otherwise the oldest job of somebody else
+  for (unsigned i = 0, e = Workers.size(); !Found && i != e; ++i) {
+    Worker *Victim = Workers[i];
+    if (Victim == Self) continue;
+    ::pthread_mutex_lock(&Victim->Lock);
+    if (!Victim->Jobs.empty()) {
+      J = Victim->Jobs.front();
+      Victim->Jobs.pop_front();
+      Found = true;
+    }
+    ::pthread_mutex_unlock(&Victim->Lock);
+  }
+
+  if (Found) {
+    ::pthread_mutex_lock(&Lock);
+    --Queued;
+    ::pthread_mutex_unlock(&Lock);
+  }
+  return Found;
+}
+
+void ThreadPool::runJob(const Job &J) {
+  J.Task->run();
+  delete J.Task;
+
+  ::pthread_mutex_lock(&Lock);
+  --J.Owner->Pending;
+  ::pthread_cond_broadcast(&JobDone);
+  ::pthread_mutex_unlock(&Lock);
+}
+
+void ThreadPool::Batch::async(PoolTask *T) {
+  Job J = { T, this };
+  Pool.enqueue(J);
+}
+
+void ThreadPool::Batch::wait() {
+  Worker *Self = Pool.currentWorker();
+
+  while (true) {
+    ::pthread_mutex_lock(&Pool.Lock);
+    bool Done = Pending == 0;
+    ::pthread_mutex_unlock(&Pool.Lock);
+    if (Done) return;
+
+    // Help out rather than block while there is queued work
+    Job J;
+    if (Pool.takeJob(Self, J)) {
+      Pool.runJob(J);
+      continue;
+    }
+
+    ::pthread_mutex_lock(&Pool.Lock);
+    while (Pending != 0 && Pool.Queued == 0)
+      ::pthread_cond_wait(&Pool.JobDone, &Pool.Lock);
+    ::pthread_mutex_unlock(&Pool.Lock);
+  }
+}
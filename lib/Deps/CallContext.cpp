@@ -15,17 +15,20 @@
 #include "CallContext.h"
 
 #include "llvm/Function.h"
-#include "llvm/Support/CallSite.h"
+#include "llvm/Instruction.h"
 #include "llvm/Support/raw_ostream.h"
 
-using namespace llvm;
+namespace llvm {
 
-void CallerContext::dump() const {
-  for (unsigned i = 0; i < callers.size(); ++i)
-    errs() << callers[i]->getName() << " ";
+void dumpCallers(const Function *const *begin, const Function *const *end) {
+  for (; begin != end; ++begin)
+    errs() << (*begin)->getName() << " ";
+}
+
+void dumpCallSites(const Instruction *const *begin,
+                   const Instruction *const *end) {
+  for (; begin != end; ++begin)
+    errs() << (*begin)->getParent()->getParent()->getName() << " ";
 }
 
-void CallSiteContext::dump() const {
-  for (unsigned i = 0; i < sites.size(); ++i)
-    errs() << sites[i].getCaller()->getName() << " ";
 }
@@ -0,0 +1,60 @@
+//===- ControlDependence.cpp ------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Builds the control dependence graph of a function from its post-dominator
+// tree.
+//
+//===----------------------------------------------------------------------===//
+
+#include "ControlDependence.h"
+
+#include "llvm/Function.h"
+#include "llvm/Analysis/PostDominators.h"
+
+#include <algorithm>
+
+namespace deps {
+
+const ControlDependence::BlockList ControlDependence::None;
+
+ControlDependence::ControlDependence(const Function &F,
+                                     const PostDominatorTree &PDT) {
+  for (Function::const_iterator A = F.begin(), E = F.end(); A != E; ++A) {
+    const TerminatorInst *T = A->getTerminator();
+    // A lone successor post-dominates the block
+    if (!T || T->getNumSuccessors() < 2) continue;
+
+    DomTreeNode *Node = PDT.getNode(const_cast<BasicBlock *>(&*A));
+    DomTreeNode *Stop = Node ? Node->getIDom() : 0;
+    BlockList Blocks;
+    for (unsigned i = 0, e = T->getNumSuccessors(); i != e; ++i) {
+      const BasicBlock *S = T->getSuccessor(i);
+      // A loop back to A itself makes A dependent on its own terminator
+      if (S != &*A && PDT.dominates(S, &*A)) continue;
+
+      // Blocks the post-dominator tree doesn't know about (that never reach
+      // an exit) can only be dependent themselves.
+      DomTreeNode *N = PDT.getNode(const_cast<BasicBlock *>(S));
+      if (!N || !Node) {
+        Blocks.push_back(S);
+        continue;
+      }
+      // The virtual root of a function with several exits has no block
+      for (; N && N != Stop && N->getBlock(); N = N->getIDom())
+        Blocks.push_back(N->getBlock());
+    }
+
+    if (Blocks.empty()) continue;
+    std::sort(Blocks.begin(), Blocks.end());
+    Blocks.erase(std::unique(Blocks.begin(), Blocks.end()), Blocks.end());
+    Dependents[&*A].swap(Blocks);
+  }
+}
+
+}
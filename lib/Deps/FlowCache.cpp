@@ -0,0 +1,468 @@
+//===- FlowCache.cpp --------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// On-disk cache of per-function FlowRecords. Each entry is a small text
+// file: a header with the key, a table of the contexts the records use,
+// and one line per record listing its eight source and sink sets.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "deps"
+
+#include "FlowCache.h"
+
+#include "llvm/Function.h"
+#include "llvm/Instructions.h"
+#include "llvm/Module.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/system_error.h"
+
+#include <unistd.h>
+
+STATISTIC(flowCacheHits, "Number of functions whose flows were loaded from the cache");
+STATISTIC(flowCacheMisses, "Number of functions whose flows were not in the cache");
+STATISTIC(flowCacheUncacheable, "Number of functions whose flows could not be cached");
+
+namespace deps {
+
+// Bump whenever the flows generated for the same IR, or the file format,
+// change.
+static const char *const Magic = "deps-flows-2";
+
+// 64-bit FNV-1a, which unlike hash_code is stable across runs and builds
+static const FlowCache::Key FNVOffset = 14695981039346656037ULL;
+static const FlowCache::Key FNVPrime = 1099511628211ULL;
+
+static FlowCache::Key hashBytes(FlowCache::Key K, StringRef Bytes) {
+  for (StringRef::iterator I = Bytes.begin(), E = Bytes.end(); I != E; ++I) {
+    K ^= (unsigned char)*I;
+    K *= FNVPrime;
+  }
+  return K;
+}
+
+static FlowCache::Key hashInteger(FlowCache::Key K, uint64_t Value) {
+  for (unsigned i = 0; i < 8; ++i) {
+    K ^= (Value >> (8 * i)) & 0xff;
+    K *= FNVPrime;
+  }
+  return K;
+}
+
+static FlowCache::Key hashName(FlowCache::Key K, StringRef Name) {
+  return hashBytes(hashInteger(K, Name.size()), Name);
+}
+
+// Names are written length first, since they may contain any character
+static void writeName(raw_ostream &OS, StringRef Name) {
+  OS << ' ' << Name.size() << ':' << Name;
+}
+
+/// Arguments, blocks and instructions of a function in order, and the
+/// first place each other operand of its instructions appears.
+struct FlowCache::Numbering {
+  std::vector<const Value *> Locals;
+  DenseMap<const Value *, unsigned> LocalIDs;
+  DenseMap<const Value *, std::pair<unsigned, unsigned> > Operands;
+
+  void addLocal(const Value &V) {
+    LocalIDs[&V] = Locals.size();
+    Locals.push_back(&V);
+  }
+};
+
+/// Tokenizer for cache entries. Any malformed input puts it in the failed
+/// state, after which everything read is zero or empty.
+class FlowCache::Reader {
+public:
+  explicit Reader(StringRef Buf) : Buf(Buf), Failed(false) {}
+
+  bool failed() const { return Failed; }
+  bool atEnd() {
+    skipSpace();
+    return Buf.empty();
+  }
+
+  void expect(StringRef Token) {
+    skipSpace();
+    if (!Buf.startswith(Token)) return fail();
+    Buf = Buf.substr(Token.size());
+  }
+
+  char readChar() {
+    skipSpace();
+    if (Failed || Buf.empty()) {
+      fail();
+      return 0;
+    }
+    char C = Buf[0];
+    Buf = Buf.substr(1);
+    return C;
+  }
+
+  uint64_t readNumber() {
+    skipSpace();
+    size_t Len = 0;
+    while (Len < Buf.size() && Buf[Len] >= '0' && Buf[Len] <= '9') ++Len;
+    unsigned long long Value = 0;
+    if (Failed || Len == 0 || Buf.substr(0, Len).getAsInteger(10, Value)) {
+      fail();
+      return 0;
+    }
+    Buf = Buf.substr(Len);
+    return Value;
+  }
+
+  StringRef readName() {
+    uint64_t Len = readNumber();
+    if (Failed || Buf.empty() || Buf[0] != ':' || Buf.size() - 1 < Len) {
+      fail();
+      return StringRef();
+    }
+    StringRef Name = Buf.substr(1, Len);
+    Buf = Buf.substr(Len + 1);
+    return Name;
+  }
+
+  void fail() { Failed = true; }
+
+private:
+  void skipSpace() {
+    size_t Start = Buf.find_first_not_of(" \n");
+    Buf = Start == StringRef::npos ? StringRef() : Buf.substr(Start);
+  }
+
+  StringRef Buf;
+  bool Failed;
+};
+
+FlowCache::FlowCache(StringRef Dir, StringRef Options, Contexts &CM)
+  : Dir(Dir.str()), Seed(hashName(hashBytes(FNVOffset, Magic), Options)),
+    CM(CM) {
+  bool Existed;
+  sys::fs::create_directories(Dir, Existed);
+}
+
+FlowCache::~FlowCache() {
+  for (DenseMap<const Function *, Numbering *>::iterator I = Numberings.begin(),
+       E = Numberings.end(); I != E; ++I)
+    delete I->second;
+}
+
+FlowCache::Key
+FlowCache::functionHash(const Function &F) {
+  DenseMap<const Function *, Key>::iterator I = FunctionHashes.find(&F);
+  if (I != FunctionHashes.end()) return I->second;
+
+  std::string IR;
+  raw_string_ostream OS(IR);
+  F.print(OS);
+  OS.flush();
+
+  Key K = hashBytes(FNVOffset, IR);
+  FunctionHashes[&F] = K;
+  return K;
+}
+
+FlowCache::Key
+FlowCache::hashContext(Key K, ContextID Ctxt) const {
+  const Context &C = CM.getContextFor(Ctxt);
+  K = hashInteger(K, C.size());
+  for (Context::iterator I = C.begin(), E = C.end(); I != E; ++I)
+    K = hashName(K, (*I)->getName());
+  return K;
+}
+
+FlowCache::Key
+FlowCache::key(const Function &F, ContextID Ctxt) {
+  Key K = hashName(Seed, F.getName());
+  K = hashInteger(K, functionHash(F));
+  return hashContext(K, Ctxt);
+}
+
+void
+FlowCache::addCallee(Key &K, const ImmutableCallSite &CS,
+                     const Function &Callee, ContextID Ctxt) {
+  const Numbering &N = numberingFor(*CS.getCaller());
+  Key Site = hashInteger(FNVOffset, N.LocalIDs.lookup(CS.getInstruction()));
+  Site = hashName(Site, Callee.getName());
+  Site = hashInteger(Site, functionHash(Callee));
+  Site = hashContext(Site, Ctxt);
+  // Callees come out of sets ordered by address, so combine them in a way
+  // that doesn't depend on the order.
+  K += Site;
+}
+
+FlowCache::Numbering &
+FlowCache::numberingFor(const Function &F) {
+  Numbering *&N = Numberings[&F];
+  if (N) return *N;
+  N = new Numbering();
+
+  for (Function::const_arg_iterator A = F.arg_begin(), E = F.arg_end();
+       A != E; ++A)
+    N->addLocal(*A);
+  for (Function::const_iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    N->addLocal(*BB);
+    for (BasicBlock::const_iterator I = BB->begin(), IE = BB->end();
+         I != IE; ++I)
+      N->addLocal(*I);
+  }
+
+  for (unsigned i = 0, e = N->Locals.size(); i != e; ++i) {
+    const Instruction *I = dyn_cast<Instruction>(N->Locals[i]);
+    if (!I) continue;
+    for (unsigned op = 0, ope = I->getNumOperands(); op != ope; ++op) {
+      const Value *V = I->getOperand(op);
+      if (isa<Argument>(V) || isa<BasicBlock>(V) || isa<Instruction>(V))
+        continue;
+      // Keeps the first occurrence
+      N->Operands.insert(std::make_pair(V, std::make_pair(i, op)));
+    }
+  }
+  return *N;
+}
+
+std::string
+FlowCache::pathFor(Key K) const {
+  return Dir + "/" + utohexstr(K) + ".flows";
+}
+
+bool
+FlowCache::writeValue(raw_ostream &OS, const Function &F, const Value &V) {
+  const GlobalValue *GV = dyn_cast<GlobalValue>(&V);
+  if (GV && GV->hasName()) {
+    OS << " G";
+    writeName(OS, GV->getName());
+    return true;
+  }
+
+  const Function *Owner = NULL;
+  if (const Argument *A = dyn_cast<Argument>(&V))
+    Owner = A->getParent();
+  else if (const BasicBlock *BB = dyn_cast<BasicBlock>(&V))
+    Owner = BB->getParent();
+  else if (const Instruction *I = dyn_cast<Instruction>(&V))
+    Owner = I->getParent()->getParent();
+
+  if (Owner) {
+    if (!Owner->hasName()) return false;
+    const Numbering &N = numberingFor(*Owner);
+    OS << " L";
+    writeName(OS, Owner->getName());
+    OS << ' ' << N.LocalIDs.lookup(&V);
+    return true;
+  }
+
+  const Numbering &N = numberingFor(F);
+  DenseMap<const Value *, std::pair<unsigned, unsigned> >::const_iterator I =
+    N.Operands.find(&V);
+  if (I == N.Operands.end()) return false;
+  OS << " O " << I->second.first << ' ' << I->second.second;
+  return true;
+}
+
+const Value *
+FlowCache::readValue(Reader &R, const Function &F) {
+  const Module &M = *F.getParent();
+
+  switch (R.readChar()) {
+  case 'G':
+    return M.getNamedValue(R.readName());
+  case 'L': {
+    const Function *Owner = M.getFunction(R.readName());
+    uint64_t ID = R.readNumber();
+    if (!Owner) return NULL;
+    const Numbering &N = numberingFor(*Owner);
+    return ID < N.Locals.size() ? N.Locals[ID] : NULL;
+  }
+  case 'O': {
+    uint64_t ID = R.readNumber();
+    uint64_t Op = R.readNumber();
+    const Numbering &N = numberingFor(F);
+    if (ID >= N.Locals.size()) return NULL;
+    const Instruction *I = dyn_cast<Instruction>(N.Locals[ID]);
+    if (!I || Op >= I->getNumOperands()) return NULL;
+    return I->getOperand(Op);
+  }
+  default:
+    R.fail();
+    return NULL;
+  }
+}
+
+template <typename it>
+bool
+FlowCache::writeValues(raw_ostream &OS, const Function &F, it begin, it end) {
+  unsigned Count = 0;
+  for (it I = begin; I != end; ++I) ++Count;
+  OS << ' ' << Count;
+  for (it I = begin; I != end; ++I)
+    if (!writeValue(OS, F, **I)) return false;
+  return true;
+}
+
+unsigned
+FlowCache::contextIndex(ContextID Ctxt, std::vector<ContextID> &Table) {
+  // Zero is the default context, the others are numbered from one
+  if (Ctxt == DefaultID) return 0;
+  for (unsigned i = 0, e = Table.size(); i != e; ++i)
+    if (Table[i] == Ctxt) return i + 1;
+  Table.push_back(Ctxt);
+  return Table.size();
+}
+
+void
+FlowCache::store(Key K, const Function &F, const Flows &flows) {
+  std::vector<ContextID> Table;
+  std::string Records;
+  raw_string_ostream OS(Records);
+  for (Flows::const_iterator rec = flows.begin(), end = flows.end();
+       rec != end; ++rec) {
+    OS << 'R' << ' ' << rec->isImplicit()
+       << ' ' << contextIndex(rec->sourceContext(), Table)
+       << ' ' << contextIndex(rec->sinkContext(), Table);
+    bool Encoded =
+      writeValues(OS, F, rec->source_value_begin(), rec->source_value_end()) &&
+      writeValues(OS, F, rec->source_directptr_begin(), rec->source_directptr_end()) &&
+      writeValues(OS, F, rec->source_reachptr_begin(), rec->source_reachptr_end()) &&
+      writeValues(OS, F, rec->source_varg_begin(), rec->source_varg_end()) &&
+      writeValues(OS, F, rec->sink_value_begin(), rec->sink_value_end()) &&
+      writeValues(OS, F, rec->sink_directptr_begin(), rec->sink_directptr_end()) &&
+      writeValues(OS, F, rec->sink_reachptr_begin(), rec->sink_reachptr_end()) &&
+      writeValues(OS, F, rec->sink_varg_begin(), rec->sink_varg_end());
+    if (!Encoded) {
+      ++flowCacheUncacheable;
+      return;
+    }
+    OS << '\n';
+  }
+  OS.flush();
+
+  std::string Contents;
+  raw_string_ostream Out(Contents);
+  Out << Magic << ' ' << K << '\n';
+  Out << 'C' << ' ' << Table.size() << '\n';
+  for (std::vector<ContextID>::iterator I = Table.begin(), E = Table.end();
+       I != E; ++I) {
+    const Context &C = CM.getContextFor(*I);
+    Out << C.size();
+    for (Context::iterator CI = C.begin(), CE = C.end(); CI != CE; ++CI) {
+      if (!(*CI)->hasName()) {
+        ++flowCacheUncacheable;
+        return;
+      }
+      writeName(Out, (*CI)->getName());
+    }
+    Out << '\n';
+  }
+  Out << Records;
+  Out.flush();
+
+  // Write to a private file first, so that concurrent runs sharing the
+  // cache never see a partial entry.
+  std::string Path = pathFor(K);
+  std::string Temp = Path + ".tmp" + utostr(::getpid());
+  {
+    std::string Error;
+    raw_fd_ostream File(Temp.c_str(), Error, raw_fd_ostream::F_Binary);
+    if (!Error.empty()) return;
+    File << Contents;
+    File.close();
+    if (File.has_error()) {
+      File.clear_error();
+      bool Existed;
+      sys::fs::remove(Temp, Existed);
+      return;
+    }
+  }
+  if (sys::fs::rename(Temp, Path)) {
+    bool Existed;
+    sys::fs::remove(Temp, Existed);
+  }
+}
+
+bool
+FlowCache::load(Key K, const Function &F, Flows &flows) {
+  OwningPtr<MemoryBuffer> Buffer;
+  if (MemoryBuffer::getFile(pathFor(K), Buffer)) {
+    ++flowCacheMisses;
+    return false;
+  }
+
+  Reader R(Buffer->getBuffer());
+  R.expect(Magic);
+  if (R.readNumber() != K) R.fail();
+
+  // Contexts, by index
+  std::vector<ContextID> Table(1, DefaultID);
+  R.expect("C");
+  for (uint64_t i = 0, e = R.readNumber(); i != e && !R.failed(); ++i) {
+    Context C;
+    for (uint64_t j = 0, je = R.readNumber(); j != je && !R.failed(); ++j) {
+      const Function *Caller = F.getParent()->getFunction(R.readName());
+      if (!Caller) R.fail();
+      C.push_back(Caller);
+    }
+    if (R.failed()) break;
+    Table.push_back(CM.getIDFor(C));
+  }
+
+  Flows Loaded;
+  while (!R.failed() && !R.atEnd()) {
+    R.expect("R");
+    bool Implicit = R.readNumber();
+    uint64_t Source = R.readNumber();
+    uint64_t Sink = R.readNumber();
+    if (Source >= Table.size() || Sink >= Table.size()) {
+      R.fail();
+      break;
+    }
+    FlowRecord rec(Implicit, Table[Source], Table[Sink]);
+
+    // In the order store() writes them
+    for (unsigned Set = 0; Set != 8 && !R.failed(); ++Set) {
+      for (uint64_t i = 0, e = R.readNumber(); i != e && !R.failed(); ++i) {
+        const Value *V = readValue(R, F);
+        const Function *Fun = dyn_cast_or_null<Function>(V);
+        if (!V || ((Set == 3 || Set == 7) && !Fun)) {
+          R.fail();
+          break;
+        }
+        switch (Set) {
+        case 0: rec.addSourceValue(*V); break;
+        case 1: rec.addSourceDirectPtr(*V); break;
+        case 2: rec.addSourceReachablePtr(*V); break;
+        case 3: rec.addSourceVarg(*Fun); break;
+        case 4: rec.addSinkValue(*V); break;
+        case 5: rec.addSinkDirectPtr(*V); break;
+        case 6: rec.addSinkReachablePtr(*V); break;
+        case 7: rec.addSinkVarg(*Fun); break;
+        }
+      }
+    }
+    Loaded.push_back(rec);
+  }
+
+  if (R.failed()) {
+    ++flowCacheMisses;
+    return false;
+  }
+
+  ++flowCacheHits;
+  flows.insert(flows.end(), Loaded.begin(), Loaded.end());
+  return true;
+}
+
+}
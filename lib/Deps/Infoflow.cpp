@@ -15,10 +15,14 @@
 
 #include "Infoflow.h"
 #include "SignatureLibrary.h"
+#include "Constraints/PhaseReport.h"
 
 #include "llvm/Module.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
 
 namespace deps {
 
@@ -33,6 +37,39 @@ static cl::opt<bool> DepsCollapseIndContext(
 static cl::opt<bool> DepsDropAtSink(
   "deps-drop-sink-flows", cl::desc("Cut dependencies from sinks to other values"),
   cl::init(false));
+static cl::opt<bool> DepsDemandSolver(
+  "deps-demand-solver", cl::desc("Solve for each value only when it is queried"),
+  cl::init(false));
+static cl::opt<bool> DepsParallelConstraints(
+  "deps-parallel-constraints", cl::desc("Compute the flows of several functions at once on worker threads"),
+  cl::init(false));
+static cl::opt<bool> DepsBottomUp(
+  "deps-bottom-up", cl::desc("Analyze callees before their callers, by call graph SCC"),
+  cl::init(false));
+static cl::opt<std::string> DepsDumpConstraints(
+  "deps-dump-constraints", cl::desc("Write the generated constraints to the given file, for deps-solver-bench"),
+  cl::init(""));
+static cl::opt<std::string> DepsFlowCache(
+  "deps-flow-cache", cl::desc("Directory in which to keep the flows of each function between runs"),
+  cl::init(""));
+static cl::opt<unsigned> DepsContextBudget(
+  "deps-context-budget", cl::desc("Analyze each function in at most this many calling contexts, merging the rest (0 = no limit)"),
+  cl::init(0));
+static cl::opt<bool> DepsCanonicalContexts(
+  "deps-canonical-contexts", cl::desc("Generate the constraints of functions that call no analyzed code once, and only their interface per context"),
+  cl::init(false));
+static cl::opt<bool> DepsImplicitFlows(
+  "deps-implicit-flows", cl::desc("Taint the blocks control dependent on tainted branches"),
+  cl::init(true));
+static cl::opt<bool> DepsLazyPostDom(
+  "deps-lazy-postdom", cl::desc("Compute post-dominator trees only for functions with conditional branches to constrain"),
+  cl::init(false));
+static cl::opt<bool> DepsCompactAfterSolve(
+  "deps-compact-after-solve", cl::desc("Free the solver state once clients have all their solutions"),
+  cl::init(false));
+static cl::opt<bool> DepsEvictPostDom(
+  "deps-evict-postdom", cl::desc("Free the post-dominator tree of a function once it has been analyzed (with -deps-lazy-postdom)"),
+  cl::init(false));
 
 typedef Infoflow::Flows Flows;
 
@@ -44,19 +81,42 @@ X ("infoflow", "Compute information flow constraints", true, true);
 
 static RegisterPass<PDTCache>
 Y ("pdtcache", "Cache PostDom Analysis Results", true, true);
+
+bool PDTCache::computeLazily() const { return DepsLazyPostDom; }
+bool PDTCache::isNeeded() const { return DepsImplicitFlows; }
   
 Infoflow::Infoflow () : 
-    CallSensitiveAnalysisPass<Unit,Unit,1,CallerContext>(ID, DepsCollapseExtContext, DepsCollapseIndContext),
-    kit(new LHConstraintKit()) { }
+    CallSensitiveAnalysisPass<Unit,Unit,1,CallerContext>(ID, DepsCollapseExtContext, DepsCollapseIndContext,
+                                                         DepsContextBudget),
+    kit(new LHConstraintKit()), pdtCache(NULL), numLabels(0), flowCache(NULL),
+    constraintsDumped(false) {
+  ::pthread_mutex_init(&preparedFlowsLock, NULL);
+  ::pthread_mutex_init(&controlDepsLock, NULL);
+}
 
 void
 Infoflow::doInitialization() {
   // Get the PointsToInterface
   pti = &getAnalysis<PointsToInterface>();
   sourceSinkAnalysis = &getAnalysis<SourceSinkAnalysis>();
+  pdtCache = &getAnalysis<PDTCache>();
 
   signatureRegistrar = new SignatureRegistrar();
   registerSignatures();
+  signatureRegistrar->compile(getAnalysis<DataStructureCallGraph>().getModule());
+
+  if (!DepsFlowCache.empty()) {
+    // Everything that changes the flows generated for the same IR
+    std::string options;
+    raw_string_ostream OS(options);
+    OS << "collapse-external=" << DepsCollapseExtContext
+       << " collapse-indirect=" << DepsCollapseIndContext
+       << " drop-sink-flows=" << DepsDropAtSink
+       << " implicit-flows=" << DepsImplicitFlows
+       << " context-budget=" << DepsContextBudget
+       << " canonical-contexts=" << DepsCanonicalContexts;
+    flowCache = new FlowCache(DepsFlowCache, OS.str(), CM);
+  }
 }
 
 void
@@ -64,6 +124,31 @@ Infoflow::doFinalization() {
   //  delete signatureRegistrar;
   // now deleted in destructor, because we need the registrar
   // for computing propagatesTaint
+
+  const std::vector<const Function *> &demoted = demotedFunctions();
+  if (!demoted.empty()) {
+    errs() << "deps: " << demoted.size() << " functions exceeded the context budget of "
+           << DepsContextBudget << ":\n";
+    for (std::vector<const Function *>::const_iterator fun = demoted.begin(),
+         end = demoted.end(); fun != end; ++fun)
+      errs() << "  " << (*fun)->getName() << "\n";
+  }
+}
+
+// Written when the first solution is asked for rather than at the end of
+// constraint generation, so that the kinds clients add before that are
+// replayed too
+void
+Infoflow::dumpConstraints() {
+  if (constraintsDumped || DepsDumpConstraints.empty()) return;
+  constraintsDumped = true;
+
+  std::string error;
+  raw_fd_ostream out(DepsDumpConstraints.c_str(), error);
+  if (error.empty())
+    kit->writeConstraints(out);
+  else
+    errs() << "Cannot write constraints: " << error << "\n";
 }
 
 void Infoflow::registerSignatures() {
@@ -92,68 +177,129 @@ Infoflow::runOnContext(const Infoflow::AUnitType unit, const Unit input) {
   DEBUG(errs() << "Running on " << unit.function().getName() << " in context [";
   CM.getContextFor(unit.context()).dump();
   errs() << "]\n");
-  generateFunctionConstraints(unit.function());
+  PhaseTimer T("constraint generation");
+  std::map<AUnitType, Flows>::iterator prepared = preparedFlows.find(unit);
+  if (DepsCanonicalContexts) {
+    Flows *flows = prepared != preparedFlows.end() ? &prepared->second : NULL;
+    if (CanonicalInstance *canon = getOrCreateCanonicalInstance(unit.function(), flows)) {
+      instantiateCanonicalInstance(unit.function(), *canon, unit.context());
+      if (flows) preparedFlows.erase(prepared);
+      return Unit();
+    }
+  }
+  if (prepared != preparedFlows.end()) {
+    constrainPreparedFunction(unit.function(), prepared->second);
+    preparedFlows.erase(prepared);
+  } else if (flowCache) {
+    cachedFunctionConstraints(unit.function());
+  } else {
+    generateFunctionConstraints(unit.function());
+  }
+  // No units are being prepared while we run, so nothing else holds the
+  // tree. Other contexts of the function only need its control dependence.
+  if (DepsEvictPostDom)
+    pdtCache->evict(&unit.function());
   return Unit();
 }
 
+unsigned
+Infoflow::prepareBatchSize() const {
+  // A few units per worker, so that a large function does not leave the
+  // rest of the pool idle. Units found in the flow cache are cheap, so
+  // don't prepare any when there is one.
+  if (flowCache) return 0;
+  return DepsParallelConstraints ? 4 * ThreadPool::global().size() : 0;
+}
+
+bool
+Infoflow::scheduleBottomUp() const {
+  return DepsBottomUp;
+}
+
+/// Computes the flows of a function in the unit's context without touching
+/// the constraint kit or requesting callees (the signature flows of external
+/// callees are included), so that it may run on a worker thread.
+void
+Infoflow::prepareContext(const AUnitType unit) {
+  PhaseTimer T("flow preparation");
+  Flows flows;
+  getFunctionFlows(unit.function(), flows);
+
+  ::pthread_mutex_lock(&preparedFlowsLock);
+  preparedFlows[unit].swap(flows);
+  ::pthread_mutex_unlock(&preparedFlowsLock);
+}
+
+typedef SmallVector<const AbstractLoc *, 8> LocList;
+
+/// Sorts the locations and drops the duplicates
+static void
+uniqueLocs(LocList &locs) {
+  std::sort(locs.begin(), locs.end());
+  locs.erase(std::unique(locs.begin(), locs.end()), locs.end());
+}
+
 void
 Infoflow::constrainFlowRecord(const FlowRecord &record) {
   const ConsElem *sourceElem = NULL;
   const ConsElem *sinkSourceElem = NULL;
   
-  // First, build up the set of ConsElem's that represent the sources:
-  std::set<const ConsElem*> Sources;
-  std::set<const ConsElem*> sinkSources;
+  // First, build up the set of ConsElem's that represent the sources.
+  // These are small, and the kit sorts and deduplicates them in the join.
+  SmallVector<const ConsElem*, 8> Sources;
+  SmallVector<const ConsElem*, 8> sinkSources;
   {
     // For variables and vargs elements, add all of these directly to 'Sources'
     for (FlowRecord::value_iterator source = record.source_value_begin(), end = record.source_value_end();
         source != end; ++source) {
       if (!DepsDropAtSink || !sourceSinkAnalysis->valueIsSink(**source)) {
-	Sources.insert(&getOrCreateConsElem(record.sourceContext(), **source));
+	Sources.push_back(&getOrCreateConsElem(record.sourceContext(), **source));
       } else {
-	sinkSources.insert(&getOrCreateConsElem(record.sourceContext(), **source));
+	sinkSources.push_back(&getOrCreateConsElem(record.sourceContext(), **source));
       }
     }
     for (FlowRecord::fun_iterator source = record.source_varg_begin(), end = record.source_varg_end();
         source != end; ++source) {
       if (!DepsDropAtSink || !sourceSinkAnalysis->vargIsSink(**source)) {
-	Sources.insert(&getOrCreateVargConsElem(record.sourceContext(), **source));
+	Sources.push_back(&getOrCreateVargConsElem(record.sourceContext(), **source));
       } else {
-	sinkSources.insert(&getOrCreateVargConsElem(record.sourceContext(), **source));
+	sinkSources.push_back(&getOrCreateVargConsElem(record.sourceContext(), **source));
       }
     }
 
     // For memory-based sources, build up the set of memory locations that act
     // as sources for this record...
-    std::set<const AbstractLoc*> SourceLocs;
-    std::set<const AbstractLoc*> sinkSourceLocs;
+    LocList SourceLocs;
+    LocList sinkSourceLocs;
     for (FlowRecord::value_iterator source = record.source_directptr_begin(), end = record.source_directptr_end();
         source != end; ++source) {
       const std::set<const AbstractLoc *> & locs = locsForValue(**source);
       if (!DepsDropAtSink || !sourceSinkAnalysis->directPtrIsSink(**source)) {
-	SourceLocs.insert(locs.begin(), locs.end());
+	SourceLocs.append(locs.begin(), locs.end());
       } else {
-	sinkSourceLocs.insert(locs.begin(), locs.end());
+	sinkSourceLocs.append(locs.begin(), locs.end());
       }
     }
     for (FlowRecord::value_iterator source = record.source_reachptr_begin(), end = record.source_reachptr_end();
         source != end; ++source) {
       const std::set<const AbstractLoc *> & locs = reachableLocsForValue(**source);
       if (!DepsDropAtSink || !sourceSinkAnalysis->reachPtrIsSink(**source)) {
-	SourceLocs.insert(locs.begin(), locs.end());
+	SourceLocs.append(locs.begin(), locs.end());
       } else {
-	sinkSourceLocs.insert(locs.begin(), locs.end());
+	sinkSourceLocs.append(locs.begin(), locs.end());
       }
     }
 
     // ...And convert those locs into ConsElem's and store them into Sources
-    for(std::set<const AbstractLoc*>::const_iterator I = SourceLocs.begin(),
+    uniqueLocs(SourceLocs);
+    uniqueLocs(sinkSourceLocs);
+    for(LocList::const_iterator I = SourceLocs.begin(),
         E = SourceLocs.end(); I != E; ++I) {
-      Sources.insert(&getOrCreateConsElem(**I));
+      Sources.push_back(&getOrCreateConsElem(**I));
     }
-    for(std::set<const AbstractLoc*>::const_iterator I = sinkSourceLocs.begin(),
+    for(LocList::const_iterator I = sinkSourceLocs.begin(),
         E = sinkSourceLocs.end(); I != E; ++I) {
-      sinkSources.insert(&getOrCreateConsElem(**I));
+      sinkSources.push_back(&getOrCreateConsElem(**I));
     }
   }
 
@@ -191,20 +337,21 @@ Infoflow::constrainFlowRecord(const FlowRecord &record) {
   }
 
   // To try to save constraint generation, gather memory locations as before:
-  std::set<const AbstractLoc*> SinkLocs;
+  LocList SinkLocs;
   for (FlowRecord::value_iterator sink = record.sink_directptr_begin(), end = record.sink_directptr_end();
       sink != end; ++sink) {
     const std::set<const AbstractLoc *> & locs = locsForValue(**sink);
-    SinkLocs.insert(locs.begin(), locs.end());
+    SinkLocs.append(locs.begin(), locs.end());
   }
   for (FlowRecord::value_iterator sink = record.sink_reachptr_begin(), end = record.sink_reachptr_end();
       sink != end; ++sink) {
     const std::set<const AbstractLoc *> & locs = reachableLocsForValue(**sink);
-    SinkLocs.insert(locs.begin(), locs.end());
+    SinkLocs.append(locs.begin(), locs.end());
   }
 
   // And add constraints for each of the sink memory locations
-  for (std::set<const AbstractLoc *>::iterator loc = SinkLocs.begin(), end = SinkLocs.end();
+  uniqueLocs(SinkLocs);
+  for (LocList::const_iterator loc = SinkLocs.begin(), end = SinkLocs.end();
       loc != end ; ++loc) {
     if (regFlow)
       putOrConstrainConsElem(implicit, false, **loc, *sourceElem);
@@ -249,6 +396,12 @@ InfoflowSolution::isTainted(const Value & value) {
 bool
 InfoflowSolution::isDirectPtrTainted(const Value & value) {
   const std::set<const AbstractLoc *> & locs = infoflow.locsForValue(value);
+  if (precomputed) {
+    DenseMap<const AbstractLocSet *, bool>::iterator known = directTainted.find(&locs);
+    if (known == directTainted.end())
+      known = directTainted.insert(std::make_pair(&locs, anyLocTainted(locs))).first;
+    return known->second;
+  }
   for (std::set<const AbstractLoc *>::const_iterator loc = locs.begin(), end = locs.end();
         loc != end; ++loc) {
     DenseMap<const AbstractLoc *, const ConsElem *>::iterator entry = locMap.find(*loc);
@@ -267,6 +420,14 @@ InfoflowSolution::isDirectPtrTainted(const Value & value) {
 
 bool
 InfoflowSolution::isReachPtrTainted(const Value & value) {
+  if (precomputed) {
+    ReachableSetID id = infoflow.reachableSetIDForValue(value);
+    if (id >= reachTainted.size())
+      reachTainted.resize(id + 1, 0);
+    if (!reachTainted[id])
+      reachTainted[id] = anyLocTainted(infoflow.reachableLocsForID(id)) ? 2 : 1;
+    return reachTainted[id] == 2;
+  }
   const std::set<const AbstractLoc *> & locs = infoflow.reachableLocsForValue(value);
   for (std::set<const AbstractLoc *>::iterator loc = locs.begin(), end = locs.end();
         loc != end; ++loc) {
@@ -296,6 +457,44 @@ InfoflowSolution::isVargTainted(const Function & fun) {
   }
 }
 
+bool
+InfoflowSolution::isLocTainted(const AbstractLoc & loc) {
+  DenseMap<const AbstractLoc *, const ConsElem *>::iterator entry = locMap.find(&loc);
+  if (entry == locMap.end()) return defaultTainted;
+  return (soln->subst(*(entry->second)) == highConstant);
+}
+
+void
+InfoflowSolution::precompute() {
+  if (precomputed) return;
+  PhaseTimer T("solution precompute");
+  for (DenseMap<const AbstractLoc *, const ConsElem *>::iterator entry = locMap.begin(),
+       end = locMap.end(); entry != end; ++entry) {
+    locTainted[entry->first] = soln->subst(*(entry->second)) == highConstant;
+  }
+  precomputed = true;
+}
+
+bool
+InfoflowSolution::anyLocTainted(const AbstractLocSet & locs) const {
+  for (AbstractLocSet::const_iterator loc = locs.begin(), end = locs.end();
+       loc != end; ++loc) {
+    DenseMap<const AbstractLoc *, bool>::const_iterator known = locTainted.find(*loc);
+    if (known != locTainted.end()) {
+      if (known->second) return true;
+      continue;
+    }
+    // Added to locMap since precompute(): ask the solution
+    DenseMap<const AbstractLoc *, const ConsElem *>::const_iterator entry = locMap.find(*loc);
+    if (entry == locMap.end()) {
+      assert(false && "abstract location not in solution!");
+      return defaultTainted;
+    }
+    if (soln->subst(*(entry->second)) == highConstant) return true;
+  }
+  return false;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Infoflow
 ///////////////////////////////////////////////////////////////////////////////
@@ -380,14 +579,78 @@ Infoflow::setReachPtrTainted(std::string kind, const Value & value) {
   }
 }
 
+void
+Infoflow::addLabelSeed(unsigned label, const ConsElem & elem) {
+  labelSeeds.push_back(std::make_pair(&elem, label));
+  numLabels = std::max(numLabels, label + 1);
+}
+
+void
+Infoflow::setLabelTainted(unsigned label, const Value & value) {
+  addLabelSeed(label, getOrCreateConsElemSummarySource(value));
+}
+
+void
+Infoflow::setDirectPtrLabelTainted(unsigned label, const Value & value) {
+  const std::set<const AbstractLoc *> & locs = locsForValue(value);
+  for (std::set<const AbstractLoc *>::iterator loc = locs.begin(), end = locs.end();
+        loc != end; ++loc) {
+    addLabelSeed(label, getOrCreateConsElem(**loc));
+  }
+}
+
+void
+Infoflow::setReachPtrLabelTainted(unsigned label, const Value & value) {
+  const std::set<const AbstractLoc *> & locs = reachableLocsForValue(value);
+  for (std::set<const AbstractLoc *>::iterator loc = locs.begin(), end = locs.end();
+        loc != end; ++loc) {
+    addLabelSeed(label, getOrCreateConsElem(**loc));
+  }
+}
+
+void
+Infoflow::setVargLabelTainted(unsigned label, const Function & fun) {
+  addLabelSeed(label, getOrCreateVargConsElemSummarySource(fun));
+}
+
+bool
+Infoflow::compactAfterSolve() const {
+  return DepsCompactAfterSolve;
+}
+
+void
+Infoflow::compactSolverState() {
+  PhaseTimer T("compact solver state");
+  dumpConstraints();
+
+  // Per-context elems and the analysis units they came from
+  clearFunctionElems();
+  clearControlDependence();
+  clearCanonicalInstances();
+  valueConstraintMap.clear();
+  preparedFlows.clear();
+  Flows().swap(functionFlows);
+  releaseAnalysisUnits();
+  CM.clear();
+
+  // Only used for adding more constraints to locations
+  reachableJoinMap.clear();
+  for (unsigned kind = 0; kind != 4; ++kind)
+    reachableBoundMap[kind].clear();
+
+  kit->compact();
+}
+
 InfoflowSolution *
 Infoflow::leastSolution(std::set<std::string> kinds, bool implicit, bool sinks) {
+  dumpConstraints();
   kinds.insert("default");
   if (sinks) kinds.insert("default-sinks");
   if (implicit) kinds.insert("implicit");
   if (implicit && sinks) kinds.insert("implicit-sinks");
   return new InfoflowSolution(*this,
-                              kit->leastSolution(kinds),
+                              DepsDemandSolver ? kit->leastDemandSolution(kinds)
+                                               : kit->leastSolution(kinds),
                               kit->highConstant(),
                               false, /* default to untainted */
                               summarySinkValueConstraintMap,
@@ -397,6 +660,7 @@ Infoflow::leastSolution(std::set<std::string> kinds, bool implicit, bool sinks)
 
 InfoflowSolution *
 Infoflow::greatestSolution(std::set<std::string> kinds, bool implicit) {
+  dumpConstraints();
   kinds.insert("default");
   kinds.insert("default-sinks");
   if (implicit) {
@@ -404,7 +668,8 @@ Infoflow::greatestSolution(std::set<std::string> kinds, bool implicit) {
     kinds.insert("implicit-sinks");
   }
   return new InfoflowSolution(*this,
-                              kit->greatestSolution(kinds),
+                              DepsDemandSolver ? kit->greatestDemandSolution(kinds)
+                                               : kit->greatestSolution(kinds),
                               kit->highConstant(),
                               true, /* default to tainted */
                               summarySourceValueConstraintMap,
@@ -422,6 +687,16 @@ Infoflow::reachableLocsForValue(const Value & value) const {
   return *pti->getReachableAbstractLocSetForValue(&value);
 }
 
+ReachableSetID
+Infoflow::reachableSetIDForValue(const Value & value) const {
+  return pti->getReachableSetIDForValue(&value);
+}
+
+const std::set<const AbstractLoc *> &
+Infoflow::reachableLocsForID(ReachableSetID id) const {
+  return *pti->getReachableAbstractLocSet(id);
+}
+
 const std::string
 Infoflow::kindFromImplicitSink(bool implicit, bool sink) const {
   if (implicit) {
@@ -484,23 +759,95 @@ Infoflow::putOrConstrainConsElemSummarySink(std::string kind, const Value &value
   kit->addConstraint(kind, lub, current);
 }
 
+static const Function *
+functionOf(const Value &value) {
+  if (const Argument *arg = dyn_cast<Argument>(&value))
+    return arg->getParent();
+  if (const BasicBlock *block = dyn_cast<BasicBlock>(&value))
+    return block->getParent();
+  if (const Instruction *inst = dyn_cast<Instruction>(&value))
+    return inst->getParent()->getParent();
+  return NULL;
+}
+
+Infoflow::FunctionElems &
+Infoflow::getOrCreateFunctionElems(const Function &fun) {
+  FunctionElems *&elems = functionElems[&fun];
+  if (elems) return *elems;
+
+  elems = new FunctionElems();
+  elems->lastContext = DefaultID;
+  elems->lastElems = NULL;
+  // Slot 0 is the varargs
+  unsigned slot = 1;
+  for (Function::const_arg_iterator arg = fun.arg_begin(), end = fun.arg_end();
+       arg != end; ++arg)
+    localSlots[&*arg] = LocalSlot(elems, slot++);
+  for (Function::const_iterator block = fun.begin(), end = fun.end();
+       block != end; ++block) {
+    localSlots[&*block] = LocalSlot(elems, slot++);
+    for (BasicBlock::const_iterator inst = block->begin(), iend = block->end();
+         inst != iend; ++inst)
+      localSlots[&*inst] = LocalSlot(elems, slot++);
+  }
+  elems->numSlots = slot;
+  return *elems;
+}
+
+const ConsElem *&
+Infoflow::getOrCreateSlot(FunctionElems &elems, const ContextID ctxt, unsigned slot) {
+  if (!elems.lastElems || elems.lastContext != ctxt) {
+    const ConsElem **&array = elems.byContext[ctxt];
+    if (!array) {
+      array = new const ConsElem *[elems.numSlots];
+      std::fill(array, array + elems.numSlots, (const ConsElem *)NULL);
+    }
+    elems.lastContext = ctxt;
+    elems.lastElems = array;
+  }
+  return elems.lastElems[slot];
+}
+
+void
+Infoflow::clearFunctionElems() {
+  for (DenseMap<const Function *, FunctionElems *>::iterator fun = functionElems.begin(),
+       end = functionElems.end(); fun != end; ++fun) {
+    FunctionElems *elems = fun->second;
+    for (DenseMap<ContextID, const ConsElem **>::iterator ctxt = elems->byContext.begin(),
+         cend = elems->byContext.end(); ctxt != cend; ++ctxt)
+      delete [] ctxt->second;
+    delete elems;
+  }
+  functionElems.clear();
+  localSlots.clear();
+}
+
 const ConsElem &
 Infoflow::getOrCreateConsElem(const ContextID ctxt, const Value &value) {
-  DenseMap<const Value *, const ConsElem *> & valueMap = getOrCreateValueConstraintMap(ctxt);
-  DenseMap<const Value *, const ConsElem *>::iterator curElem = valueMap.find(&value);
-  if (curElem == valueMap.end()) {
+  const ConsElem **slot;
+  DenseMap<const Value *, LocalSlot>::iterator local = localSlots.find(&value);
+  if (local != localSlots.end()) {
+    slot = &getOrCreateSlot(*local->second.first, ctxt, local->second.second);
+  } else if (const Function *fun = functionOf(value)) {
+    // The first value of the function we see
+    FunctionElems &elems = getOrCreateFunctionElems(*fun);
+    local = localSlots.find(&value);
+    assert(local != localSlots.end() && "Value added after its function was numbered");
+    slot = &getOrCreateSlot(elems, ctxt, local->second.second);
+  } else {
+    slot = &getOrCreateValueConstraintMap(ctxt)[&value];
+  }
+
+  if (!*slot) {
       const ConsElem & elem = kit->newVar(value.getName());
-      valueMap.insert(std::make_pair(&value, &elem));
+      *slot = &elem;
 
       // Hook up the summaries for non-context sensitive interface
       const ConsElem & summarySource = getOrCreateConsElemSummarySource(value);
       kit->addConstraint("default",summarySource,elem);
       putOrConstrainConsElemSummarySink("default", value, elem);
-      
-      return elem;
-  } else {
-      return *(curElem->second);
   }
+  return **slot;
 }
 
 void
@@ -519,11 +866,6 @@ Infoflow::putOrConstrainConsElem(bool implicit, bool sink, const Value &value, c
   return putOrConstrainConsElem(implicit, sink, this->getCurrentContext(), value, lub);
 }
 
-DenseMap<const Function *, const ConsElem *> &
-Infoflow::getOrCreateVargConstraintMap(const ContextID context) {
-  return vargConstraintMap[context];
-}
-
 const ConsElem &
 Infoflow::getOrCreateVargConsElemSummarySource(const Function &value) {
   DenseMap<const Function *, const ConsElem *>::iterator curElem = summarySourceVargConstraintMap.find(&value);
@@ -566,21 +908,17 @@ Infoflow::putOrConstrainVargConsElemSummarySink(std::string kind, const Function
 
 const ConsElem &
 Infoflow::getOrCreateVargConsElem(const ContextID ctxt, const Function &value) {
-  DenseMap<const Function *, const ConsElem *> & valueMap = getOrCreateVargConstraintMap(ctxt);
-  DenseMap<const Function *, const ConsElem *>::iterator curElem = valueMap.find(&value);
-  if (curElem == valueMap.end()) {
+  const ConsElem *&slot = getOrCreateSlot(getOrCreateFunctionElems(value), ctxt, 0);
+  if (!slot) {
       const ConsElem & elem = kit->newVar(value.getName());
-      valueMap.insert(std::make_pair(&value, &elem));
+      slot = &elem;
 
       // Hook up the summaries for non-context sensitive interface
       const ConsElem & summarySource = getOrCreateConsElemSummarySource(value);
       kit->addConstraint("default",summarySource,elem);
       putOrConstrainVargConsElemSummarySink("default", value, elem);
-
-      return elem;
-  } else {
-      return *(curElem->second);
   }
+  return *slot;
 }
 
 void
@@ -621,7 +959,8 @@ Infoflow::putOrConstrainConsElem(bool implicit, bool sink, const AbstractLoc &lo
 
 void
 Infoflow::generateFunctionConstraints(const Function& f) {
-    std::vector<FlowRecord> flows;
+    Flows &flows = functionFlows;
+    flows.clear();
     for (Function::const_iterator bb = f.begin(), end = f.end(); bb != end; ++bb) {
         // Build constraints for basic blocks
         // The pc of the entry block will be tainted at any call sites
@@ -634,6 +973,292 @@ Infoflow::generateFunctionConstraints(const Function& f) {
     }
 }
 
+/// Finishes what prepareContext started: requests the analysis of every
+/// callee generateFunctionConstraints would have requested, and adds the
+/// prepared flows to the constraint kit.
+void
+Infoflow::constrainPreparedFunction(const Function& f, const Flows &flows) {
+    for (Function::const_iterator bb = f.begin(), end = f.end(); bb != end; ++bb) {
+      for (BasicBlock::const_iterator inst = bb->begin(), iend = bb->end(); inst != iend; ++inst) {
+        ImmutableCallSite cs(&*inst);
+        if (cs && !isa<IntrinsicInst>(&*inst)) {
+          this->requestCallees(cs, Unit());
+        }
+      }
+    }
+
+    for (Flows::const_iterator flow = flows.begin(), flowend = flows.end();
+        flow != flowend; ++flow) {
+      constrainFlowRecord(*flow);
+    }
+}
+
+/// Same as generateFunctionConstraints, but loads the flows from the flow
+/// cache if the function, its context and its callees haven't changed
+/// since they were stored, and stores them otherwise.
+void
+Infoflow::cachedFunctionConstraints(const Function& f) {
+    FlowCache::Key key = flowCache->key(f, this->getCurrentContext());
+    for (Function::const_iterator bb = f.begin(), end = f.end(); bb != end; ++bb) {
+      for (BasicBlock::const_iterator inst = bb->begin(), iend = bb->end(); inst != iend; ++inst) {
+        ImmutableCallSite cs(&*inst);
+        if (!cs || isa<IntrinsicInst>(&*inst)) continue;
+
+        std::set<std::pair<const Function *, const ContextID> > callees = this->invokableCode(cs);
+        for (std::set<std::pair<const Function *, const ContextID> >::iterator callee = callees.begin(), cend = callees.end();
+             callee != cend; ++callee) {
+          flowCache->addCallee(key, cs, *callee->first, callee->second);
+        }
+      }
+    }
+
+    Flows &flows = functionFlows;
+    flows.clear();
+    if (!flowCache->load(key, f, flows)) {
+      getFunctionFlows(f, flows);
+      flowCache->store(key, f, flows);
+    }
+    constrainPreparedFunction(f, flows);
+}
+
+Infoflow::CanonicalInstance *
+Infoflow::getOrCreateCanonicalInstance(const Function &f, Flows *prepared) {
+    DenseMap<const Function *, CanonicalInstance *>::iterator entry =
+      canonicalInstances.find(&f);
+    if (entry != canonicalInstances.end())
+      return entry->second;
+
+    // Any code we'd analyze would be in contexts derived from ours
+    CanonicalInstance *&canon = canonicalInstances[&f];
+    canon = NULL;
+    for (Function::const_iterator bb = f.begin(), end = f.end(); bb != end; ++bb) {
+      for (BasicBlock::const_iterator inst = bb->begin(), iend = bb->end(); inst != iend; ++inst) {
+        ImmutableCallSite cs(&*inst);
+        if (cs && !isa<IntrinsicInst>(&*inst) && !this->invokableCode(cs).empty())
+          return NULL;
+      }
+    }
+
+    CanonicalInstance *instance = new CanonicalInstance();
+    instance->context = CM.getAnonymousID();
+    Flows &flows = prepared ? *prepared : functionFlows;
+    if (!prepared) {
+      flows.clear();
+      getFunctionFlows(f, flows);
+    }
+    const ContextID current = this->getCurrentContext();
+    for (Flows::iterator flow = flows.begin(), flowend = flows.end();
+        flow != flowend; ++flow) {
+      flow->setContexts(flow->sourceContext() == current ? instance->context : flow->sourceContext(),
+                        flow->sinkContext() == current ? instance->context : flow->sinkContext());
+      constrainFlowRecord(*flow);
+    }
+    summarizeCanonicalInstance(f, flows, *instance);
+    canon = instance;
+    return canon;
+}
+
+/// Whether combination k (by implicit + 2 * sink) is reached already, by
+/// it or a combination needing less
+static bool
+coveredKind(unsigned reached, unsigned k) {
+  for (unsigned s = 0; s != 4; ++s)
+    if ((reached & (1u << s)) && (s & ~k) == 0) return true;
+  return false;
+}
+
+/// Finds what reaches each return of the canonical instance through the
+/// function's own values, which are numbered by their slots.
+void
+Infoflow::summarizeCanonicalInstance(const Function &f, const Flows &flows, CanonicalInstance &canon) {
+    FunctionElems &elems = getOrCreateFunctionElems(f);
+    const unsigned numSlots = elems.numSlots;
+    // The varargs take the summaries of the function itself
+    std::vector<const Value *> values(numSlots);
+    values[0] = &f;
+    for (Function::const_arg_iterator arg = f.arg_begin(), end = f.arg_end();
+         arg != end; ++arg)
+      values[localSlots[&*arg].second] = &*arg;
+    for (Function::const_iterator bb = f.begin(), end = f.end(); bb != end; ++bb) {
+      values[localSlots[&*bb].second] = &*bb;
+      for (BasicBlock::const_iterator inst = bb->begin(), iend = bb->end(); inst != iend; ++inst)
+        values[localSlots[&*inst].second] = &*inst;
+    }
+
+    // What each slot is constrained by, and through which kinds
+    typedef std::pair<unsigned, unsigned> LocalPred;
+    typedef std::pair<const ConsElem *, unsigned> GlobalPred;
+    std::vector<std::vector<LocalPred> > localPreds(numSlots);
+    std::vector<std::vector<GlobalPred> > globalPreds(numSlots);
+    for (Flows::const_iterator flow = flows.begin(), flowend = flows.end();
+        flow != flowend; ++flow) {
+      const unsigned implicit = flow->isImplicit() ? 1 : 0;
+      SmallVector<LocalPred, 8> locals;
+      SmallVector<GlobalPred, 8> globals;
+      for (FlowRecord::value_iterator source = flow->source_value_begin(), end = flow->source_value_end();
+          source != end; ++source) {
+        unsigned k = implicit | (DepsDropAtSink && sourceSinkAnalysis->valueIsSink(**source) ? 2 : 0);
+        DenseMap<const Value *, LocalSlot>::iterator local = localSlots.find(*source);
+        if (flow->sourceContext() == canon.context && local != localSlots.end() &&
+            local->second.first == &elems)
+          locals.push_back(LocalPred(local->second.second, k));
+        else
+          globals.push_back(GlobalPred(&getOrCreateConsElem(flow->sourceContext(), **source), k));
+      }
+      for (FlowRecord::fun_iterator source = flow->source_varg_begin(), end = flow->source_varg_end();
+          source != end; ++source) {
+        unsigned k = implicit | (DepsDropAtSink && sourceSinkAnalysis->vargIsSink(**source) ? 2 : 0);
+        if (flow->sourceContext() == canon.context && *source == &f)
+          locals.push_back(LocalPred(0, k));
+        else
+          globals.push_back(GlobalPred(&getOrCreateVargConsElem(flow->sourceContext(), **source), k));
+      }
+      for (FlowRecord::value_iterator source = flow->source_directptr_begin(), end = flow->source_directptr_end();
+          source != end; ++source) {
+        unsigned k = implicit | (DepsDropAtSink && sourceSinkAnalysis->directPtrIsSink(**source) ? 2 : 0);
+        const std::set<const AbstractLoc *> &locs = locsForValue(**source);
+        for (std::set<const AbstractLoc *>::const_iterator loc = locs.begin(), lend = locs.end();
+             loc != lend; ++loc)
+          globals.push_back(GlobalPred(&getOrCreateConsElem(**loc), k));
+      }
+      for (FlowRecord::value_iterator source = flow->source_reachptr_begin(), end = flow->source_reachptr_end();
+          source != end; ++source) {
+        unsigned k = implicit | (DepsDropAtSink && sourceSinkAnalysis->reachPtrIsSink(**source) ? 2 : 0);
+        const std::set<const AbstractLoc *> &locs = reachableLocsForValue(**source);
+        for (std::set<const AbstractLoc *>::const_iterator loc = locs.begin(), lend = locs.end();
+             loc != lend; ++loc)
+          globals.push_back(GlobalPred(&getOrCreateConsElem(**loc), k));
+      }
+
+      SmallVector<unsigned, 4> sinks;
+      if (flow->sinkContext() == canon.context) {
+        for (FlowRecord::value_iterator sink = flow->sink_value_begin(), end = flow->sink_value_end();
+            sink != end; ++sink) {
+          DenseMap<const Value *, LocalSlot>::iterator local = localSlots.find(*sink);
+          if (local != localSlots.end() && local->second.first == &elems)
+            sinks.push_back(local->second.second);
+        }
+        for (FlowRecord::fun_iterator sink = flow->sink_varg_begin(), end = flow->sink_varg_end();
+            sink != end; ++sink)
+          if (*sink == &f) sinks.push_back(0);
+      }
+      for (SmallVector<unsigned, 4>::iterator sink = sinks.begin(), end = sinks.end();
+           sink != end; ++sink) {
+        localPreds[*sink].insert(localPreds[*sink].end(), locals.begin(), locals.end());
+        globalPreds[*sink].insert(globalPreds[*sink].end(), globals.begin(), globals.end());
+      }
+    }
+
+    // Search back from each return, through the least kinds possible
+    std::vector<unsigned> reached(numSlots);
+    for (Function::const_iterator bb = f.begin(), end = f.end(); bb != end; ++bb) {
+      const ReturnInst *ret = dyn_cast<ReturnInst>(bb->getTerminator());
+      if (!ret) continue;
+
+      std::fill(reached.begin(), reached.end(), 0);
+      std::vector<LocalPred> workList;
+      const unsigned retSlot = localSlots[ret].second;
+      reached[retSlot] = 1;
+      workList.push_back(LocalPred(retSlot, 0));
+      while (!workList.empty()) {
+        LocalPred cur = workList.back();
+        workList.pop_back();
+        const std::vector<LocalPred> &preds = localPreds[cur.first];
+        for (std::vector<LocalPred>::const_iterator pred = preds.begin(), pend = preds.end();
+             pred != pend; ++pred) {
+          unsigned k = cur.second | pred->second;
+          if (coveredKind(reached[pred->first], k)) continue;
+          reached[pred->first] |= 1u << k;
+          workList.push_back(LocalPred(pred->first, k));
+        }
+      }
+
+      CanonicalInstance::Transfer transfers[4];
+      std::set<const ConsElem *> globals[4];
+      for (unsigned slot = 0; slot != numSlots; ++slot) {
+        for (unsigned k = 0; k != 4; ++k) {
+          // Only the least kinds it is reached through matter
+          if (!(reached[slot] & (1u << k)) ||
+              coveredKind(reached[slot] & ~(1u << k), k)) continue;
+          if (slot == 0)
+            transfers[k].varargs = true;
+          else if (isa<Argument>(values[slot]) || values[slot] == &f.getEntryBlock())
+            transfers[k].inputs.push_back(values[slot]);
+          const std::vector<GlobalPred> &preds = globalPreds[slot];
+          for (std::vector<GlobalPred>::const_iterator pred = preds.begin(), pend = preds.end();
+               pred != pend; ++pred)
+            globals[k | pred->second].insert(pred->first);
+          // Contexts get the summary source of the return itself on their own
+          if (slot != retSlot)
+            globals[k].insert(&getOrCreateConsElemSummarySource(*values[slot]));
+        }
+      }
+
+      for (unsigned k = 0; k != 4; ++k) {
+        CanonicalInstance::Transfer &transfer = transfers[k];
+        transfer.ret = ret;
+        transfer.kind = k;
+        transfer.base = NULL;
+        if (!globals[k].empty()) {
+          const ConsElem &base = kit->newVar("canonical return");
+          for (std::set<const ConsElem *>::iterator global = globals[k].begin(),
+               gend = globals[k].end(); global != gend; ++global)
+            kit->addConstraint(kindFromImplicitSink(k & 1, k & 2), **global, base);
+          transfer.base = &base;
+        }
+        if (transfer.base || transfer.varargs || !transfer.inputs.empty())
+          canon.transfers.push_back(transfer);
+      }
+    }
+}
+
+/// Connects the interface of the function in the given context to its
+/// canonical instance.
+void
+Infoflow::instantiateCanonicalInstance(const Function &f, const CanonicalInstance &canon, const ContextID ctxt) {
+    for (Function::const_arg_iterator arg = f.arg_begin(), end = f.arg_end();
+         arg != end; ++arg)
+      kit->addConstraint("default", getOrCreateConsElem(ctxt, *arg),
+                         getOrCreateConsElem(canon.context, *arg));
+    kit->addConstraint("default", getOrCreateConsElem(ctxt, f.getEntryBlock()),
+                       getOrCreateConsElem(canon.context, f.getEntryBlock()));
+    if (f.isVarArg())
+      kit->addConstraint("default", getOrCreateVargConsElem(ctxt, f),
+                         getOrCreateVargConsElem(canon.context, f));
+
+    for (std::vector<CanonicalInstance::Transfer>::const_iterator transfer = canon.transfers.begin(),
+         end = canon.transfers.end(); transfer != end; ++transfer) {
+      const ConsElem &ret = getOrCreateConsElem(ctxt, *transfer->ret);
+      const std::string kind = kindFromImplicitSink(transfer->kind & 1, transfer->kind & 2);
+      if (transfer->base)
+        kit->addConstraint("default", *transfer->base, ret);
+      if (transfer->varargs)
+        kit->addConstraint(kind, getOrCreateVargConsElem(ctxt, f), ret);
+      for (SmallVector<const Value *, 4>::const_iterator input = transfer->inputs.begin(),
+           iend = transfer->inputs.end(); input != iend; ++input)
+        kit->addConstraint(kind, getOrCreateConsElem(ctxt, **input), ret);
+    }
+}
+
+void
+Infoflow::clearCanonicalInstances() {
+  for (DenseMap<const Function *, CanonicalInstance *>::iterator canon = canonicalInstances.begin(),
+       end = canonicalInstances.end(); canon != end; ++canon)
+    delete canon->second;
+  canonicalInstances.clear();
+}
+
+/// Computes the flows of a function without requesting callees, including
+/// the signature flows of external callees.
+void
+Infoflow::getFunctionFlows(const Function& f, Flows &flows) {
+    for (Function::const_iterator bb = f.begin(), end = f.end(); bb != end; ++bb) {
+      for (BasicBlock::const_iterator inst = bb->begin(), iend = bb->end(); inst != iend; ++inst) {
+        getInstructionFlowsInternal(*inst, false, flows);
+      }
+    }
+}
+
 void
 Infoflow::generateBasicBlockConstraints(const BasicBlock & bb, Flows & flows) {
     // Build constraints for instructions
@@ -653,40 +1278,58 @@ Infoflow::constrainMemoryLocation(bool implicit, bool sink, const Value & value,
 
 void
 Infoflow::constrainReachableMemoryLocations(bool implicit, bool sink, const Value & value, const ConsElem & level) {
-    const std::set<const AbstractLoc *> & locs = reachableLocsForValue(value);
-    for (std::set<const AbstractLoc *>::iterator loc = locs.begin(), end = locs.end();
-            loc != end ; ++loc) {
-      putOrConstrainConsElem(implicit, sink, **loc, level);
+    const ReachableSetID id = pti->getReachableSetIDForValue(&value);
+    const std::set<const AbstractLoc *> & locs = *pti->getReachableAbstractLocSet(id);
+    if (locs.size() < 2) {
+      for (std::set<const AbstractLoc *>::iterator loc = locs.begin(), end = locs.end();
+              loc != end ; ++loc) {
+        putOrConstrainConsElem(implicit, sink, **loc, level);
+      }
+      return;
+    }
+
+    // Constrain the locations once per set and kind, through a variable
+    // below all of them
+    const ConsElem *&bound = reachableBoundMap[implicit * 2 + sink][id];
+    if (!bound) {
+      bound = &kit->newVar("reachable locations");
+      for (std::set<const AbstractLoc *>::iterator loc = locs.begin(), end = locs.end();
+              loc != end ; ++loc) {
+        putOrConstrainConsElem(implicit, sink, **loc, *bound);
+      }
     }
+    kit->addConstraint(kindFromImplicitSink(implicit,sink), level, *bound);
 }
 
 const ConsElem &
 Infoflow::getOrCreateMemoryConsElem(const Value & value) {
-    const ConsElem *join = NULL;
+    // Join all the locations at once, rather than building a chain of
+    // ever larger intermediate joins (no locations gives low)
+    std::set<const ConsElem *> elems;
     const std::set<const AbstractLoc *> & locs = locsForValue(value);
     for (std::set<const AbstractLoc *>::iterator loc = locs.begin(), end = locs.end();
             loc != end ; ++loc) {
-        if (join == NULL) {
-            join = &getOrCreateConsElem(**loc);
-        } else {
-            join = &kit->upperBound(*join, getOrCreateConsElem(**loc));
-        }
+        elems.insert(&getOrCreateConsElem(**loc));
     }
-    return *join;
+    return kit->upperBound(elems);
 }
 
 const ConsElem &
 Infoflow::getOrCreateReachableMemoryConsElem(const Value & value) {
-    const ConsElem *join = NULL;
-    const std::set<const AbstractLoc *> & locs = reachableLocsForValue(value);
+    // Values with the same reachable set share its join
+    const ReachableSetID id = pti->getReachableSetIDForValue(&value);
+    const ConsElem *&join = reachableJoinMap[id];
+    if (join) return *join;
+
+    // Join all the locations at once, rather than building a chain of
+    // ever larger intermediate joins (no locations gives low)
+    std::set<const ConsElem *> elems;
+    const std::set<const AbstractLoc *> & locs = *pti->getReachableAbstractLocSet(id);
     for (std::set<const AbstractLoc *>::iterator loc = locs.begin(), end = locs.end();
             loc != end ; ++loc) {
-        if (join == NULL) {
-            join = &getOrCreateConsElem(**loc);
-        } else {
-            join = &kit->upperBound(*join, getOrCreateConsElem(**loc));
-        }
+        elems.insert(&getOrCreateConsElem(**loc));
     }
+    join = &kit->upperBound(elems);
     return *join;
 }
 
@@ -719,32 +1362,43 @@ Infoflow::operandsAndPCtoValue(const Instruction & inst, Flows &flows) {
 
 void
 Infoflow::constrainConditionalSuccessors(const TerminatorInst & term, FlowRecord & rec) {
-    std::set<const BasicBlock *> visited;
-    std::deque<const BasicBlock *> workqueue;
-    const BasicBlock *bb = term.getParent();
-
-    for (unsigned i = 0, end = term.getNumSuccessors(); i < end; ++i) {
-        workqueue.push_back(term.getSuccessor(i));
-    }
-
-    PostDominatorTree &pdt = getAnalysis<PDTCache>().get(term.getParent()->getParent());
-
-    while (!workqueue.empty()) {
-        const BasicBlock *cur = workqueue.front();
-        workqueue.pop_front();
-        visited.insert(cur);
-
-        if (!pdt.dominates(cur, bb)) {
-            rec.addSinkValue(*cur);
+    // A lone successor post-dominates the block
+    if (!DepsImplicitFlows || term.getNumSuccessors() < 2)
+        return;
+
+    const BasicBlock &bb = *term.getParent();
+    const ControlDependence::BlockList &blocks =
+      getOrCreateControlDependence(*bb.getParent()).dependents(bb);
+    rec.addSinkValue(blocks.begin(), blocks.end());
+}
+
+/// May be called from the threads preparing units. Two threads asking for
+/// the same function may both build it, but only one is kept.
+const ControlDependence &
+Infoflow::getOrCreateControlDependence(const Function &fun) {
+    ::pthread_mutex_lock(&controlDepsLock);
+    DenseMap<const Function *, const ControlDependence *>::iterator entry =
+      controlDeps.find(&fun);
+    const ControlDependence *cd = entry == controlDeps.end() ? 0 : entry->second;
+    ::pthread_mutex_unlock(&controlDepsLock);
+    if (cd) return *cd;
+
+    ControlDependence *built = new ControlDependence(fun, pdtCache->get(&fun));
+    ::pthread_mutex_lock(&controlDepsLock);
+    const ControlDependence *&slot = controlDeps[&fun];
+    if (slot) delete built;
+    else slot = built;
+    cd = slot;
+    ::pthread_mutex_unlock(&controlDepsLock);
+    return *cd;
+}
 
-            const TerminatorInst *t = cur->getTerminator();
-            for (unsigned i = 0, end = t->getNumSuccessors(); i < end; ++i) {
-              if (visited.find(cur) == visited.end()) {
-                workqueue.push_back(t->getSuccessor(i));
-              }
-            }
-        }
-    }
+void
+Infoflow::clearControlDependence() {
+  for (DenseMap<const Function *, const ControlDependence *>::iterator cd = controlDeps.begin(),
+       end = controlDeps.end(); cd != end; ++cd)
+    delete cd->second;
+  controlDeps.clear();
 }
 
 Flows
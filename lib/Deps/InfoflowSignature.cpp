@@ -18,6 +18,8 @@
 #include "InfoflowSignature.h"
 #include "FlowRecord.h"
 
+#include "llvm/Module.h"
+
 namespace deps {
 
 using namespace llvm;
@@ -36,8 +38,26 @@ SignatureRegistrar::registerSignature(const SigInfo si) {
   sigs.push_back(si.makeSignature());
 }
 
+void
+SignatureRegistrar::compile(const Module &M) {
+  for (Module::const_iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    for (sig_iterator sig = sigs.begin(), end = sigs.end(); sig != end; ++sig) {
+      Signature::CalleeAccept accepts = (*sig)->acceptCallee(*F);
+      if (accepts == Signature::RejectsCallee) continue;
+      // Otherwise the first signature to accept depends on the call site
+      if (accepts == Signature::AcceptsCallee) calleeSigs[&*F] = *sig;
+      break;
+    }
+  }
+}
+
 std::vector<FlowRecord>
 SignatureRegistrar::process(const ContextID ctxt, const ImmutableCallSite cs) {
+  if (const Function *F = cs.getCalledFunction()) {
+    DenseMap<const Function *, const Signature *>::const_iterator sig = calleeSigs.find(F);
+    if (sig != calleeSigs.end()) return sig->second->process(ctxt, cs);
+  }
+
   for (sig_iterator sig = sigs.begin(), end = sigs.end(); sig != end; ++sig) {
     if ((*sig)->accept(ctxt, cs)) {
       return (*sig)->process(ctxt, cs);
@@ -103,6 +103,11 @@ NoFlows::process(const ContextID ctxt, const ImmutableCallSite cs) const {
   return std::vector<FlowRecord>();
 }
 
+Signature::CalleeAccept
+OverflowChecks::acceptCallee(const Function &F) const {
+  return F.getName().startswith("____jf_check") ? AcceptsCallee : RejectsCallee;
+}
+
 bool
 OverflowChecks::accept(const ContextID ctxt, const ImmutableCallSite cs) const {
   const Function * F = cs.getCalledFunction();
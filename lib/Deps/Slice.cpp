@@ -12,6 +12,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "Slice.h"
+#include "SolutionFile.h"
 
 #include <sstream>
 
@@ -68,6 +69,10 @@ Slice::Slice(Infoflow & info,
   std::set<std::string> sinkKinds;
   sinkKinds.insert(sinkKind);
   backward = infoflow.greatestSolution(sinkKinds, false);
+
+  // Slices are usually asked about every value of the module
+  forward->precompute();
+  backward->precompute();
 }
 
 Slice::~Slice() {
@@ -95,6 +100,13 @@ Slice::vargInSlice(const Function & fun) {
   return forward->isVargTainted(fun) && !backward->isVargTainted(fun);
 }
 
+bool
+Slice::writeSolutionFile(StringRef path, const ValueNumbering & numbering,
+                         std::string & error) {
+  return SolutionFile::write(path, numbering, infoflow, *forward, *backward,
+                             error);
+}
+
 bool
 MultiSlice::sourceReachable(const Value *Overflow, const FlowRecord & record) {
   assert(forward.count(Overflow));
@@ -129,6 +141,11 @@ MultiSlice::MultiSlice(Infoflow & info, InfoflowSolution *backward,
 		       bool cutSinks) : cutAfterSinks(cutSinks), infoflow(info), backward(backward) {
   std::string sourceKindPrefix = kindPrefix + "-sources";
 
+  // The backward solution is shared by every source, so it pays to solve
+  // all of its locations up front. The forward ones are only asked about
+  // by sourceReachable, which touches a few values.
+  backward->precompute();
+
   // Give each overflow a unique id, even across MultiSlice objects.
   static uint64_t unique_id = 0;
 
@@ -0,0 +1,377 @@
+//===- SliceBench.cpp -------------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The deps-slice-bench pass runs one Slice and one MultiSlice over the
+// sources and sinks SourceSinkAnalysis finds, the way a client would, and
+// adds checksums of their answers to the -deps-time-report. Two runs give
+// the same checksums exactly when every query gave the same answer, so the
+// report shows both how fast a change is and that it changed no results.
+// test/bench runs it over the benchmark programs.
+//
+// With -deps-bench-write-solution the Slice is also written to a
+// SolutionFile; with -deps-bench-read-solution the Slice queries are
+// answered from such a file instead, without running the analysis, and
+// must give the same "slice" checksum.
+//
+// The MultiSlice is also solved with solveLabels, a label per source, and
+// the "mismatches multislice labels" counter is the number of queries on
+// which the two disagree, which must be zero.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Infoflow.h"
+#include "Slice.h"
+#include "SolutionFile.h"
+#include "SourceSinkAnalysis.h"
+#include "ValueNumbering.h"
+#include "Constraints/PhaseReport.h"
+
+#include "llvm/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Type.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace deps;
+
+static cl::opt<unsigned> DepsBenchMaxSources(
+  "deps-bench-max-sources", cl::desc("Solve a MultiSlice for at most this many of the sources (0 = all)"),
+  cl::init(64));
+
+static cl::opt<std::string> DepsBenchWriteSolution(
+  "deps-bench-write-solution", cl::desc("Write the Slice's solutions to this solution file"),
+  cl::value_desc("file"));
+
+static cl::opt<std::string> DepsBenchReadSolution(
+  "deps-bench-read-solution", cl::desc("Answer the Slice queries from this solution file instead of running the analysis"),
+  cl::value_desc("file"));
+
+namespace {
+
+/// 64-bit FNV-1a over the answers to a sequence of queries
+class Checksum {
+public:
+  Checksum() : hash(14695981039346656037ULL), answers(0) {}
+
+  void add(unsigned char bits) {
+    hash = (hash ^ bits) * 1099511628211ULL;
+    if (bits) ++answers;
+  }
+
+  uint64_t value() const { return hash; }
+  /// Queries answered with anything but "not in the slice"
+  uint64_t inSlice() const { return answers; }
+
+private:
+  uint64_t hash;
+  uint64_t answers;
+};
+
+class SliceBench : public ModulePass {
+public:
+  static char ID;
+
+  SliceBench() : ModulePass(ID) {}
+
+  virtual bool runOnModule(Module &M);
+
+  virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+    // A solution file answers the queries without any of the analyses
+    if (DepsBenchReadSolution.empty()) {
+      AU.addRequired<Infoflow>();
+      AU.addRequired<SourceSinkAnalysis>();
+    }
+    AU.setPreservesAll();
+  }
+
+private:
+  void runFromFile(Module &M);
+  void record(const std::string &name, const Checksum &sum) const;
+};
+
+/// The queries asked of each value: whether it is in the slice, and for
+/// pointers whether the locations it points to (or reaches) are.
+template <class AskFn>
+static void checksumModule(Module &M, AskFn &ask, Checksum &sum) {
+  for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
+    if (F->isDeclaration()) continue;
+    for (Function::arg_iterator A = F->arg_begin(), AE = F->arg_end();
+         A != AE; ++A)
+      sum.add(ask(*A));
+    for (Function::iterator B = F->begin(), BE = F->end(); B != BE; ++B)
+      for (BasicBlock::iterator I = B->begin(), IE = B->end(); I != IE; ++I)
+        sum.add(ask(*I));
+    if (F->isVarArg())
+      sum.add(ask.varg(*F));
+  }
+}
+
+/// The value sources of the record, in module order rather than in the
+/// record's (address) order, so that runs agree on which ones come first
+static void orderedSources(Module &M, const FlowRecord &record,
+                           std::vector<const Value *> &sources) {
+  DenseSet<const Value *> isSource;
+  for (FlowRecord::value_iterator V = record.source_value_begin(),
+       VE = record.source_value_end(); V != VE; ++V)
+    isSource.insert(*V);
+
+  for (Module::global_iterator G = M.global_begin(), GE = M.global_end();
+       G != GE; ++G)
+    if (isSource.count(&*G)) sources.push_back(&*G);
+  for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
+    for (Function::arg_iterator A = F->arg_begin(), AE = F->arg_end();
+         A != AE; ++A)
+      if (isSource.count(&*A)) sources.push_back(&*A);
+    for (Function::iterator B = F->begin(), BE = F->end(); B != BE; ++B)
+      for (BasicBlock::iterator I = B->begin(), IE = B->end(); I != IE; ++I)
+        if (isSource.count(&*I)) sources.push_back(&*I);
+  }
+}
+
+struct AskSlice {
+  explicit AskSlice(Slice &slice) : slice(slice) {}
+
+  unsigned char operator()(const Value &V) const {
+    unsigned char bits = slice.valueInSlice(V);
+    if (V.getType()->isPointerTy()) {
+      bits |= slice.directPtrInSlice(V) << 1;
+      bits |= slice.reachPtrInSlice(V) << 2;
+    }
+    return bits;
+  }
+  unsigned char varg(const Function &F) const { return slice.vargInSlice(F); }
+
+  Slice &slice;
+};
+
+/// The Slice queries, answered by the solutions of a SolutionFile the
+/// Slice was written to
+struct AskMappedSlice {
+  AskMappedSlice(const MappedSolution &forward, const MappedSolution &backward)
+    : forward(forward), backward(backward) {}
+
+  unsigned char operator()(const Value &V) const {
+    unsigned char bits = forward.isTainted(V) && !backward.isTainted(V);
+    if (V.getType()->isPointerTy()) {
+      bits |= (forward.isDirectPtrTainted(V) &&
+               !backward.isDirectPtrTainted(V)) << 1;
+      bits |= (forward.isReachPtrTainted(V) &&
+               !backward.isReachPtrTainted(V)) << 2;
+    }
+    return bits;
+  }
+  unsigned char varg(const Function &F) const {
+    return forward.isVargTainted(F) && !backward.isVargTainted(F);
+  }
+
+  const MappedSolution &forward;
+  const MappedSolution &backward;
+};
+
+/// Whether a MultiSlice and the label solution of the same source give
+/// different answers
+struct AskLabelMismatch {
+  AskLabelMismatch(MultiSlice &slice, const Value *source,
+                   InfoflowSolution &label, InfoflowSolution &backward)
+    : slice(slice), source(source), label(label), backward(backward) {}
+
+  unsigned char operator()(const Value &V) const {
+    bool differ = slice.valueInSlice(V, source) !=
+                  (label.isTainted(V) && !backward.isTainted(V));
+    if (V.getType()->isPointerTy()) {
+      differ |= slice.directPtrInSlice(V, source) !=
+                (label.isDirectPtrTainted(V) && !backward.isDirectPtrTainted(V));
+      differ |= slice.reachPtrInSlice(V, source) !=
+                (label.isReachPtrTainted(V) && !backward.isReachPtrTainted(V));
+    }
+    return differ;
+  }
+  unsigned char varg(const Function &F) const {
+    return slice.vargInSlice(F, source) !=
+           (label.isVargTainted(F) && !backward.isVargTainted(F));
+  }
+
+  MultiSlice &slice;
+  const Value *source;
+  InfoflowSolution &label;
+  InfoflowSolution &backward;
+};
+
+struct AskMultiSlice {
+  AskMultiSlice(MultiSlice &slice, const Value *source)
+    : slice(slice), source(source) {}
+
+  unsigned char operator()(const Value &V) const {
+    unsigned char bits = slice.valueInSlice(V, source);
+    if (V.getType()->isPointerTy()) {
+      bits |= slice.directPtrInSlice(V, source) << 1;
+      bits |= slice.reachPtrInSlice(V, source) << 2;
+    }
+    return bits;
+  }
+  unsigned char varg(const Function &F) const {
+    return slice.vargInSlice(F, source);
+  }
+
+  MultiSlice &slice;
+  const Value *source;
+};
+
+} // end anonymous namespace
+
+char SliceBench::ID = 0;
+
+static RegisterPass<SliceBench>
+X ("deps-slice-bench", "Time Slice and MultiSlice queries and checksum their answers", true, true);
+
+void
+SliceBench::record(const std::string &name, const Checksum &sum) const {
+  PhaseReport &report = PhaseReport::get();
+  report.addCount("checksum " + name, sum.value());
+  report.addCount("in " + name, sum.inSlice());
+}
+
+void
+SliceBench::runFromFile(Module &M) {
+  OwningPtr<ValueNumbering> numbering;
+  OwningPtr<SolutionFile> file;
+  std::string error;
+  {
+    PhaseTimer T("bench map solution");
+    numbering.reset(new ValueNumbering(M));
+    file.reset(SolutionFile::open(DepsBenchReadSolution, *numbering, error));
+  }
+  if (!file) {
+    errs() << "Cannot read solution: " << error << "\n";
+    return;
+  }
+
+  MappedSolution forward(*file, SolutionFile::Least, *numbering);
+  MappedSolution backward(*file, SolutionFile::Greatest, *numbering);
+  Checksum sum;
+  {
+    PhaseTimer T("bench mapped slice queries");
+    AskMappedSlice ask(forward, backward);
+    checksumModule(M, ask, sum);
+  }
+  record("slice", sum);
+}
+
+bool
+SliceBench::runOnModule(Module &M) {
+  if (!DepsBenchReadSolution.empty()) {
+    runFromFile(M);
+    return false;
+  }
+
+  Infoflow &infoflow = getAnalysis<Infoflow>();
+  const FlowRecord &sourcesAndSinks =
+    getAnalysis<SourceSinkAnalysis>().getSourcesAndSinks();
+
+  // MultiSlice needs both default kinds solved up front
+  {
+    PhaseTimer T("bench solve defaults");
+    infoflow.solveMT("default");
+    infoflow.solveMT("default-sinks");
+  }
+
+  // One MultiSlice lane per value source
+  std::vector<const Value *> sources;
+  orderedSources(M, sourcesAndSinks, sources);
+  if (DepsBenchMaxSources && sources.size() > DepsBenchMaxSources)
+    sources.resize(DepsBenchMaxSources);
+  PhaseReport::get().addCount("multislice sources", sources.size());
+
+  // Every solution is asked for before any query, so that with
+  // -deps-compact-after-solve the queries run on compacted solutions
+  OwningPtr<Slice> slice;
+  {
+    PhaseTimer T("bench slice solve");
+    slice.reset(new Slice(infoflow, "bench", sourcesAndSinks, false));
+  }
+
+  // multi borrows backward, and so is declared (and destroyed) after it
+  OwningPtr<InfoflowSolution> backward;
+  OwningPtr<MultiSlice> multi;
+  if (!sources.empty()) {
+    PhaseTimer T("bench multislice solve");
+    std::set<std::string> sinkKinds;
+    sinkKinds.insert("bench-sinks");
+    backward.reset(infoflow.greatestSolution(sinkKinds, false));
+    multi.reset(new MultiSlice(infoflow, backward.get(), "bench-multi",
+                               sourcesAndSinks, sources, false));
+  }
+
+  // The MultiSlice's forward solutions again, from one propagation of a
+  // label per source
+  std::vector<InfoflowSolution *> labels;
+  if (!sources.empty()) {
+    PhaseTimer T("bench multislice label solve");
+    for (unsigned i = 0, e = sources.size(); i != e; ++i)
+      infoflow.setLabelTainted(i, *sources[i]);
+    labels = infoflow.solveLabels(true);
+  }
+
+  if (infoflow.compactAfterSolve())
+    infoflow.compactSolverState();
+
+  {
+    Checksum sum;
+    {
+      PhaseTimer T("bench slice queries");
+      AskSlice ask(*slice);
+      checksumModule(M, ask, sum);
+    }
+    record("slice", sum);
+  }
+
+  if (!DepsBenchWriteSolution.empty()) {
+    PhaseTimer T("bench write solution");
+    ValueNumbering numbering(M);
+    std::string error;
+    if (!slice->writeSolutionFile(DepsBenchWriteSolution, numbering, error))
+      errs() << "Cannot write solution: " << error << "\n";
+  }
+
+  if (multi) {
+    Checksum sum;
+    {
+      PhaseTimer T("bench multislice queries");
+      for (std::vector<const Value *>::const_iterator S = sources.begin(),
+           E = sources.end(); S != E; ++S) {
+        AskMultiSlice ask(*multi, *S);
+        checksumModule(M, ask, sum);
+      }
+    }
+    record("multislice", sum);
+
+    Checksum mismatches;
+    {
+      PhaseTimer T("bench multislice label queries");
+      for (unsigned i = 0, e = sources.size(); i != e; ++i) {
+        AskLabelMismatch ask(*multi, sources[i], *labels[i], *backward);
+        checksumModule(M, ask, mismatches);
+      }
+    }
+    PhaseReport::get().addCount("mismatches multislice labels",
+                                mismatches.inSlice());
+  }
+
+  for (unsigned i = 0, e = labels.size(); i != e; ++i)
+    delete labels[i];
+
+  return false;
+}
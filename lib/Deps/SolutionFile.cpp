@@ -0,0 +1,240 @@
+//===- SolutionFile.cpp -----------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Writing and memory-mapping solution files.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SolutionFile.h"
+#include "Infoflow.h"
+#include "ValueNumbering.h"
+
+#include "llvm/Function.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace deps {
+
+static const char Magic[8] = { 'D', 'E', 'P', 'S', 'S', 'O', 'L', 'N' };
+static const uint32_t Version = 1;
+// Reads back differently on a host of the other byte order
+static const uint32_t ByteOrderMark = 0x01020304;
+
+// Followed by the bitmaps, each a whole number of 64-bit words: for Least
+// then Greatest, ValueBits, DirectPtrBits and ReachPtrBits over the values
+// and VargBits over the functions.
+struct SolutionFile::Header {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t ByteOrder;
+  uint64_t Fingerprint;
+  uint32_t NumValues;
+  uint32_t NumFunctions;
+};
+
+static size_t wordsFor(unsigned Bits) {
+  return (Bits + 63) / 64;
+}
+
+static void set(std::vector<uint64_t> &Words, size_t Offset, unsigned ID) {
+  Words[Offset + ID / 64] |= uint64_t(1) << (ID % 64);
+}
+
+// Is any of the locations tainted? Remembers the answer for each location.
+static bool anyTainted(InfoflowSolution &S, const AbstractLocSet &Locs,
+                       DenseMap<const AbstractLoc *, bool> &Tainted) {
+  for (AbstractLocSet::const_iterator I = Locs.begin(), E = Locs.end();
+       I != E; ++I) {
+    DenseMap<const AbstractLoc *, bool>::iterator Known = Tainted.find(*I);
+    if (Known == Tainted.end())
+      Known = Tainted.insert(std::make_pair(*I, S.isLocTainted(**I))).first;
+    if (Known->second) return true;
+  }
+  return false;
+}
+
+bool
+SolutionFile::write(StringRef Path, const ValueNumbering &VN,
+                    Infoflow &infoflow, InfoflowSolution &LeastSoln,
+                    InfoflowSolution &GreatestSoln, std::string &Error) {
+  Header H;
+  std::memset(&H, 0, sizeof(H));
+  std::memcpy(H.Magic, Magic, sizeof(Magic));
+  H.Version = Version;
+  H.ByteOrder = ByteOrderMark;
+  H.Fingerprint = VN.fingerprint();
+  H.NumValues = VN.numValues();
+  H.NumFunctions = VN.numFunctions();
+
+  size_t ValueWords = wordsFor(H.NumValues);
+  size_t FunctionWords = wordsFor(H.NumFunctions);
+  size_t SolutionWords = 3 * ValueWords + FunctionWords;
+  std::vector<uint64_t> Words(2 * SolutionWords);
+
+  for (unsigned W = Least; W <= Greatest; ++W) {
+    InfoflowSolution &S = W == Least ? LeastSoln : GreatestSoln;
+    size_t Offset = W * SolutionWords;
+    DenseMap<const AbstractLoc *, bool> LocTainted;
+
+    for (unsigned ID = 0, E = H.NumValues; ID != E; ++ID) {
+      const Value &V = *VN.value(ID);
+      if (S.isTainted(V))
+        set(Words, Offset, ID);
+      if (!V.getType()->isPointerTy()) continue;
+      if (anyTainted(S, infoflow.locsForValue(V), LocTainted))
+        set(Words, Offset + ValueWords, ID);
+      if (anyTainted(S, infoflow.reachableLocsForValue(V), LocTainted))
+        set(Words, Offset + 2 * ValueWords, ID);
+    }
+
+    for (unsigned ID = 0, E = H.NumFunctions; ID != E; ++ID) {
+      if (S.isVargTainted(*VN.function(ID)))
+        set(Words, Offset + 3 * ValueWords, ID);
+    }
+  }
+
+  raw_fd_ostream OS(Path.str().c_str(), Error, raw_fd_ostream::F_Binary);
+  if (!Error.empty()) return false;
+  OS.write((const char *)&H, sizeof(H));
+  if (!Words.empty())
+    OS.write((const char *)&Words[0], Words.size() * sizeof(uint64_t));
+  OS.close();
+  if (OS.has_error()) {
+    OS.clear_error();
+    Error = "error writing " + Path.str();
+    return false;
+  }
+  return true;
+}
+
+SolutionFile *
+SolutionFile::open(StringRef Path, const ValueNumbering &VN,
+                   std::string &Error) {
+  int FD = ::open(Path.str().c_str(), O_RDONLY);
+  if (FD < 0) {
+    Error = "cannot open " + Path.str();
+    return NULL;
+  }
+
+  struct stat Stat;
+  if (::fstat(FD, &Stat) || (size_t)Stat.st_size < sizeof(Header)) {
+    ::close(FD);
+    Error = Path.str() + " is not a solution file";
+    return NULL;
+  }
+
+  size_t Size = Stat.st_size;
+  void *Base = ::mmap(NULL, Size, PROT_READ, MAP_SHARED, FD, 0);
+  ::close(FD);
+  if (Base == MAP_FAILED) {
+    Error = "cannot map " + Path.str();
+    return NULL;
+  }
+
+  const Header &H = *(const Header *)Base;
+  bool Valid = !std::memcmp(H.Magic, Magic, sizeof(Magic)) &&
+               H.Version == Version && H.ByteOrder == ByteOrderMark &&
+               Size == sizeof(Header) + sizeof(uint64_t) *
+                       2 * (3 * wordsFor(H.NumValues) +
+                            wordsFor(H.NumFunctions));
+  if (!Valid) {
+    ::munmap(Base, Size);
+    Error = Path.str() + " is not a solution file";
+    return NULL;
+  }
+
+  // Answers for another module would be silently wrong
+  if (H.Fingerprint != VN.fingerprint() || H.NumValues != VN.numValues() ||
+      H.NumFunctions != VN.numFunctions()) {
+    ::munmap(Base, Size);
+    Error = Path.str() + " was written for a different module";
+    return NULL;
+  }
+
+  return new SolutionFile((const char *)Base, Size);
+}
+
+SolutionFile::SolutionFile(const char *Base, size_t Size)
+  : Base(Base), Size(Size) {
+  const Header &H = *(const Header *)Base;
+  size_t ValueWords = wordsFor(H.NumValues);
+  const uint64_t *Words = (const uint64_t *)(Base + sizeof(Header));
+
+  for (unsigned W = Least; W <= Greatest; ++W) {
+    for (unsigned B = ValueBits; B != NumBitmaps; ++B) {
+      Bits[W][B] = Words;
+      Words += B == VargBits ? wordsFor(H.NumFunctions) : ValueWords;
+    }
+  }
+}
+
+SolutionFile::~SolutionFile() {
+  ::munmap((void *)Base, Size);
+}
+
+uint64_t
+SolutionFile::fingerprint() const {
+  return ((const Header *)Base)->Fingerprint;
+}
+
+unsigned
+SolutionFile::numValues() const {
+  return ((const Header *)Base)->NumValues;
+}
+
+unsigned
+SolutionFile::numFunctions() const {
+  return ((const Header *)Base)->NumFunctions;
+}
+
+MappedSolution::MappedSolution(const SolutionFile &File,
+                               SolutionFile::Which W,
+                               const ValueNumbering &VN)
+  : File(File), W(W), VN(VN) {
+  assert(File.fingerprint() == VN.fingerprint() &&
+         File.numValues() == VN.numValues() &&
+         File.numFunctions() == VN.numFunctions() &&
+         "Solution file is for a different module!");
+}
+
+bool
+MappedSolution::isTainted(const Value &V) const {
+  unsigned ID = VN.valueID(V);
+  if (ID == ValueNumbering::None) return W == SolutionFile::Greatest;
+  return File.isTainted(W, ID);
+}
+
+bool
+MappedSolution::isDirectPtrTainted(const Value &V) const {
+  unsigned ID = VN.valueID(V);
+  return ID != ValueNumbering::None && File.isDirectPtrTainted(W, ID);
+}
+
+bool
+MappedSolution::isReachPtrTainted(const Value &V) const {
+  unsigned ID = VN.valueID(V);
+  return ID != ValueNumbering::None && File.isReachPtrTainted(W, ID);
+}
+
+bool
+MappedSolution::isVargTainted(const Function &F) const {
+  unsigned ID = VN.functionID(F);
+  if (ID == ValueNumbering::None) return W == SolutionFile::Greatest;
+  return File.isVargTainted(W, ID);
+}
+
+}
@@ -180,11 +180,8 @@ StdLib::initCalls() {
 
 // Helper to locate a matching entry, if any
 bool
-StdLib::findEntry(const ImmutableCallSite cs, const CallSummary *& S) const {
-  const Function *F = cs.getCalledFunction();
-  if (!F) return false;
-
-  StringRef Name = F->getName();
+StdLib::findEntry(const Function &F, const CallSummary *& S) const {
+  StringRef Name = F.getName();
 
   std::vector<const CallSummary*>::const_iterator I =
     std::lower_bound(Calls.begin(), Calls.end(), Name, NameSearch);
@@ -196,6 +193,30 @@ StdLib::findEntry(const ImmutableCallSite cs, const CallSummary *& S) const {
   return true;
 }
 
+// Same, but for the callee of a call site, which acceptCallee has usually
+// looked up already
+bool
+StdLib::findEntry(const ImmutableCallSite cs, const CallSummary *& S) const {
+  const Function *F = cs.getCalledFunction();
+  if (!F) return false;
+
+  DenseMap<const Function *, const CallSummary *>::const_iterator I =
+    CalleeCalls.find(F);
+  if (I != CalleeCalls.end()) {
+    S = I->second;
+    return S != NULL;
+  }
+  return findEntry(*F, S);
+}
+
+Signature::CalleeAccept
+StdLib::acceptCallee(const Function &F) const {
+  const CallSummary *S = NULL;
+  bool found = findEntry(F, S);
+  CalleeCalls[&F] = S;
+  return found ? AcceptsCallee : RejectsCallee;
+}
+
 // Helper to find the set of values described by a TSpecifier
 std::set<const Value*>
 getValues(const ImmutableCallSite cs, TSpecifier TS) {
@@ -0,0 +1,82 @@
+//===- ValueNumbering.cpp ---------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Stable numbering of the values of a module.
+//
+//===----------------------------------------------------------------------===//
+
+#include "ValueNumbering.h"
+
+#include "llvm/Function.h"
+#include "llvm/Module.h"
+
+namespace deps {
+
+// 64-bit FNV-1a, stable across runs and builds
+static const uint64_t FNVPrime = 1099511628211ULL;
+
+static uint64_t hashByte(uint64_t H, unsigned char Byte) {
+  return (H ^ Byte) * FNVPrime;
+}
+
+ValueNumbering::ValueNumbering(const Module &M)
+  : Fingerprint(14695981039346656037ULL) {
+  for (Module::const_global_iterator G = M.global_begin(), E = M.global_end();
+       G != E; ++G)
+    add(*G);
+  for (Module::const_alias_iterator A = M.alias_begin(), E = M.alias_end();
+       A != E; ++A)
+    add(*A);
+
+  for (Module::const_iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    FunctionIDs[&*F] = Functions.size();
+    Functions.push_back(&*F);
+
+    add(*F);
+    for (Function::const_arg_iterator A = F->arg_begin(), AE = F->arg_end();
+         A != AE; ++A)
+      add(*A);
+    for (Function::const_iterator BB = F->begin(), BE = F->end();
+         BB != BE; ++BB) {
+      add(*BB);
+      for (BasicBlock::const_iterator I = BB->begin(), IE = BB->end();
+           I != IE; ++I)
+        add(*I);
+    }
+  }
+}
+
+void
+ValueNumbering::add(const Value &V) {
+  ValueIDs[&V] = Values.size();
+  Values.push_back(&V);
+
+  Fingerprint = hashByte(Fingerprint, V.getValueID());
+  if (isa<GlobalValue>(V)) {
+    StringRef Name = V.getName();
+    for (StringRef::iterator I = Name.begin(), E = Name.end(); I != E; ++I)
+      Fingerprint = hashByte(Fingerprint, *I);
+    // Separates the name from whatever follows
+    Fingerprint = hashByte(Fingerprint, 0);
+  }
+}
+
+unsigned
+ValueNumbering::valueID(const Value &V) const {
+  DenseMap<const Value *, unsigned>::const_iterator I = ValueIDs.find(&V);
+  return I == ValueIDs.end() ? None : I->second;
+}
+
+unsigned
+ValueNumbering::functionID(const Function &F) const {
+  DenseMap<const Function *, unsigned>::const_iterator I = FunctionIDs.find(&F);
+  return I == FunctionIDs.end() ? None : I->second;
+}
+
+}
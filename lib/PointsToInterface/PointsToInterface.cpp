@@ -12,10 +12,13 @@
 //===----------------------------------------------------------------------===//
 
 #include "PointsToInterface.h"
+#include "Constraints/PhaseReport.h"
 
 #include "dsa/DSGraphTraits.h"
 #include "llvm/Module.h"
-#include "llvm/ADT/DepthFirstIterator.h"
+
+#include <algorithm>
+#include <iterator>
 
 namespace deps {
 
@@ -26,6 +29,11 @@ char PointsToInterface::ID;
 
 const AbstractLocSet PointsToInterface::EmptySet;
 
+PointsToInterface::~PointsToInterface() {
+  for (unsigned I = 0, E = ReachableLocSets.size(); I != E; ++I)
+    delete ReachableLocSets[I];
+}
+
 //
 // To preserve soundness, we need to go over the computed equivalence classes
 // and merge together those which contain incomplete DSNodes. We don't merge
@@ -63,9 +71,11 @@ void PointsToInterface::mergeAllIncomplete() {
 }
 
 bool PointsToInterface::runOnModule(Module &M) {
+  PhaseTimer T("points-to setup");
   EquivsAnalysis = &getAnalysis<DSNodeEquivs>();
   Classes = &EquivsAnalysis->getEquivalenceClasses();
   mergeAllIncomplete();
+  computeReachableSets();
 
   // Does not modify module.
   return false;
@@ -96,50 +106,188 @@ PointsToInterface::getAbstractLocSetForValue(const Value *V) {
 //
 const AbstractLocSet *
 PointsToInterface::getReachableAbstractLocSetForValue(const Value *V) {
+  return getReachableAbstractLocSet(getReachableSetIDForValue(V));
+}
+
+ReachableSetID
+PointsToInterface::getReachableSetIDForValue(const Value *V) {
   const DSNode *MergedLeader = getMergedLeaderForValue(V);
 
   // If the class for the value doesn't exist, return the empty set.
   if (MergedLeader == 0)
+    return EmptyReachableSetID;
+
+  DenseMap<const DSNode *, ReachableSetID>::iterator It =
+    ReachableSetForLeader.find(MergedLeader);
+  assert(It != ReachableSetForLeader.end() && "Reachable set not computed!");
+  return It->second;
+}
+
+const AbstractLocSet *
+PointsToInterface::getReachableAbstractLocSet(ReachableSetID ID) {
+  assert(ID < ReachableSets.size() && "Unknown reachable set!");
+  if (ID == EmptyReachableSetID)
     return &EmptySet;
 
-  // Check if the reachable set has been computed.
-  if (ReachablesForLeader.find(MergedLeader) != ReachablesForLeader.end())
-    return &ReachablesForLeader[MergedLeader];
+  // Build the set the first time it is asked for.
+  AbstractLocSet *&Result = ReachableLocSets[ID];
+  if (Result == 0) {
+    Result = new AbstractLocSet();
+    const LeaderIDSet &Set = *ReachableSets[ID];
+    for (LeaderIDSet::const_iterator I = Set.begin(), E = Set.end(); I != E; ++I)
+      Result->insert(LeaderForID[*I]);
+  }
+  return Result;
+}
 
-  // Otherwise, for each element in each equivalence class merged in with
-  // MergedLeader, we need to compute its reachable set.
-  AbstractLocSet ReachableSet;
+//
+// Return the dense ID of the merged leader of the given node's class.
+//
+unsigned
+PointsToInterface::getLeaderID(const DSNode *Node) {
+  const DSNode *ClassLeader = Classes->getLeaderValue(Node);
+  const DSNode *MergedLeader = MergedLeaders.getLeaderValue(ClassLeader);
+  std::pair<DenseMap<const DSNode *, unsigned>::iterator, bool> Entry =
+    IDForLeader.insert(std::make_pair(MergedLeader, LeaderForID.size()));
+  if (Entry.second)
+    LeaderForID.push_back(MergedLeader);
+  return Entry.first->second;
+}
 
-  EquivalenceClasses<const DSNode *>::member_iterator
-    MIt = MergedLeaders.member_begin(MergedLeaders.findValue(MergedLeader)),
-    MItEnd = MergedLeaders.member_end();
+ReachableSetID
+PointsToInterface::internReachableSet(const LeaderIDSet &Set) {
+  std::pair<std::map<LeaderIDSet, ReachableSetID>::iterator, bool> Entry =
+    IDForReachableSet.insert(std::make_pair(Set, ReachableSets.size()));
+  if (Entry.second) {
+    ReachableSets.push_back(&Entry.first->first);
+    ReachableLocSets.push_back(0);
+  }
+  return Entry.first->second;
+}
+
+//
+// Computes the reachable set of every merged leader up front, so queries
+// are a lookup. The set of a node is the merged leaders of the nodes
+// reachable from it; the nodes of a strongly connected component of the
+// DSNode graph share theirs, and it's the union of the sets of the
+// components it points to. Components are found with an iterative Tarjan
+// walk, which finishes each after those it points to. The set of a merged
+// leader is the union of those of all the nodes in the classes merged into
+// it.
+//
+void PointsToInterface::computeReachableSets() {
+  typedef GraphTraits<const DSNode *> GT;
 
-  for (; MIt != MItEnd; ++MIt) {
-    const DSNode *Leader = *MIt;
+  // The empty set is always EmptyReachableSetID.
+  internReachableSet(LeaderIDSet());
 
-    EquivalenceClasses<const DSNode *>::member_iterator
-      ClassesIt = Classes->member_begin(Classes->findValue(Leader)),
-      ClassesItEnd = Classes->member_end();
+  // The Tarjan index of each node seen, where it was pushed on Stack, and
+  // the set of each node finished.
+  DenseMap<const DSNode *, unsigned> Index;
+  DenseMap<const DSNode *, unsigned> LowLink;
+  DenseMap<const DSNode *, unsigned> StackDepth;
+  DenseMap<const DSNode *, ReachableSetID> SetForNode;
+  std::vector<const DSNode *> Stack;
+  std::vector<std::pair<const DSNode *, GT::ChildIteratorType> > Visit;
+
+  EquivalenceClasses<const DSNode *>::iterator EqIt = Classes->begin();
+  EquivalenceClasses<const DSNode *>::iterator EqItEnd = Classes->end();
+  for (; EqIt != EqItEnd; ++EqIt) {
+    const DSNode *Root = EqIt->getData();
+    if (Index.count(Root))
+      continue;
 
-    for (; ClassesIt != ClassesItEnd; ++ClassesIt) {
-      const DSNode *Node = *ClassesIt;
-      findReachableAbstractLocSetForNode(ReachableSet, Node);
+    unsigned Number = Index.size();
+    Index[Root] = LowLink[Root] = Number;
+    StackDepth[Root] = Stack.size();
+    Stack.push_back(Root);
+    Visit.push_back(std::make_pair(Root, GT::child_begin(Root)));
+
+    while (!Visit.empty()) {
+      const DSNode *Node = Visit.back().first;
+      GT::ChildIteratorType &Child = Visit.back().second;
+
+      if (Child != GT::child_end(Node)) {
+        const DSNode *Next = *Child;
+        ++Child;
+        if (Next == 0)
+          continue;
+        DenseMap<const DSNode *, unsigned>::iterator Seen = Index.find(Next);
+        if (Seen == Index.end()) {
+          Number = Index.size();
+          Index[Next] = LowLink[Next] = Number;
+          StackDepth[Next] = Stack.size();
+          Stack.push_back(Next);
+          Visit.push_back(std::make_pair(Next, GT::child_begin(Next)));
+        } else if (!SetForNode.count(Next)) {
+          // Still on the stack
+          LowLink[Node] = std::min(LowLink[Node], Seen->second);
+        }
+        continue;
+      }
+
+      Visit.pop_back();
+      if (!Visit.empty()) {
+        const DSNode *Parent = Visit.back().first;
+        LowLink[Parent] = std::min(LowLink[Parent], LowLink[Node]);
+      }
+      if (LowLink[Node] != Index[Node])
+        continue;
+
+      // Node is the root of a component: pop it, and join the sets of the
+      // components it points to, which are all finished.
+      std::vector<const DSNode *>::iterator First =
+        Stack.begin() + StackDepth[Node];
+      LeaderIDSet Set, Merged;
+      std::vector<ReachableSetID> Children;
+      for (std::vector<const DSNode *>::iterator M = First, E = Stack.end();
+           M != E; ++M) {
+        Set.push_back(getLeaderID(*M));
+        for (GT::ChildIteratorType C = GT::child_begin(*M),
+             CE = GT::child_end(*M); C != CE; ++C) {
+          DenseMap<const DSNode *, ReachableSetID>::iterator Done =
+            *C ? SetForNode.find(*C) : SetForNode.end();
+          if (Done != SetForNode.end())
+            Children.push_back(Done->second);
+        }
+      }
+      std::sort(Children.begin(), Children.end());
+      Children.erase(std::unique(Children.begin(), Children.end()),
+                     Children.end());
+      std::sort(Set.begin(), Set.end());
+      Set.erase(std::unique(Set.begin(), Set.end()), Set.end());
+      for (std::vector<ReachableSetID>::iterator C = Children.begin(),
+           CE = Children.end(); C != CE; ++C) {
+        const LeaderIDSet &ChildSet = *ReachableSets[*C];
+        Merged.clear();
+        std::set_union(Set.begin(), Set.end(), ChildSet.begin(),
+                       ChildSet.end(), std::back_inserter(Merged));
+        Set.swap(Merged);
+      }
+
+      ReachableSetID ID = internReachableSet(Set);
+      for (std::vector<const DSNode *>::iterator M = First, E = Stack.end();
+           M != E; ++M)
+        SetForNode[*M] = ID;
+      Stack.erase(First, Stack.end());
     }
   }
 
-  // ReachableSet now contains all DSNodes reachable from V. We cut this down
-  // to the set of merged equivalence class leaders of these nodes.
-  AbstractLocSet &Result = ReachablesForLeader[MergedLeader];
-  AbstractLocSet::iterator ReachableIt = ReachableSet.begin();
-  AbstractLocSet::iterator ReachableEnd = ReachableSet.end();
-  for (; ReachableIt != ReachableEnd; ++ReachableIt) {
-    const DSNode *Node = *ReachableIt;
-    const DSNode *ClassLeader = Classes->getLeaderValue(Node);
-    const DSNode *MergedLeader = MergedLeaders.getLeaderValue(ClassLeader);
-    Result.insert(MergedLeader);
+  // Join the sets of the nodes merged into each leader.
+  DenseMap<const DSNode *, LeaderIDSet> Unions;
+  for (EqIt = Classes->begin(); EqIt != EqItEnd; ++EqIt) {
+    const DSNode *Node = EqIt->getData();
+    const DSNode *MergedLeader = LeaderForID[getLeaderID(Node)];
+    const LeaderIDSet &NodeSet = *ReachableSets[SetForNode[Node]];
+    LeaderIDSet &Set = Unions[MergedLeader];
+    LeaderIDSet Merged;
+    std::set_union(Set.begin(), Set.end(), NodeSet.begin(), NodeSet.end(),
+                   std::back_inserter(Merged));
+    Set.swap(Merged);
   }
-
-  return &Result;
+  for (DenseMap<const DSNode *, LeaderIDSet>::iterator U = Unions.begin(),
+       UE = Unions.end(); U != UE; ++U)
+    ReachableSetForLeader[U->first] = internReachableSet(U->second);
 }
 
 //
@@ -167,17 +315,4 @@ PointsToInterface::getMergedLeaderForValue(const Value *V) {
   return LeaderForValue[V] = MergedLeader;
 }
 
-//
-// Add to the given set all nodes reachable from the given DSNode that are not
-// in the set already.
-//
-void
-PointsToInterface::findReachableAbstractLocSetForNode(AbstractLocSet &Set,
-                                                      const DSNode *Node) {
-  df_ext_iterator<const DSNode *> DFIt = df_ext_begin(Node, Set);
-  df_ext_iterator<const DSNode *> DFEnd = df_ext_end(Node, Set);
-  for (; DFIt != DFEnd; ++DFIt)
-    ;
-}
-
 }
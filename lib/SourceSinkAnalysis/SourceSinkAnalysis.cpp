@@ -12,11 +12,16 @@
 //===----------------------------------------------------------------------===//
 
 #include "SourceSinkAnalysis.h"
+#include "Constraints/PhaseReport.h"
+#include "Constraints/ThreadPool.h"
 #include "llvm/Function.h"
 #include "llvm/Module.h"
 #include "llvm/IntrinsicInst.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/InstIterator.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
 #include <string>
 
 // For __cxa_demangle (demangling c++ function names)
@@ -26,6 +31,11 @@
 using std::set;
 using std::string;
 
+static cl::opt<bool> DepsParallelSources(
+  "deps-parallel-sources",
+  cl::desc("Identify the sources and sinks of each function in parallel"),
+  cl::init(true));
+
 namespace deps {
 
 static RegisterPass<SourceSinkAnalysis>
@@ -33,122 +43,78 @@ X("sourcesinkanalysis", "Source and sink identification");
 
 char SourceSinkAnalysis::ID;
 
+namespace {
+
+// Classify the sources and sinks of one function
+class ClassifyTask : public PoolTask {
+public:
+  ClassifyTask(const SourceSinkAnalysis &SSA, Function &F,
+               SourceSinkAnalysis::FunctionTaint &Taint)
+    : SSA(SSA), F(F), Taint(Taint) {}
+
+  virtual void run() {
+    SSA.classifyFunction(F, Taint);
+  }
+
+private:
+  const SourceSinkAnalysis &SSA;
+  Function &F;
+  SourceSinkAnalysis::FunctionTaint &Taint;
+};
+
+} // end anonymous namespace
+
+// Replace All with the concatenation of one of the vectors of every Taint
+static void
+gatherTaint(const std::vector<SourceSinkAnalysis::FunctionTaint> &Taints,
+            std::vector<const Value *> SourceSinkAnalysis::FunctionTaint::*Member,
+            std::vector<const Value *> &All) {
+  All.clear();
+  for (std::vector<SourceSinkAnalysis::FunctionTaint>::const_iterator
+       taint = Taints.begin(), end = Taints.end(); taint != end; ++taint)
+    All.insert(All.end(), ((*taint).*Member).begin(), ((*taint).*Member).end());
+}
+
 bool SourceSinkAnalysis::runOnModule(Module &M) {
-  for (Module::iterator fun = M.begin(), fend = M.end(); fun != fend; ++fun) {
-    //errs() << "Adding sources and sinks from " << fun->getName() << "\n";
-
-    std::set<const Value *> sources;
-    std::set<const Value *> sinks;
-
-    std::set<const Value *> directPtrSources;
-    std::set<const Value *> directPtrSinks;
-
-    std::set<const Value *> reachPtrSources;
-    std::set<const Value *> reachPtrSinks;
-
-    // Add the arguments to the function as sources if necessary (e.g. main)
-    identifySourcesForFunction(*fun, sources, directPtrSources, reachPtrSources);
-    // Add sources and sinks that result from instructions
-    for (inst_iterator I = inst_begin(*fun), E = inst_end(*fun); I != E; ++I) {
-      Instruction *inst = &*I;
-
-      // XXX don't consider these to be sinks for performance reasons in jitflow
-      /*
-      if (LoadInst * load = dyn_cast<LoadInst>(inst)) {
-	// The pointer operand of a load is a sensitive sink
-        //sinks.insert(load->getPointerOperand());
-      } else if (StoreInst * store = dyn_cast<StoreInst>(inst)) {
-        // The pointer operand of a store is a sensitive sink
-        sinks.insert(store->getPointerOperand());
-      } else 
-      */
-      if (CallInst *call = dyn_cast<CallInst>(inst)) {
-        // Calls may add sources or sinks (for example input returned
-        // via a system call may be a source or the argument to a system
-        // call may be a sink
-	
-        // Handle intrinsics here rather than defering to SourceSinkAnalysis
-        if (const IntrinsicInst *intr = dyn_cast<IntrinsicInst>(call)) {
-          switch(intr->getIntrinsicID()) {
-          case Intrinsic::memcpy:
-          case Intrinsic::memmove:
-            // Destination pointer
-            sinks.insert(intr->getArgOperand(0));
-            // Source pointer
-            sinks.insert(intr->getArgOperand(1));
-            // Length
-            sinks.insert(intr->getArgOperand(2));
-            break;
-          case Intrinsic::memset:
-            // Destination pointer
-            sinks.insert(intr->getArgOperand(0));
-            // Value to set memory to
-            sinks.insert(intr->getArgOperand(1));
-            // Length
-            sinks.insert(intr->getArgOperand(2));
-            break;
-          default:
-            break;
-          }
-        } else {
-          const CallSite cs(call);
-          identifySourcesForCallSite(cs, sources, directPtrSources, reachPtrSources);
-          identifySinksForCallSite(cs, sinks, directPtrSinks, reachPtrSinks);
-        }
-      } else if (const AllocaInst *ai = dyn_cast<AllocaInst>(inst)) {
-        // The size operand of an alloca is a sensitive sink.
-        if (!ai->isStaticAlloca())
-          sinks.insert(ai->getArraySize());
-      }
-    }
-    
-    // Use the source and sink sets to generate constraints
-    //errs() << "sources:\n";
-    for (std::set<const Value *>::iterator value = sources.begin(), end = sources.end();
-	  value != end; ++value) {
-        sourcesAndSinks.addSourceValue(**value);
-        //infoflow->setTainted("source", **value);
-        //errs() << "\t" << **value << "\n";
-    }
-    //errs() << "direct sources:\n";
-    for (std::set<const Value *>::iterator value = directPtrSources.begin(), end = directPtrSources.end();
-	  value != end; ++value) {
-        sourcesAndSinks.addSourceDirectPtr(**value);
-        //infoflow->setDirectPtrTainted("source", **value);
-        //errs() << "\t" << **value << "\n";
-    }
-    //errs() << "reachable sources:\n";
-    for (std::set<const Value *>::iterator value = reachPtrSources.begin(), end = reachPtrSources.end();
-          value != end; ++value) {
-        sourcesAndSinks.addSourceReachablePtr(**value);
-        //infoflow->setReachPtrTainted("source", **value);
-        //errs() << "\t" << **value << "\n";
-    }
+  PhaseTimer T("source/sink identification");
+  resolveTaintEntries(M);
 
-    //errs() << "sinks:\n";
-    for (std::set<const Value *>::iterator value = sinks.begin(), end = sinks.end();
-          value != end; ++value) {
-        sourcesAndSinks.addSinkValue(**value);
-        //infoflow->setUntainted("sink", **value);
-        //errs() << "\t" << **value << "\n";
-    }
-    //errs() << "direct sinks:\n";
-    for (std::set<const Value *>::iterator value = directPtrSinks.begin(), end = directPtrSinks.end();
-          value != end; ++value) {
-        sourcesAndSinks.addSinkDirectPtr(**value);
-        //infoflow->setDirectPtrUntainted("sink", **value);
-        //errs() << "\t" << **value << "\n";
-    }
-    //errs() << "reachable sinks:\n";
-    for (std::set<const Value *>::iterator value = reachPtrSinks.begin(), end = reachPtrSinks.end();
-          value != end; ++value) {
-        sourcesAndSinks.addSinkReachablePtr(**value);
-        //infoflow->setReachPtrUntainted("sink", **value);
-        //errs() << "\t" << **value << "\n";
-    }
-    //errs() << "\n";
+  // The call sites of each function are independent of all others, so
+  // every function is classified on its own, and the results are added to
+  // the flow record in module order afterwards.
+  std::vector<Function *> Funs;
+  for (Module::iterator fun = M.begin(), fend = M.end(); fun != fend; ++fun) {
+    if (!fun->isDeclaration())
+      Funs.push_back(&*fun);
+  }
+  std::vector<FunctionTaint> Taints(Funs.size());
+
+  if (DepsParallelSources && Funs.size() > 1) {
+    ThreadPool::Batch B(ThreadPool::global());
+    for (unsigned i = 0, e = Funs.size(); i != e; ++i)
+      B.async(new ClassifyTask(*this, *Funs[i], Taints[i]));
+    B.wait();
+  } else {
+    for (unsigned i = 0, e = Funs.size(); i != e; ++i)
+      classifyFunction(*Funs[i], Taints[i]);
   }
 
+  // Each set of the record gets the values of all functions at once, so
+  // that it is sorted once rather than merged again for every function
+  std::vector<const Value *> All;
+  gatherTaint(Taints, &FunctionTaint::Sources, All);
+  sourcesAndSinks.addSourceValue(All.begin(), All.end());
+  gatherTaint(Taints, &FunctionTaint::DirectPtrSources, All);
+  sourcesAndSinks.addSourceDirectPtr(All.begin(), All.end());
+  gatherTaint(Taints, &FunctionTaint::ReachPtrSources, All);
+  sourcesAndSinks.addSourceReachablePtr(All.begin(), All.end());
+  gatherTaint(Taints, &FunctionTaint::Sinks, All);
+  sourcesAndSinks.addSinkValue(All.begin(), All.end());
+  gatherTaint(Taints, &FunctionTaint::DirectPtrSinks, All);
+  sourcesAndSinks.addSinkDirectPtr(All.begin(), All.end());
+  gatherTaint(Taints, &FunctionTaint::ReachPtrSinks, All);
+  sourcesAndSinks.addSinkReachablePtr(All.begin(), All.end());
+
   return false;
 }
 
@@ -373,13 +339,103 @@ findEntryForFunction(const CallTaintEntry *Summaries,
 }
 
 //
-// Add into the value set all values from the call site specified by the taint
-// summary.
+// Fill in the table entry of every external function of the module, with
+// one pass over the table and one lookup per function.
+//
+static void
+resolveEntries(const CallTaintEntry *Summaries, const Module &M,
+               DenseMap<const Function *, const CallTaintEntry *> &Entries) {
+  StringMap<const CallTaintEntry *> ByName;
+  unsigned Index;
+  for (Index = 0; Summaries[Index].Name; ++Index) {
+    // The first entry of a name wins, as in findEntryForFunction
+    ByName.GetOrCreateValue(Summaries[Index].Name, &Summaries[Index]);
+  }
+  const CallTaintEntry *Default = &Summaries[Index];
+
+  Entries.clear();
+  // Indirect calls
+  Entries[NULL] = Default;
+  for (Module::const_iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (!F->empty())
+      continue;
+    if (F->getName().startswith("____jf_check")) {
+      Entries[&*F] = &nothing;
+      continue;
+    }
+    StringMap<const CallTaintEntry *>::const_iterator Entry = ByName.find(F->getName());
+    Entries[&*F] = Entry != ByName.end() ? Entry->second : Default;
+  }
+}
+
+// isCXXSink: Attempt to demangle and match the given function name.
+static bool isCXXSink(StringRef Name) {
+  // Check C++ names
+  size_t len = 0;
+  int status;
+  bool sink = false;
+  char* demangled = abi::__cxa_demangle(Name.str().c_str(), NULL, &len, &status);
+  if (!status) {
+    StringRef Demangled(demangled);
+    // Pick up common allocation/free/output logics
+    // TODO: Refactor and add support for cin/etc as sources?
+#if 0
+    sink = Demangled.startswith("std::ios_base") ||
+           Demangled.startswith("operator new") ||
+           Demangled.startswith("operator delete") ||
+           Demangled.startswith("std::basic_ostream") ||
+           Demangled.startswith("std::ostream");
+#else
+    sink = Demangled.startswith("operator new") ||
+           Demangled.startswith("operator delete");
+#endif
+  }
+
+  free(demangled);
+
+  return sink;
+}
+
+void SourceSinkAnalysis::resolveTaintEntries(const Module &M) {
+  resolveEntries(SourceTaintSummaries, M, SourceEntries);
+  resolveEntries(SinkTaintSummaries, M, SinkEntries);
+
+  // Defined functions may be C++ sinks too, so look at all of them
+  CXXSinks.clear();
+  for (Module::const_iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (isCXXSink(F->getName()))
+      CXXSinks.insert(&*F);
+  }
+}
+
+//
+// The taint table helpers below fill either the sets of the per-call-site
+// entry points or the vectors of classifyFunction, through add().
+//
+static void add(set<const Value *> &S, const Value *V) {
+  S.insert(V);
+}
+
+static void add(std::vector<const Value *> &S, const Value *V) {
+  S.push_back(V);
+}
+
+template <class Container>
+static void addValue(Container &S, const Value *V, bool PointersOnly) {
+  if (!PointersOnly || isa<PointerType>(V->getType()))
+    add(S, V);
+}
+
+//
+// Add into the container all values from the call site specified by the
+// taint summary, or only the pointers among them.
 //
+template <class Container>
 static void
 determineTaintedValues(const CallTaintSummary *Summary,
                        const CallSite &CS,
-                       set<const Value *> &S) {
+                       Container &S,
+                       bool PointersOnly) {
   const Value *Callee = CS.getCalledValue();
   FunctionType *CalleeType =
     dyn_cast<FunctionType>(
@@ -388,12 +444,12 @@ determineTaintedValues(const CallTaintSummary *Summary,
 
   // Add return value if it is tainted.
   if (Summary->TaintsReturnValue)
-    S.insert(CS.getInstruction());
+    addValue(S, CS.getInstruction(), PointersOnly);
 
   // Add all tainted arguments.
   for (unsigned ArgIndex = 0; ArgIndex < Summary->NumArguments; ++ArgIndex) {
     if (Summary->TaintsArgument[ArgIndex] && ArgIndex < CS.arg_size())
-      S.insert(CS.getArgument(ArgIndex));
+      addValue(S, CS.getArgument(ArgIndex), PointersOnly);
   }
 
   // Add the vararg arguments if they are tainted.
@@ -401,127 +457,104 @@ determineTaintedValues(const CallTaintSummary *Summary,
     unsigned NumArgs = CS.arg_size(), VarArgIndex = CalleeType->getNumParams();
 
     for (; VarArgIndex < NumArgs; VarArgIndex++)
-      S.insert(CS.getArgument(VarArgIndex));
+      addValue(S, CS.getArgument(VarArgIndex), PointersOnly);
   }
 }
 
 //
-// Remove the non-pointer type values from the set.
+// Sort the vector and drop its duplicates
 //
-static void filterOutNonPointers(set<const Value *> &S) {
-  set<const Value *>::iterator SetIt = S.begin(), SetItEnd = S.end();
-  while (SetIt != SetItEnd) {
-    if (!isa<PointerType>((*SetIt)->getType()))
-      S.erase(SetIt++);
-    else
-      SetIt++;
-  }
+static void sortUnique(std::vector<const Value *> &V) {
+  std::sort(V.begin(), V.end());
+  V.erase(std::unique(V.begin(), V.end()), V.end());
 }
 
 //
-// Given a call site and a list of entries in a taint table, fill the
-// TaintedValues argument with all values that are tainted according to the
-// table, and fill the TaintedRootPointers with all pointers which reach
-// tainted memory according to the table.
+// The entry of the callee of the call site in a taint table, or NULL if the
+// callee is defined in the module, which has no entry.
 //
-static void identifyTaintForCallSite(
+static const CallTaintEntry *entryForCallSite(
   const CallSite &CS,
   const CallTaintEntry *EntryList,
-  set<const Value *> &TaintedValues,
-  set<const Value *> &TaintedDirectPointers,
-  set<const Value *> &TaintedRootPointers
+  const DenseMap<const Function *, const CallTaintEntry *> &Entries
 ) {
   Function *CalledFunction = CS.getCalledFunction();
 
   // Only determine taint for external functions.
   if (CalledFunction && !CalledFunction->empty())
-    return;
+    return NULL;
+
+  // Get the entry for the function in the taint table, which is usually
+  // resolved already.
+  DenseMap<const Function *, const CallTaintEntry *>::const_iterator Resolved =
+    Entries.find(CalledFunction);
+  if (Resolved != Entries.end())
+    return Resolved->second;
 
-  // Get the name of the callee.
   string FunctionName =
     CalledFunction != 0 ? CalledFunction->getName().str() : "";
+  return findEntryForFunction(EntryList, FunctionName);
+}
 
-  // Get the entry for the function in the source taint table.
-  const CallTaintEntry *Entry;
-  Entry = findEntryForFunction(EntryList, FunctionName);
-
-
+//
+// Given a call site and its entry in a taint table, add to TaintedValues all
+// values that are tainted according to the entry, and to TaintedDirectPointers
+// and TaintedRootPointers all pointers whose directly reachable or reachable
+// memory is tainted according to it.
+//
+template <class Container>
+static void identifyTaintForEntry(
+  const CallSite &CS,
+  const CallTaintEntry &Entry,
+  Container &TaintedValues,
+  Container &TaintedDirectPointers,
+  Container &TaintedRootPointers
+) {
   // Determine the directly tainted sources.
-  determineTaintedValues(&Entry->ValueSummary, CS, TaintedValues);
+  determineTaintedValues(&Entry.ValueSummary, CS, TaintedValues, false);
 
   // Determine the pointers only whose directly reachable memory is tainted.
-  set<const Value *> TaintedDirectMemoryValues;
-  determineTaintedValues(
-    &Entry->DirectPointerSummary, CS, TaintedDirectMemoryValues
-  );
-
-  // determineTaintedValues() might return non-pointer entries, so filter
-  // those out.
-  filterOutNonPointers(TaintedDirectMemoryValues);
-
-  // Insert the computed direct memory taint pointers into the argument.
-  TaintedDirectPointers.insert(
-    TaintedDirectMemoryValues.begin(), TaintedDirectMemoryValues.end()
-  );
-
+  determineTaintedValues(&Entry.DirectPointerSummary, CS,
+                         TaintedDirectPointers, true);
 
   // Determine the tainted root pointer sources.
-  set<const Value *> TaintedRootValues;
-  determineTaintedValues(&Entry->RootPointerSummary, CS, TaintedRootValues);
-
-  // determineTaintedValues() might return non-pointer entries, so filter
-  // those out.
-  filterOutNonPointers(TaintedRootValues);
-
-  // Insert the computed tainted root pointer values into the argument.
-  TaintedRootPointers.insert(
-    TaintedRootValues.begin(), TaintedRootValues.end()
-  );
+  determineTaintedValues(&Entry.RootPointerSummary, CS,
+                         TaintedRootPointers, true);
 }
 
-// checkCXXSinks: Attempt to demangle and match the callee's name,
-// and if we succeed add all arguments as value and direct memory.
+//
+// Add all arguments of a call to a C++ sink as values, and those that are
+// pointers as direct memory.
 // Please forgive the mess...
-bool checkCXXSinks(
+//
+template <class Container>
+static void addCXXSinkArguments(
   const CallSite &CS,
-  set<const Value *> &TaintedValues,
-  set<const Value *> &TaintedDirectPointers,
-  set<const Value *> &TaintedRootPointers) {
-  const Function *F = CS.getCalledFunction();
-  if (!F) return false;
-  StringRef Name = F->getName();
-
-  // Check C++ names
-  size_t len = 0;
-  int status;
-  char* demangled = abi::__cxa_demangle(Name.str().c_str(), NULL, &len, &status);
-  if (!status) {
-    StringRef Demangled(demangled);
-    // Pick up common allocation/free/output logics
-    // TODO: Refactor and add support for cin/etc as sources?
-#if 0
-    if (Demangled.startswith("std::ios_base") ||
-        Demangled.startswith("operator new") ||
-        Demangled.startswith("operator delete") ||
-        Demangled.startswith("std::basic_ostream") ||
-        Demangled.startswith("std::ostream")) {
-#else
-    if (
-        Demangled.startswith("operator new") ||
-        Demangled.startswith("operator delete")) {
-#endif
-      TaintedValues.insert(CS.arg_begin(), CS.arg_end());
-      std::set<const Value*> PtrArgs(CS.arg_begin(), CS.arg_end());
-      filterOutNonPointers(PtrArgs);
-      TaintedDirectPointers.insert(PtrArgs.begin(), PtrArgs.end());
-      free(demangled);
-      return true;
-    }
+  Container &TaintedValues,
+  Container &TaintedDirectPointers) {
+  for (CallSite::arg_iterator Arg = CS.arg_begin(), End = CS.arg_end();
+       Arg != End; ++Arg) {
+    addValue(TaintedValues, *Arg, false);
+    addValue(TaintedDirectPointers, *Arg, true);
   }
+}
 
-  free(demangled);
+//
+// Taint all arguments of main, and the reachable memory of all pointers.
+//
+template <class Container>
+static void addMainArguments(
+  const Function &F,
+  Container &TaintedValues,
+  Container &TaintedRootPointers) {
+  if (F.getName() != "main")
+    return;
 
-  return false;
+  Function::const_arg_iterator ArgIt = F.arg_begin(), ArgItEnd = F.arg_end();
+  for (; ArgIt != ArgItEnd; ++ArgIt) {
+    addValue(TaintedRootPointers, &*ArgIt, true);
+    addValue(TaintedValues, &*ArgIt, false);
+  }
 }
 
 void SourceSinkAnalysis::identifySourcesForCallSite(
@@ -530,13 +563,11 @@ void SourceSinkAnalysis::identifySourcesForCallSite(
   set<const Value *> &TaintedDirectPointers,
   set<const Value *> &TaintedRootPointers
 ) {
-  identifyTaintForCallSite(
-    CS,
-    SourceTaintSummaries,
-    TaintedValues,
-    TaintedDirectPointers,
-    TaintedRootPointers
-  );
+  const CallTaintEntry *Entry =
+    entryForCallSite(CS, SourceTaintSummaries, SourceEntries);
+  if (Entry)
+    identifyTaintForEntry(CS, *Entry, TaintedValues, TaintedDirectPointers,
+                          TaintedRootPointers);
 }
 
 void SourceSinkAnalysis::identifySinksForCallSite(
@@ -547,17 +578,18 @@ void SourceSinkAnalysis::identifySinksForCallSite(
 ) {
 
   // If we recognize this as a C++-specific sink, we're done
-  if (checkCXXSinks(CS, TaintedValues, TaintedDirectPointers, TaintedRootPointers))
+  const Function *F = CS.getCalledFunction();
+  if (F && isCXXSink(F->getName())) {
+    addCXXSinkArguments(CS, TaintedValues, TaintedDirectPointers);
     return;
+  }
 
   // Otherwise, check our function summary table
-  identifyTaintForCallSite(
-    CS,
-    SinkTaintSummaries,
-    TaintedValues,
-    TaintedDirectPointers,
-    TaintedRootPointers
-  );
+  const CallTaintEntry *Entry =
+    entryForCallSite(CS, SinkTaintSummaries, SinkEntries);
+  if (Entry)
+    identifyTaintForEntry(CS, *Entry, TaintedValues, TaintedDirectPointers,
+                          TaintedRootPointers);
 }
 
 void SourceSinkAnalysis::identifySourcesForFunction(
@@ -566,16 +598,65 @@ void SourceSinkAnalysis::identifySourcesForFunction(
   set<const Value *> &TaintedDirectPointers,
   set<const Value *> &TaintedRootPointers
 ) {
-  if (F.getName().str() != "main")
-    return;
+  addMainArguments(F, TaintedValues, TaintedRootPointers);
+}
 
-  // Taint all arguments, and taint the reachable memory of all pointers.
-  Function::const_arg_iterator ArgIt = F.arg_begin(), ArgItEnd = F.arg_end();
-  for (; ArgIt != ArgItEnd; ++ArgIt) {
-    if (isa<PointerType>(ArgIt->getType()))
-      TaintedRootPointers.insert(&*ArgIt);
-    TaintedValues.insert(&*ArgIt);
+void SourceSinkAnalysis::classifyFunction(Function &F, FunctionTaint &Taint) const {
+  // Add the arguments to the function as sources if necessary (e.g. main)
+  addMainArguments(F, Taint.Sources, Taint.ReachPtrSources);
+
+  // Add sources and sinks that result from instructions
+  for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+    Instruction *inst = &*I;
+
+    // XXX don't consider the pointer operands of loads and stores to be
+    // sinks for performance reasons in jitflow
+    if (CallInst *call = dyn_cast<CallInst>(inst)) {
+      // Handle intrinsics here rather than through the taint tables
+      if (const IntrinsicInst *intr = dyn_cast<IntrinsicInst>(call)) {
+        switch(intr->getIntrinsicID()) {
+        case Intrinsic::memcpy:
+        case Intrinsic::memmove:
+        case Intrinsic::memset:
+          // Destination pointer, source pointer or value, and length
+          Taint.Sinks.push_back(intr->getArgOperand(0));
+          Taint.Sinks.push_back(intr->getArgOperand(1));
+          Taint.Sinks.push_back(intr->getArgOperand(2));
+          break;
+        default:
+          break;
+        }
+        continue;
+      }
+
+      const CallSite cs(call);
+      const Function *Callee = cs.getCalledFunction();
+
+      if (const CallTaintEntry *Source =
+            entryForCallSite(cs, SourceTaintSummaries, SourceEntries))
+        identifyTaintForEntry(cs, *Source, Taint.Sources,
+                              Taint.DirectPtrSources, Taint.ReachPtrSources);
+
+      // As in identifySinksForCallSite, with the C++ sinks found up front
+      if (Callee && CXXSinks.count(Callee))
+        addCXXSinkArguments(cs, Taint.Sinks, Taint.DirectPtrSinks);
+      else if (const CallTaintEntry *Sink =
+                 entryForCallSite(cs, SinkTaintSummaries, SinkEntries))
+        identifyTaintForEntry(cs, *Sink, Taint.Sinks,
+                              Taint.DirectPtrSinks, Taint.ReachPtrSinks);
+    } else if (const AllocaInst *ai = dyn_cast<AllocaInst>(inst)) {
+      // The size operand of an alloca is a sensitive sink.
+      if (!ai->isStaticAlloca())
+        Taint.Sinks.push_back(ai->getArraySize());
+    }
   }
+
+  sortUnique(Taint.Sources);
+  sortUnique(Taint.DirectPtrSources);
+  sortUnique(Taint.ReachPtrSources);
+  sortUnique(Taint.Sinks);
+  sortUnique(Taint.DirectPtrSinks);
+  sortUnique(Taint.ReachPtrSinks);
 }
 
 }
@@ -0,0 +1,190 @@
+#!/usr/bin/env python
+#
+# Runs the deps passes over bitcode files and compares the results with a
+# baseline.
+#
+#   bench.py run REPORT [--repeat N] BITCODE... -- OPT [OPT ARGS...]
+#
+# runs "OPT ARGS... -deps-time-report-json=... BITCODE" N times for each
+# bitcode file. REPORT gets the wall time of the fastest run, the process'
+# peak memory and the -deps-time-report of each file, as JSON. The answers
+# of every run must be the same, and its "mismatches" counters zero.
+#
+#   bench.py compare REPORT BASELINE [--tolerance T]
+#
+# prints the differences between two reports per program. It fails if any
+# answer differs, or if total time or peak memory grew by more than T
+# (a fraction, 0.10 by default).
+
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+# Counters that must be the same in every run: checksums of the answers
+# of the queries deps-slice-bench asks, and how many were in the slice
+ANSWER_PREFIXES = ('checksum ', 'in ')
+# Counters worth showing next to the answers, if they changed
+SIZE_PREFIXES = ('variables', 'constraints in kind', 'distinct joins',
+                 'distinct analysis units', 'multislice sources')
+# Counters of queries on which two ways of solving disagreed
+MISMATCH_PREFIX = 'mismatches '
+
+
+def is_answer(counter):
+    return counter.startswith(ANSWER_PREFIXES)
+
+
+def answers(report):
+    return dict((k, v) for k, v in report['counters'].items() if is_answer(k))
+
+
+def run_one(opt, bitcode):
+    fd, path = tempfile.mkstemp(suffix='.json')
+    os.close(fd)
+    try:
+        start = time.time()
+        subprocess.check_call(opt + ['-deps-time-report-json=' + path,
+                                     bitcode])
+        seconds = time.time() - start
+        with open(path) as f:
+            report = json.load(f)
+    finally:
+        os.remove(path)
+    report['seconds'] = seconds
+    return report
+
+
+def run(argv):
+    if '--' not in argv:
+        sys.stderr.write('bench.py run: no opt command given\n')
+        return 2
+    split = argv.index('--')
+    args, opt = argv[:split], argv[split + 1:]
+    if not args or not opt:
+        sys.stderr.write('bench.py run: no report or opt command given\n')
+        return 2
+    output, args = args[0], args[1:]
+    repeat = 1
+    if args[:1] == ['--repeat']:
+        repeat, args = int(args[1]), args[2:]
+
+    programs = {}
+    for bitcode in args:
+        name = os.path.splitext(os.path.basename(bitcode))[0]
+        best = None
+        for i in range(repeat):
+            report = run_one(opt, bitcode)
+            for counter, value in sorted(report['counters'].items()):
+                if counter.startswith(MISMATCH_PREFIX) and value:
+                    sys.stderr.write('%s: %s is %d\n' % (name, counter, value))
+                    return 1
+            if best and answers(best) != answers(report):
+                sys.stderr.write('%s: answers differ between runs\n' % name)
+                return 1
+            if not best or report['seconds'] < best['seconds']:
+                best = report
+        programs[name] = best
+        sys.stdout.write('%-16s %8.3fs %9dKB\n' %
+                         (name, best['seconds'], best['peak_kb']))
+
+    with open(output, 'w') as f:
+        json.dump({'programs': programs}, f, indent=2, sort_keys=True)
+        f.write('\n')
+    return 0
+
+
+def ratio(new, old):
+    if not old:
+        return ''
+    return '%+.1f%%' % (100.0 * (new - old) / old)
+
+
+def compare_program(name, new, old, tolerance):
+    failed = False
+    sys.stdout.write('%s\n' % name)
+
+    new_answers, old_answers = answers(new), answers(old)
+    for counter in sorted(set(new_answers) | set(old_answers)):
+        if new_answers.get(counter) != old_answers.get(counter):
+            sys.stdout.write('  ANSWERS DIFFER: %s was %s, now %s\n' %
+                             (counter, old_answers.get(counter),
+                              new_answers.get(counter)))
+            failed = True
+
+    for counter in sorted(new['counters']):
+        if not counter.startswith(SIZE_PREFIXES):
+            continue
+        n = new['counters'][counter]
+        o = old['counters'].get(counter)
+        if n != o:
+            sys.stdout.write('  %-40s %12s -> %-12s %s\n' %
+                             (counter, o, n, ratio(n, o or 0)))
+
+    old_phases = dict((p['name'], p) for p in old['phases'])
+    for phase in new['phases']:
+        o = old_phases.get(phase['name'])
+        if o is None:
+            sys.stdout.write('  %-40s %12s -> %9.3fs\n' %
+                             (phase['name'], 'new', phase['seconds']))
+            continue
+        sys.stdout.write('  %-40s %11.3fs -> %9.3fs %s\n' %
+                         (phase['name'], o['seconds'], phase['seconds'],
+                          ratio(phase['seconds'], o['seconds'])))
+
+    sys.stdout.write('  %-40s %11.3fs -> %9.3fs %s\n' %
+                     ('total', old['seconds'], new['seconds'],
+                      ratio(new['seconds'], old['seconds'])))
+    sys.stdout.write('  %-40s %10dKB -> %8dKB %s\n' %
+                     ('peak memory', old['peak_kb'], new['peak_kb'],
+                      ratio(new['peak_kb'], old['peak_kb'])))
+
+    if new['seconds'] > old['seconds'] * (1 + tolerance):
+        sys.stdout.write('  SLOWER than the baseline\n')
+        failed = True
+    if new['peak_kb'] > old['peak_kb'] * (1 + tolerance):
+        sys.stdout.write('  MORE MEMORY than the baseline\n')
+        failed = True
+    return failed
+
+
+def compare(argv):
+    tolerance = 0.10
+    if '--tolerance' in argv:
+        i = argv.index('--tolerance')
+        tolerance = float(argv[i + 1])
+        argv = argv[:i] + argv[i + 2:]
+    if len(argv) != 2:
+        sys.stderr.write('bench.py compare: need a report and a baseline\n')
+        return 2
+
+    with open(argv[0]) as f:
+        new = json.load(f)['programs']
+    with open(argv[1]) as f:
+        old = json.load(f)['programs']
+
+    failed = False
+    for name in sorted(set(new) | set(old)):
+        if name not in old:
+            sys.stdout.write('%s: not in the baseline\n' % name)
+        elif name not in new:
+            sys.stdout.write('%s: not run\n' % name)
+            failed = True
+        else:
+            failed |= compare_program(name, new[name], old[name], tolerance)
+    return 1 if failed else 0
+
+
+def main(argv):
+    if len(argv) > 1 and argv[1] == 'run':
+        return run(argv[2:])
+    if len(argv) > 1 and argv[1] == 'compare':
+        return compare(argv[2:])
+    sys.stderr.write('usage: %s run|compare ...\n' % argv[0])
+    return 2
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
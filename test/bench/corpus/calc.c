@@ -0,0 +1,236 @@
+/* A line-at-a-time calculator with variables: a tokenizer, a recursive
+   descent parser building a heap-allocated tree, and an evaluator. Flows
+   go through the tree and through the variable table. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum token_kind { T_NUM, T_NAME, T_OP, T_LPAREN, T_RPAREN, T_ASSIGN, T_END };
+
+struct token {
+  enum token_kind kind;
+  double num;
+  char name[32];
+  char op;
+};
+
+struct lexer {
+  const char *p;
+  struct token tok;
+};
+
+enum node_kind { N_NUM, N_VAR, N_BINOP, N_NEG, N_CALL };
+
+struct node {
+  enum node_kind kind;
+  double num;
+  char name[32];
+  char op;
+  struct node *lhs, *rhs;
+};
+
+struct var {
+  char name[32];
+  double value;
+  struct var *next;
+};
+
+static struct var *vars;
+
+static void next_token(struct lexer *lx) {
+  const char *p = lx->p;
+  while (*p == ' ' || *p == '\t') ++p;
+  if (*p == '\0' || *p == '\n') {
+    lx->tok.kind = T_END;
+  } else if ((*p >= '0' && *p <= '9') || *p == '.') {
+    char *end;
+    lx->tok.kind = T_NUM;
+    lx->tok.num = strtod(p, &end);
+    p = end - 1;
+  } else if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z')) {
+    unsigned n = 0;
+    lx->tok.kind = T_NAME;
+    while (((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+            (*p >= '0' && *p <= '9')) && n + 1 < sizeof(lx->tok.name))
+      lx->tok.name[n++] = *p++;
+    lx->tok.name[n] = '\0';
+    --p;
+  } else if (*p == '(') {
+    lx->tok.kind = T_LPAREN;
+  } else if (*p == ')') {
+    lx->tok.kind = T_RPAREN;
+  } else if (*p == '=') {
+    lx->tok.kind = T_ASSIGN;
+  } else {
+    lx->tok.kind = T_OP;
+    lx->tok.op = *p;
+  }
+  lx->p = p + 1;
+}
+
+static struct node *new_node(enum node_kind kind) {
+  struct node *n = calloc(1, sizeof(*n));
+  if (!n) {
+    fputs("out of memory\n", stderr);
+    exit(1);
+  }
+  n->kind = kind;
+  return n;
+}
+
+static void free_node(struct node *n) {
+  if (!n) return;
+  free_node(n->lhs);
+  free_node(n->rhs);
+  free(n);
+}
+
+static struct node *parse_sum(struct lexer *lx);
+
+static struct node *parse_atom(struct lexer *lx) {
+  struct node *n;
+  switch (lx->tok.kind) {
+  case T_NUM:
+    n = new_node(N_NUM);
+    n->num = lx->tok.num;
+    next_token(lx);
+    return n;
+  case T_NAME:
+    n = new_node(N_VAR);
+    strcpy(n->name, lx->tok.name);
+    next_token(lx);
+    if (lx->tok.kind == T_LPAREN) {
+      next_token(lx);
+      n->kind = N_CALL;
+      n->lhs = parse_sum(lx);
+      if (lx->tok.kind == T_RPAREN) next_token(lx);
+    }
+    return n;
+  case T_LPAREN:
+    next_token(lx);
+    n = parse_sum(lx);
+    if (lx->tok.kind == T_RPAREN) next_token(lx);
+    return n;
+  case T_OP:
+    if (lx->tok.op == '-') {
+      next_token(lx);
+      n = new_node(N_NEG);
+      n->lhs = parse_atom(lx);
+      return n;
+    }
+    /* fall through */
+  default:
+    return new_node(N_NUM);
+  }
+}
+
+static struct node *parse_binary(struct lexer *lx, const char *ops,
+                                 struct node *(*operand)(struct lexer *)) {
+  struct node *lhs = operand(lx);
+  while (lx->tok.kind == T_OP && strchr(ops, lx->tok.op)) {
+    struct node *n = new_node(N_BINOP);
+    n->op = lx->tok.op;
+    next_token(lx);
+    n->lhs = lhs;
+    n->rhs = operand(lx);
+    lhs = n;
+  }
+  return lhs;
+}
+
+static struct node *parse_product(struct lexer *lx) {
+  return parse_binary(lx, "*/%", parse_atom);
+}
+
+static struct node *parse_sum(struct lexer *lx) {
+  return parse_binary(lx, "+-", parse_product);
+}
+
+static struct var *lookup(const char *name, int create) {
+  struct var *v;
+  for (v = vars; v; v = v->next)
+    if (!strcmp(v->name, name)) return v;
+  if (!create) return NULL;
+  v = calloc(1, sizeof(*v));
+  if (!v) exit(1);
+  strncpy(v->name, name, sizeof(v->name) - 1);
+  v->next = vars;
+  vars = v;
+  return v;
+}
+
+static double call(const char *name, double arg) {
+  if (!strcmp(name, "sq")) return arg * arg;
+  if (!strcmp(name, "abs")) return arg < 0 ? -arg : arg;
+  if (!strcmp(name, "half")) return arg / 2;
+  fprintf(stderr, "unknown function %s\n", name);
+  return 0;
+}
+
+static double eval(const struct node *n) {
+  double l, r;
+  struct var *v;
+  switch (n->kind) {
+  case N_NUM:
+    return n->num;
+  case N_VAR:
+    v = lookup(n->name, 0);
+    return v ? v->value : 0;
+  case N_NEG:
+    return -eval(n->lhs);
+  case N_CALL:
+    return call(n->name, n->lhs ? eval(n->lhs) : 0);
+  case N_BINOP:
+    l = eval(n->lhs);
+    r = eval(n->rhs);
+    switch (n->op) {
+    case '+': return l + r;
+    case '-': return l - r;
+    case '*': return l * r;
+    case '/': return r != 0 ? l / r : 0;
+    case '%': return r != 0 ? (double)((long)l % (long)r) : 0;
+    }
+  }
+  return 0;
+}
+
+static void run_line(const char *line, int echo) {
+  struct lexer lx;
+  struct node *tree;
+  char target[32] = "";
+
+  lx.p = line;
+  next_token(&lx);
+  if (lx.tok.kind == T_END) return;
+
+  /* name = expr */
+  if (lx.tok.kind == T_NAME) {
+    struct lexer save = lx;
+    strcpy(target, lx.tok.name);
+    next_token(&lx);
+    if (lx.tok.kind != T_ASSIGN) {
+      lx = save;
+      target[0] = '\0';
+    } else {
+      next_token(&lx);
+    }
+  }
+
+  tree = parse_sum(&lx);
+  if (target[0]) {
+    lookup(target, 1)->value = eval(tree);
+  } else if (echo) {
+    printf("%g\n", eval(tree));
+  }
+  free_node(tree);
+}
+
+int main(void) {
+  char line[256];
+  const char *init = getenv("CALC_INIT");
+  if (init) run_line(init, 0);
+  while (fgets(line, sizeof(line), stdin))
+    run_line(line, 1);
+  return 0;
+}
@@ -0,0 +1,252 @@
+/* A key-value store with a chained hash table, a log file and a small
+   command language. Keys and values are heap strings reached through
+   several levels of pointers, so most flows go through memory. */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct entry {
+  char *key;
+  char *value;
+  unsigned hits;
+  struct entry *next;
+};
+
+struct table {
+  struct entry **buckets;
+  unsigned size;
+  unsigned count;
+};
+
+struct store {
+  struct table table;
+  FILE *log;
+  const char *prompt;
+};
+
+typedef int (*command_fn)(struct store *, char **args, int nargs);
+
+struct command {
+  const char *name;
+  int nargs;
+  command_fn run;
+};
+
+static char *copy_string(const char *s) {
+  size_t n = strlen(s) + 1;
+  char *c = malloc(n);
+  if (!c) {
+    fputs("out of memory\n", stderr);
+    exit(1);
+  }
+  memcpy(c, s, n);
+  return c;
+}
+
+static unsigned hash(const char *s) {
+  unsigned h = 5381;
+  while (*s) h = h * 33 + (unsigned char)*s++;
+  return h;
+}
+
+static void table_init(struct table *t, unsigned size) {
+  t->buckets = calloc(size, sizeof(*t->buckets));
+  if (!t->buckets) exit(1);
+  t->size = size;
+  t->count = 0;
+}
+
+static struct entry **table_find(struct table *t, const char *key) {
+  struct entry **e = &t->buckets[hash(key) % t->size];
+  while (*e && strcmp((*e)->key, key)) e = &(*e)->next;
+  return e;
+}
+
+static void table_grow(struct table *t) {
+  struct table bigger;
+  unsigned i;
+  table_init(&bigger, t->size * 2);
+  for (i = 0; i != t->size; ++i) {
+    struct entry *e = t->buckets[i];
+    while (e) {
+      struct entry *next = e->next;
+      struct entry **slot = &bigger.buckets[hash(e->key) % bigger.size];
+      e->next = *slot;
+      *slot = e;
+      e = next;
+    }
+  }
+  bigger.count = t->count;
+  free(t->buckets);
+  *t = bigger;
+}
+
+static void table_put(struct table *t, const char *key, const char *value) {
+  struct entry **e = table_find(t, key);
+  if (*e) {
+    free((*e)->value);
+    (*e)->value = copy_string(value);
+    return;
+  }
+  *e = calloc(1, sizeof(**e));
+  if (!*e) exit(1);
+  (*e)->key = copy_string(key);
+  (*e)->value = copy_string(value);
+  if (++t->count > t->size * 2) table_grow(t);
+}
+
+static const char *table_get(struct table *t, const char *key) {
+  struct entry *e = *table_find(t, key);
+  if (!e) return NULL;
+  ++e->hits;
+  return e->value;
+}
+
+static int table_del(struct table *t, const char *key) {
+  struct entry **e = table_find(t, key);
+  struct entry *dead = *e;
+  if (!dead) return 0;
+  *e = dead->next;
+  free(dead->key);
+  free(dead->value);
+  free(dead);
+  --t->count;
+  return 1;
+}
+
+static void log_line(struct store *s, const char *fmt, ...) {
+  va_list ap;
+  if (!s->log) return;
+  va_start(ap, fmt);
+  vfprintf(s->log, fmt, ap);
+  va_end(ap);
+  fputc('\n', s->log);
+}
+
+static int cmd_set(struct store *s, char **args, int nargs) {
+  (void)nargs;
+  table_put(&s->table, args[0], args[1]);
+  log_line(s, "set %s %s", args[0], args[1]);
+  return 0;
+}
+
+static int cmd_get(struct store *s, char **args, int nargs) {
+  const char *v = table_get(&s->table, args[0]);
+  (void)nargs;
+  if (v) printf("%s\n", v);
+  else printf("(nil)\n");
+  return 0;
+}
+
+static int cmd_del(struct store *s, char **args, int nargs) {
+  (void)nargs;
+  if (table_del(&s->table, args[0])) log_line(s, "del %s", args[0]);
+  return 0;
+}
+
+static int cmd_append(struct store *s, char **args, int nargs) {
+  const char *old = table_get(&s->table, args[0]);
+  char *joined;
+  (void)nargs;
+  if (!old) return cmd_set(s, args, 2);
+  joined = malloc(strlen(old) + strlen(args[1]) + 1);
+  if (!joined) exit(1);
+  strcpy(joined, old);
+  strcat(joined, args[1]);
+  table_put(&s->table, args[0], joined);
+  log_line(s, "append %s %s", args[0], args[1]);
+  free(joined);
+  return 0;
+}
+
+static int cmd_dump(struct store *s, char **args, int nargs) {
+  unsigned i;
+  (void)args;
+  (void)nargs;
+  for (i = 0; i != s->table.size; ++i) {
+    struct entry *e;
+    for (e = s->table.buckets[i]; e; e = e->next)
+      printf("%s=%s (%u)\n", e->key, e->value, e->hits);
+  }
+  return 0;
+}
+
+static int cmd_quit(struct store *s, char **args, int nargs) {
+  (void)s;
+  (void)args;
+  (void)nargs;
+  return 1;
+}
+
+static const struct command commands[] = {
+  { "set", 2, cmd_set },
+  { "get", 1, cmd_get },
+  { "del", 1, cmd_del },
+  { "append", 2, cmd_append },
+  { "dump", 0, cmd_dump },
+  { "quit", 0, cmd_quit },
+};
+
+static int split(char *line, char **words, int max) {
+  int n = 0;
+  char *p = strtok(line, " \t\r\n");
+  while (p && n < max) {
+    words[n++] = p;
+    p = strtok(NULL, " \t\r\n");
+  }
+  return n;
+}
+
+static int run_command(struct store *s, char *line) {
+  char *words[4];
+  int n = split(line, words, 4);
+  unsigned i;
+  if (n == 0) return 0;
+  for (i = 0; i != sizeof(commands) / sizeof(commands[0]); ++i) {
+    if (strcmp(words[0], commands[i].name)) continue;
+    if (n - 1 < commands[i].nargs) {
+      fprintf(stderr, "%s needs %d arguments\n", words[0], commands[i].nargs);
+      return 0;
+    }
+    return commands[i].run(s, words + 1, n - 1);
+  }
+  fprintf(stderr, "unknown command %s\n", words[0]);
+  return 0;
+}
+
+static void replay(struct store *s, const char *path) {
+  char line[512];
+  FILE *in = fopen(path, "r");
+  FILE *log = s->log;
+  if (!in) return;
+  s->log = NULL;
+  while (fgets(line, sizeof(line), in))
+    run_command(s, line);
+  s->log = log;
+  fclose(in);
+}
+
+int main(int argc, char **argv) {
+  struct store s;
+  char line[512];
+  const char *path = argc > 1 ? argv[1] : getenv("KVSTORE_LOG");
+
+  table_init(&s.table, 16);
+  s.log = NULL;
+  s.prompt = getenv("KVSTORE_PROMPT");
+  if (path) {
+    replay(&s, path);
+    s.log = fopen(path, "a");
+  }
+
+  for (;;) {
+    if (s.prompt) fputs(s.prompt, stdout);
+    if (!fgets(line, sizeof(line), stdin)) break;
+    if (run_command(&s, line)) break;
+  }
+
+  if (s.log) fclose(s.log);
+  return 0;
+}
@@ -0,0 +1,52 @@
+/* Counts the lines, words and characters of its input; the smallest
+   benchmark program. Input is the only source, the counts the only sink. */
+
+#include <stdio.h>
+
+struct counts {
+  long lines, words, chars;
+};
+
+static int is_space(int c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static void count(FILE *in, struct counts *n) {
+  int c, in_word = 0;
+  while ((c = fgetc(in)) != EOF) {
+    ++n->chars;
+    if (c == '\n') ++n->lines;
+    if (is_space(c)) {
+      in_word = 0;
+    } else if (!in_word) {
+      in_word = 1;
+      ++n->words;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  struct counts total = { 0, 0, 0 };
+  int i;
+
+  if (argc < 2) {
+    count(stdin, &total);
+  } else {
+    for (i = 1; i < argc; ++i) {
+      struct counts n = { 0, 0, 0 };
+      FILE *in = fopen(argv[i], "r");
+      if (!in) {
+        perror(argv[i]);
+        continue;
+      }
+      count(in, &n);
+      fclose(in);
+      printf("%7ld %7ld %7ld %s\n", n.lines, n.words, n.chars, argv[i]);
+      total.lines += n.lines;
+      total.words += n.words;
+      total.chars += n.chars;
+    }
+  }
+  printf("%7ld %7ld %7ld total\n", total.lines, total.words, total.chars);
+  return 0;
+}
@@ -0,0 +1,115 @@
+#!/usr/bin/env python
+#
+# Writes a synthetic C program of the given number of functions to stdout,
+# for the larger benchmark programs. The functions form a call graph with
+# recursive cycles; they pass data through arguments, structs, globals and
+# heap buffers; and some of them read input or write output. The output
+# depends only on the arguments, with any Python.
+#
+#   gen-program.py FUNCTIONS [SEED]
+
+import sys
+
+
+class Random(object):
+    """A 64-bit LCG, so that every Python generates the same programs"""
+
+    def __init__(self, seed):
+        self.state = (seed * 6364136223846793005 + 1442695040888963407) % 2**64
+
+    def below(self, n):
+        self.state = (self.state * 6364136223846793005 +
+                      1442695040888963407) % 2**64
+        return (self.state >> 33) % n
+
+
+def function(out, r, i, count):
+    out.append('int f%d(int a, int *p, struct rec *r) {' % i)
+    out.append('  int i, t = a;')
+
+    kind = r.below(8)
+    if kind in (1, 2):
+        out.append('  char buf[16];')
+    if kind == 0:
+        out.append('  t += getchar();')
+    elif kind == 1:
+        out.append('  if (fgets(buf, sizeof(buf), stdin)) t += buf[0];')
+    elif kind == 2:
+        out.append('  buf[0] = (char)t;')
+        out.append('  buf[1] = 0;')
+        out.append('  r->name = strdup(buf);')
+
+    out.append('  for (i = 0; i < (a & 7); ++i) {')
+    out.append('    t = t * %d + p[i & 3];' % (r.below(9) + 2))
+    out.append('    table[(t + %d) & 255] ^= t;' % r.below(256))
+    out.append('  }')
+
+    # Mostly calls to later functions, and sometimes back to an earlier
+    # one, which makes cycles
+    for c in range(r.below(4)):
+        if i + 1 < count and r.below(5):
+            callee = i + 1 + r.below(min(count - i - 1, 32))
+        else:
+            callee = r.below(i + 1)
+        out.append('  if (depth++ < %d) t ^= f%d(t + %d, p, r);' %
+                   (count, callee, c))
+        out.append('  --depth;')
+
+    field = r.below(3)
+    if field == 0:
+        out.append('  r->value += t;')
+    elif field == 1:
+        out.append('  r->next = r->next ? r->next : malloc(sizeof(*r));')
+        out.append('  if (r->next) r->next->value = t;')
+    else:
+        out.append('  p[t & 3] = r->value;')
+
+    if kind == 3:
+        out.append('  printf("%d\\n", t);')
+    elif kind == 4:
+        out.append('  fputs(r->name ? r->name : "", stdout);')
+    out.append('  return t;')
+    out.append('}')
+    out.append('')
+
+
+def main(argv):
+    if len(argv) < 2:
+        sys.stderr.write('usage: %s FUNCTIONS [SEED]\n' % argv[0])
+        return 1
+    count = int(argv[1])
+    r = Random(int(argv[2]) if len(argv) > 2 else 1)
+
+    out = ['/* Generated by gen-program.py %d */' % count, '',
+           '#include <stdio.h>',
+           '#include <stdlib.h>',
+           '#include <string.h>', '',
+           'struct rec {',
+           '  int value;',
+           '  char *name;',
+           '  struct rec *next;',
+           '};', '',
+           'static int table[256];',
+           'static int depth;', '']
+    for i in range(count):
+        out.append('int f%d(int a, int *p, struct rec *r);' % i)
+    out.append('')
+    for i in range(count):
+        function(out, r, i, count)
+
+    out.append('int main(int argc, char **argv) {')
+    out.append('  int p[4] = { 0, 1, 2, 3 };')
+    out.append('  struct rec r = { 0, 0, 0 };')
+    out.append('  (void)argv;')
+    for i in range(0, count, max(1, count // 16)):
+        out.append('  p[%d] ^= f%d(argc + %d, p, &r);' % (i & 3, i, i))
+    out.append('  printf("%d %d\\n", r.value, table[argc & 255]);')
+    out.append('  return 0;')
+    out.append('}')
+
+    sys.stdout.write('\n'.join(out) + '\n')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
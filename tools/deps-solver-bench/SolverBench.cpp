@@ -0,0 +1,578 @@
+//===-- SolverBench.cpp -----------------------------------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Benchmarks LHConstraintKit in isolation, on synthetic constraint graphs or
+// on constraints written by -deps-dump-constraints. Every solver entry point
+// is timed on a fresh kit, and its solution is checked against a simple
+// worklist solver.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Constraints/LHConstraintKit.h"
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/system_error.h"
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+using namespace deps;
+using namespace llvm;
+
+static cl::opt<std::string> Generator(
+  "gen", cl::desc("Synthetic constraints: chain, scc, fanout or powerlaw"),
+  cl::init("chain"));
+static cl::opt<std::string> Replay(
+  "replay", cl::desc("Replay constraints written by -deps-dump-constraints"),
+  cl::value_desc("file"), cl::init(""));
+static cl::opt<unsigned> NumVars(
+  "vars", cl::desc("Number of variables to generate"), cl::init(100000));
+static cl::opt<unsigned> Degree(
+  "degree", cl::desc("Average out-degree, SCC size or join width"),
+  cl::init(4));
+static cl::opt<unsigned> NumSources(
+  "sources", cl::desc("Number of source kinds to generate for solveLeastMT and solveLabels"),
+  cl::init(100));
+static cl::opt<unsigned> Seed(
+  "seed", cl::desc("Seed for the generators"), cl::init(1));
+static cl::opt<bool> Verify(
+  "verify", cl::desc("Check every solution against a reference solver"),
+  cl::init(true));
+static cl::opt<bool> Compact(
+  "compact", cl::desc("Compact the kits before querying demand solutions and after solveLeastMT, and check their solutions again"),
+  cl::init(true));
+
+namespace {
+
+// Elements of a constraint are variable indices or one of these
+enum { Low = -1, High = -2 };
+
+// The lhs elements are joined
+struct Record {
+  unsigned Kind;
+  std::vector<int> Lhs;
+  int Rhs;
+};
+
+struct Problem {
+  unsigned NumVars;
+  std::vector<std::string> Kinds;
+  std::vector<Record> Records;
+  // Indices of the kinds solved with solveLeastMT
+  std::vector<unsigned> Sources;
+
+  void add(unsigned Kind, int Lhs, int Rhs) {
+    Record R;
+    R.Kind = Kind;
+    R.Lhs.push_back(Lhs);
+    R.Rhs = Rhs;
+    Records.push_back(R);
+  }
+};
+
+// The first two kinds of generated problems
+enum { DefaultKind = 0, DefaultSinksKind = 1 };
+
+// xorshift64*, so that problems are the same everywhere
+class Random {
+public:
+  explicit Random(uint64_t Seed) : State(Seed * 2685821657736338717ULL + 1) {}
+  unsigned below(unsigned N) {
+    State ^= State >> 12;
+    State ^= State << 25;
+    State ^= State >> 27;
+    return (unsigned)((State * 2685821657736338717ULL) >> 32) % N;
+  }
+private:
+  uint64_t State;
+};
+
+} // end anonymous namespace
+
+//===----------------------------------------------------------------------===//
+// Generators
+//===----------------------------------------------------------------------===//
+
+// Adds the seeds every generated problem has: a few constants in the
+// default kinds and a handful of tainted variables per source kind.
+static void addSeeds(Problem &P, Random &R) {
+  unsigned N = P.NumVars;
+  for (unsigned i = 0, e = N / 1000 + 1; i != e; ++i) {
+    P.add(DefaultKind, High, R.below(N));
+    P.add(DefaultKind, R.below(N), Low);
+    P.add(DefaultSinksKind, High, R.below(N));
+  }
+  for (unsigned S = 0; S != NumSources; ++S) {
+    unsigned Kind = P.Kinds.size();
+    P.Kinds.push_back("source" + utostr(S));
+    P.Sources.push_back(Kind);
+    for (unsigned i = 0, e = 1 + R.below(4); i != e; ++i)
+      P.add(Kind, High, R.below(N));
+  }
+}
+
+// v0 <= v1 <= ... <= vN-1
+static void generateChain(Problem &P, Random &) {
+  for (unsigned i = 1; i < P.NumVars; ++i)
+    P.add(DefaultKind, i - 1, i);
+}
+
+// Cycles of Degree variables, with edges from each cycle to later ones
+static void generateSCCs(Problem &P, Random &R) {
+  unsigned Size = std::max(2u, (unsigned)Degree);
+  for (unsigned Start = 0; Start < P.NumVars; Start += Size) {
+    unsigned End = std::min(Start + Size, P.NumVars);
+    for (unsigned i = Start; i != End; ++i)
+      P.add(DefaultKind, i, i + 1 == End ? Start : i + 1);
+    if (End < P.NumVars)
+      P.add(DefaultKind, Start + R.below(End - Start),
+            End + R.below(P.NumVars - End));
+  }
+}
+
+// Each variable is bounded by the join of Degree earlier variables
+static void generateFanout(Problem &P, Random &R) {
+  for (unsigned i = 1; i < P.NumVars; ++i) {
+    Record Rec;
+    Rec.Kind = DefaultKind;
+    for (unsigned j = 0; j != Degree; ++j)
+      Rec.Lhs.push_back(R.below(i));
+    Rec.Rhs = i;
+    P.Records.push_back(Rec);
+  }
+}
+
+// Degree * NumVars edges whose targets are picked by preferential
+// attachment, giving a power-law in-degree distribution
+static void generatePowerLaw(Problem &P, Random &R) {
+  std::vector<unsigned> Targets;
+  for (unsigned i = 0, e = Degree * P.NumVars; i != e; ++i) {
+    unsigned Source = R.below(P.NumVars);
+    unsigned Target = Targets.empty() || R.below(4) == 0
+                      ? R.below(P.NumVars)
+                      : Targets[R.below(Targets.size())];
+    Targets.push_back(Target);
+    P.add(DefaultKind, Source, Target);
+  }
+}
+
+static bool generate(Problem &P) {
+  P.NumVars = NumVars;
+  P.Kinds.push_back("default");
+  P.Kinds.push_back("default-sinks");
+
+  Random R(Seed);
+  if (Generator == "chain") generateChain(P, R);
+  else if (Generator == "scc") generateSCCs(P, R);
+  else if (Generator == "fanout") generateFanout(P, R);
+  else if (Generator == "powerlaw") generatePowerLaw(P, R);
+  else {
+    errs() << "Unknown generator: " << Generator << "\n";
+    return false;
+  }
+  addSeeds(P, R);
+  return true;
+}
+
+//===----------------------------------------------------------------------===//
+// Replay
+//===----------------------------------------------------------------------===//
+
+static bool parseElem(StringRef Token, unsigned NumVars, int &Elem) {
+  if (Token == "L") Elem = Low;
+  else if (Token == "H") Elem = High;
+  else if (Token.getAsInteger(10, Elem) || Elem < 0 || (unsigned)Elem >= NumVars)
+    return false;
+  return true;
+}
+
+// Reads the format of LHConstraintKit::writeConstraints. Kinds are written
+// in no particular order, so the default kinds are put first here.
+static bool parseDump(MemoryBuffer &Buffer, Problem &P) {
+  P.Kinds.push_back("default");
+  P.Kinds.push_back("default-sinks");
+  unsigned Kind = ~0U;
+
+  SmallVector<StringRef, 16> Lines, Tokens;
+  Buffer.getBuffer().split(Lines, "\n", -1, false);
+  if (Lines.size() < 2 || Lines[0] != "deps-constraints 1" ||
+      !Lines[1].startswith("vars ") ||
+      Lines[1].substr(5).getAsInteger(10, P.NumVars))
+    return false;
+
+  for (unsigned i = 2, e = Lines.size(); i != e; ++i) {
+    StringRef Line = Lines[i];
+    if (Line.startswith("kind ")) {
+      StringRef Name = Line.substr(5);
+      if (Name == "default") Kind = DefaultKind;
+      else if (Name == "default-sinks") Kind = DefaultSinksKind;
+      else {
+        Kind = P.Kinds.size();
+        P.Kinds.push_back(Name.str());
+        if (Name != "implicit" && Name != "implicit-sinks")
+          P.Sources.push_back(Kind);
+      }
+      continue;
+    }
+
+    // c <lhs> <rhs>
+    Tokens.clear();
+    Line.split(Tokens, " ", -1, false);
+    Record R;
+    int Lhs;
+    if (Kind == ~0U || Tokens.size() != 3 || Tokens[0] != "c" ||
+        !parseElem(Tokens[1], P.NumVars, Lhs) ||
+        !parseElem(Tokens[2], P.NumVars, R.Rhs))
+      return false;
+    R.Kind = Kind;
+    R.Lhs.push_back(Lhs);
+    P.Records.push_back(R);
+  }
+  return true;
+}
+
+//===----------------------------------------------------------------------===//
+// Reference solver
+//===----------------------------------------------------------------------===//
+
+// Returns whether each variable is high in the least (or greatest)
+// solution of the constraints of the given kinds
+static std::vector<char> referenceSolution(const Problem &P,
+                                           const std::set<unsigned> &Kinds,
+                                           bool Greatest) {
+  // Least: high flows from lhs to rhs. Greatest: low flows from rhs to
+  // every lhs element.
+  std::vector<std::vector<unsigned> > Uses(P.NumVars);
+  std::vector<char> Changed(P.NumVars);
+  std::vector<unsigned> WorkList;
+
+  for (unsigned i = 0, e = P.Records.size(); i != e; ++i) {
+    const Record &R = P.Records[i];
+    if (!Kinds.count(R.Kind)) continue;
+    if (Greatest) {
+      if (R.Rhs >= 0) Uses[R.Rhs].push_back(i);
+      if (R.Rhs != Low) continue;
+      for (unsigned j = 0; j != R.Lhs.size(); ++j) {
+        int V = R.Lhs[j];
+        if (V >= 0 && !Changed[V]) { Changed[V] = 1; WorkList.push_back(V); }
+      }
+    } else {
+      for (unsigned j = 0; j != R.Lhs.size(); ++j) {
+        int V = R.Lhs[j];
+        if (V >= 0) Uses[V].push_back(i);
+        if (V == High && R.Rhs >= 0 && !Changed[R.Rhs]) {
+          Changed[R.Rhs] = 1;
+          WorkList.push_back(R.Rhs);
+        }
+      }
+    }
+  }
+
+  while (!WorkList.empty()) {
+    unsigned V = WorkList.back();
+    WorkList.pop_back();
+    for (unsigned i = 0, e = Uses[V].size(); i != e; ++i) {
+      const Record &R = P.Records[Uses[V][i]];
+      if (!Greatest) {
+        if (R.Rhs >= 0 && !Changed[R.Rhs]) {
+          Changed[R.Rhs] = 1;
+          WorkList.push_back(R.Rhs);
+        }
+        continue;
+      }
+      for (unsigned j = 0; j != R.Lhs.size(); ++j) {
+        int W = R.Lhs[j];
+        if (W >= 0 && !Changed[W]) { Changed[W] = 1; WorkList.push_back(W); }
+      }
+    }
+  }
+
+  // Changed means high for least solutions and low for greatest ones
+  if (Greatest)
+    for (unsigned i = 0; i != P.NumVars; ++i) Changed[i] = !Changed[i];
+  return Changed;
+}
+
+//===----------------------------------------------------------------------===//
+// Benchmarks
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+// A kit holding all the constraints of a problem
+class Instance {
+public:
+  explicit Instance(const Problem &P) : P(P) {
+    for (unsigned i = 0; i != P.NumVars; ++i) Vars.push_back(&Kit.newVar("v"));
+    for (std::vector<Record>::const_iterator R = P.Records.begin(),
+         E = P.Records.end(); R != E; ++R) {
+      std::set<const ConsElem *> Lhs;
+      for (unsigned j = 0; j != R->Lhs.size(); ++j) Lhs.insert(&elem(R->Lhs[j]));
+      Kit.addConstraint(P.Kinds[R->Kind], Kit.upperBound(Lhs), elem(R->Rhs));
+    }
+  }
+
+  std::set<std::string> names(const std::set<unsigned> &Kinds) const {
+    std::set<std::string> Names;
+    for (std::set<unsigned>::const_iterator I = Kinds.begin(), E = Kinds.end();
+         I != E; ++I)
+      Names.insert(P.Kinds[*I]);
+    return Names;
+  }
+
+  // Returns the number of variables on which A and B differ
+  unsigned differ(ConsSoln &A, ConsSoln &B) {
+    if (!Verify) return 0;
+    unsigned Wrong = 0;
+    for (unsigned i = 0; i != P.NumVars; ++i)
+      if (&A.subst(*Vars[i]) != &B.subst(*Vars[i])) ++Wrong;
+    return Wrong;
+  }
+
+  // Returns the number of variables on which S and the reference differ
+  unsigned check(ConsSoln &S, const std::set<unsigned> &Kinds, bool Greatest) {
+    if (!Verify) return 0;
+    std::vector<char> Expected = referenceSolution(P, Kinds, Greatest);
+    unsigned Wrong = 0;
+    for (unsigned i = 0; i != P.NumVars; ++i) {
+      bool High = &S.subst(*Vars[i]) == &Kit.highConstant();
+      if (High != (bool)Expected[i]) ++Wrong;
+    }
+    return Wrong;
+  }
+
+  // A label per source kind, seeded with the variables the kind makes
+  // high. Returns false if a source kind has any other constraints, which
+  // labels can't express.
+  bool labelSeeds(LHConstraintKit::LabelSeeds &Seeds) {
+    std::vector<int> LabelOf(P.Kinds.size(), -1);
+    for (unsigned i = 0; i != P.Sources.size(); ++i)
+      LabelOf[P.Sources[i]] = i;
+    for (std::vector<Record>::const_iterator R = P.Records.begin(),
+         E = P.Records.end(); R != E; ++R) {
+      int Label = LabelOf[R->Kind];
+      if (Label < 0) continue;
+      if (R->Lhs.size() != 1 || R->Lhs[0] != High || R->Rhs < 0)
+        return false;
+      Seeds.push_back(std::make_pair(&elem(R->Rhs), (unsigned)Label));
+    }
+    return true;
+  }
+
+  LHConstraintKit Kit;
+
+private:
+  const ConsElem &elem(int E) {
+    if (E == Low) return Kit.lowConstant();
+    if (E == High) return Kit.highConstant();
+    return *Vars[E];
+  }
+
+  const Problem &P;
+  std::vector<const ConsVar *> Vars;
+};
+
+} // end anonymous namespace
+
+// Peak resident set size of the process so far, in kilobytes
+static long peakRSS() {
+  struct rusage Usage;
+  if (::getrusage(RUSAGE_SELF, &Usage)) return 0;
+#ifdef __APPLE__
+  return Usage.ru_maxrss / 1024;
+#else
+  return Usage.ru_maxrss;
+#endif
+}
+
+static double now() {
+  return TimeRecord::getCurrentTime(true).getWallTime();
+}
+
+static unsigned Failures = 0;
+
+static void report(StringRef Phase, double Seconds, long PeakBefore,
+                   unsigned Wrong) {
+  long Peak = peakRSS();
+  outs() << format("%-16s %10.3fs %10ldKB peak (+%ldKB)", Phase.str().c_str(),
+                   Seconds, Peak, Peak - PeakBefore);
+  if (Verify) outs() << (Wrong ? "  WRONG: " + utostr(Wrong) : "  ok");
+  outs() << "\n";
+  if (Wrong) ++Failures;
+}
+
+static void run(const Problem &P) {
+  std::set<unsigned> Defaults;
+  Defaults.insert(DefaultKind);
+  Defaults.insert(DefaultSinksKind);
+
+  outs() << P.NumVars << " variables, " << P.Records.size()
+         << " constraints, " << P.Kinds.size() << " kinds\n";
+
+  {
+    long Peak = peakRSS();
+    double Start = now();
+    Instance I(P);
+    report("build", now() - Start, Peak, 0);
+  }
+
+  // least- and greatestSolution of the default kinds
+  for (unsigned Greatest = 0; Greatest != 2; ++Greatest) {
+    Instance I(P);
+    long Peak = peakRSS();
+    double Start = now();
+    ConsSoln *S = Greatest ? I.Kit.greatestSolution(I.names(Defaults))
+                           : I.Kit.leastSolution(I.names(Defaults));
+    double Time = now() - Start;
+    report(Greatest ? "greatestSolution" : "leastSolution", Time, Peak,
+           I.check(*S, Defaults, Greatest));
+    delete S;
+  }
+
+  // Demand solutions of the default kinds, which a kit only builds graphs
+  // for while the kinds haven't been solved in full. They answer lazily and
+  // remember their answers, so with -compact the kit (and its component
+  // remaps) goes before the first query.
+  {
+    Instance I(P);
+    long Peak = peakRSS();
+    double Start = now();
+    std::vector<ConsSoln *> DemandSolns;
+    for (unsigned Greatest = 0; Greatest != 2; ++Greatest)
+      DemandSolns.push_back(Greatest
+                            ? I.Kit.greatestDemandSolution(I.names(Defaults))
+                            : I.Kit.leastDemandSolution(I.names(Defaults)));
+    if (Compact)
+      I.Kit.compact();
+    double Time = now() - Start;
+
+    unsigned Wrong = 0;
+    for (unsigned Greatest = 0; Greatest != 2; ++Greatest)
+      Wrong += I.check(*DemandSolns[Greatest], Defaults, Greatest);
+    report(Compact ? "demandSolution+compact" : "demandSolution", Time, Peak,
+           Wrong);
+
+    for (unsigned i = 0; i != DemandSolns.size(); ++i) delete DemandSolns[i];
+  }
+
+  // solveMT of each default kind, then solveLeastMT of the sources
+  {
+    Instance I(P);
+    long Peak = peakRSS();
+    double Start = now();
+    I.Kit.solveMT(P.Kinds[DefaultKind]);
+    I.Kit.solveMT(P.Kinds[DefaultSinksKind]);
+    double Time = now() - Start;
+
+    // Kept, along with the solutions of the sources, to be checked again
+    // once the kit is compacted
+    std::vector<ConsSoln *> DefaultSolns;
+    unsigned Wrong = 0;
+    for (unsigned Greatest = 0; Greatest != 2; ++Greatest) {
+      ConsSoln *S = Greatest ? I.Kit.greatestSolution(I.names(Defaults))
+                             : I.Kit.leastSolution(I.names(Defaults));
+      Wrong += I.check(*S, Defaults, Greatest);
+      DefaultSolns.push_back(S);
+    }
+    report("solveMT", Time, Peak, Wrong);
+
+    std::vector<std::string> Sources;
+    for (unsigned i = 0; i != P.Sources.size(); ++i)
+      Sources.push_back(P.Kinds[P.Sources[i]]);
+
+    Peak = peakRSS();
+    Start = now();
+    std::vector<ConsSoln *> Solns = I.Kit.solveLeastMT(Sources, true);
+    Time = now() - Start;
+
+    Wrong = 0;
+    for (unsigned i = 0; i != Solns.size(); ++i) {
+      std::set<unsigned> Kinds(Defaults);
+      Kinds.insert(P.Sources[i]);
+      Wrong += I.check(*Solns[i], Kinds, false);
+    }
+    report("solveLeastMT", Time, Peak, Wrong);
+
+    // The same solutions from solveLabels, a label per source kind, which
+    // must agree with solveLeastMT's on every variable
+    std::vector<ConsSoln *> Labels;
+    LHConstraintKit::LabelSeeds Seeds;
+    if (I.labelSeeds(Seeds)) {
+      Peak = peakRSS();
+      Start = now();
+      Labels = I.Kit.solveLabels(Seeds, P.Sources.size(), true);
+      Time = now() - Start;
+
+      Wrong = 0;
+      for (unsigned i = 0; i != Labels.size(); ++i)
+        Wrong += I.differ(*Labels[i], *Solns[i]);
+      report("solveLabels", Time, Peak, Wrong);
+    } else {
+      outs() << "solveLabels: skipped, the source kinds aren't just seeds\n";
+    }
+
+    // Everything handed out must still answer the same without the kit's
+    // solver state
+    if (Compact) {
+      Peak = peakRSS();
+      Start = now();
+      I.Kit.compact();
+      Time = now() - Start;
+
+      Wrong = 0;
+      for (unsigned i = 0; i != DefaultSolns.size(); ++i)
+        Wrong += I.check(*DefaultSolns[i], Defaults, i % 2);
+      for (unsigned i = 0; i != Solns.size(); ++i) {
+        std::set<unsigned> Kinds(Defaults);
+        Kinds.insert(P.Sources[i]);
+        Wrong += I.check(*Solns[i], Kinds, false);
+      }
+      for (unsigned i = 0; i != Labels.size(); ++i)
+        Wrong += I.differ(*Labels[i], *Solns[i]);
+      report("compact", Time, Peak, Wrong);
+    }
+
+    for (unsigned i = 0; i != DefaultSolns.size(); ++i) delete DefaultSolns[i];
+    for (unsigned i = 0; i != Solns.size(); ++i) delete Solns[i];
+    for (unsigned i = 0; i != Labels.size(); ++i) delete Labels[i];
+  }
+}
+
+int main(int argc, char **argv) {
+  llvm_shutdown_obj Shutdown;
+  cl::ParseCommandLineOptions(argc, argv, "LHConstraintKit benchmark\n");
+
+  Problem P;
+  if (Replay.empty()) {
+    if (!generate(P)) return 1;
+  } else {
+    OwningPtr<MemoryBuffer> Buffer;
+    if (error_code EC = MemoryBuffer::getFileOrSTDIN(Replay, Buffer)) {
+      errs() << "Cannot read " << Replay << ": " << EC.message() << "\n";
+      return 1;
+    }
+    if (!parseDump(*Buffer, P)) {
+      errs() << Replay << " is not a constraint dump\n";
+      return 1;
+    }
+  }
+
+  run(P);
+  return Failures != 0;
+}